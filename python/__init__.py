@@ -11,6 +11,7 @@ RecordReader=api.RecordReader
 RecordDatabase=api.RecordDatabase
 RecordWriter=api.RecordWriter
 PhraseTable=api.PhraseTable
+InverseIndex=api.InverseIndex
 Calendar=api.Calendar
 Date=api.Date
 WikiConverter=api.WikiConverter
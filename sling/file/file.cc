@@ -267,11 +267,13 @@ Status File::WriteContents(const string &filename,
 Status File::Read(void *buffer, size_t size) {
   // Keep reading partial data until all data has been read. Return error if
   // then end of the file is reached or a read error occurred.
+  char *ptr = static_cast<char *>(buffer);
   while (size > 0) {
     uint64 bytes;
-    Status st = Read(buffer, size, &bytes);
+    Status st = Read(ptr, size, &bytes);
     if (!st.ok()) return st;
     if (bytes == 0) return Status(1, "Truncated", filename());
+    ptr += bytes;
     size -= bytes;
   }
   return Status::OK;
@@ -156,11 +156,71 @@ int RecordFile::IndexPage::Find(uint64 fp) const {
   return lo;
 }
 
+// Mixes the bits of a key fingerprint. Record files are sharded by fingerprint
+// modulo the number of shards, so the low bits of the fingerprints of the keys
+// in a file are not uniformly distributed.
+static inline uint64 MixBits(uint64 fp) {
+  fp ^= fp >> 33;
+  fp *= 0xff51afd7ed558ccdULL;
+  fp ^= fp >> 33;
+  fp *= 0xc4ceb9fe1a85ec53ULL;
+  fp ^= fp >> 33;
+  return fp;
+}
+
+RecordFile::BloomFilter::BloomFilter(int64 keys, int bits_per_key) {
+  int64 bits = std::max(keys * bits_per_key, int64{1});
+  blocks_ = (bits + kBlockWords * 64 - 1) / (kBlockWords * 64);
+  probes_ = std::min(std::max(bits_per_key * 69 / 100, 1), 16);
+  words_.resize(1 + blocks_ * kBlockWords);
+  words_[0] = blocks_ | (static_cast<uint64>(probes_) << 32);
+}
+
+RecordFile::BloomFilter::BloomFilter(const Slice &data) {
+  // Leave the filter invalid if the data is corrupt.
+  if (data.size() < sizeof(uint64) || data.size() % sizeof(uint64) != 0) return;
+  uint64 header;
+  memcpy(&header, data.data(), sizeof(uint64));
+  uint32 blocks = header & 0xFFFFFFFF;
+  uint32 probes = header >> 32;
+  if (blocks == 0 || probes == 0) return;
+  if (data.size() != (1 + blocks * kBlockWords) * sizeof(uint64)) return;
+  words_.resize(1 + blocks * kBlockWords);
+  memcpy(words_.data(), data.data(), data.size());
+  blocks_ = blocks;
+  probes_ = probes;
+}
+
+void RecordFile::BloomFilter::Add(uint64 fp) {
+  uint64 h = MixBits(fp);
+  uint64 *block = &words_[1 + ((h >> 32) * blocks_ >> 32) * kBlockWords];
+  uint32 bit = h;
+  uint32 delta = (bit >> 17) | (bit << 15);
+  for (int i = 0; i < probes_; ++i) {
+    int b = bit % (kBlockWords * 64);
+    block[b / 64] |= 1ULL << (b % 64);
+    bit += delta;
+  }
+}
+
+bool RecordFile::BloomFilter::MayContain(uint64 fp) const {
+  uint64 h = MixBits(fp);
+  const uint64 *block = &words_[1 + ((h >> 32) * blocks_ >> 32) * kBlockWords];
+  uint32 bit = h;
+  uint32 delta = (bit >> 17) | (bit << 15);
+  for (int i = 0; i < probes_; ++i) {
+    int b = bit % (kBlockWords * 64);
+    if ((block[b / 64] & (1ULL << (b % 64))) == 0) return false;
+    bit += delta;
+  }
+  return true;
+}
+
 int RecordFile::ReadHeader(const char *data, Header *header) {
   // Read record type.
   const char *p = data;
   header->record_type = static_cast<RecordType>(*p++);
-  if (header->record_type > INDEX_RECORD) return -1;
+  if (header->record_type > BLOCK_RECORD) return -1;
 
   // Read record length.
   p = Varint::Parse64(p, &header->record_size);
@@ -197,28 +257,50 @@ int RecordFile::WriteHeader(const Header &header, char *data) {
 RecordReader::RecordReader(File *file,
                            const RecordFileOptions &options,
                            bool owned)
-    : file_(file), owned_(owned) {
-  // Allocate input buffer.
-  CHECK_GE(options.buffer_size, sizeof(FileHeader));
-  input_.resize(options.buffer_size);
-  CHECK(Fill());
+    : file_(file), owned_(owned), buffer_size_(options.buffer_size) {
+  // Map file into memory if requested. Otherwise the file is read through the
+  // input buffer.
+  if (options.memory_map) {
+    uint64 size;
+    if (file_->GetSize(&size) && size > 0) {
+      mapping_ = static_cast<char *>(file_->MapMemory(0, size));
+      if (mapping_ != nullptr) mapped_size_ = size;
+    }
+  }
+
+  // Get file header from the mapping or the input buffer.
+  const char *data;
+  size_t available;
+  if (mapping_ != nullptr) {
+    data = mapping_;
+    available = mapped_size_;
+  } else {
+    // Allocate input buffer.
+    CHECK_GE(options.buffer_size, sizeof(FileHeader));
+    input_.resize(options.buffer_size);
+    CHECK(Fill());
+    data = input_.begin();
+    available = input_.size();
+  }
 
   // Read record file header.
-  CHECK_GE(input_.size(), 8)
+  CHECK_GE(available, 8)
       << "Record file truncated: " << file->filename();
   memset(&info_, 0, sizeof(FileHeader));
-  memcpy(&info_, input_.begin(), 8);
+  memcpy(&info_, data, 8);
   CHECK(info_.magic == MAGIC1 || info_.magic == MAGIC2)
       << "Not a record file: " << file->filename();
-  CHECK_GE(input_.size(), info_.hdrlen);
+  CHECK_GE(available, info_.hdrlen);
   size_t hdrlen = info_.hdrlen;
-  memcpy(&info_, input_.begin(), std::min(hdrlen, sizeof(FileHeader)));
-  input_.consumed(hdrlen);
+  memcpy(&info_, data, std::min(hdrlen, sizeof(FileHeader)));
+  if (mapping_ == nullptr) input_.consumed(hdrlen);
   position_ = hdrlen;
 
   // Get size of file. The index records are always at the end of the file.
   if (info_.index_start != 0) {
     size_ = info_.index_start;
+  } else if (mapping_ != nullptr) {
+    size_ = mapped_size_;
   } else {
     CHECK(file_->GetSize(&size_));
   }
@@ -239,6 +321,12 @@ RecordReader::~RecordReader() {
 }
 
 Status RecordReader::Close() {
+  if (mapping_ != nullptr) {
+    Status s = File::FreeMappedMemory(mapping_, mapped_size_);
+    mapping_ = nullptr;
+    mapped_size_ = 0;
+    if (!s.ok()) return s;
+  }
   if (owned_ && file_) {
     Status s = file_->Close();
     file_ = nullptr;
@@ -257,6 +345,28 @@ Status RecordReader::Fill() {
 }
 
 Status RecordReader::Read(Record *record) {
+  if (info_.compression != BLOCK_SNAPPY) return ReadRecord(record);
+  for (;;) {
+    // Return next record from the current block.
+    if (block_offset_ < block_.size()) {
+      return ReadBlockRecord(block_, block_position_, &block_offset_, record);
+    }
+
+    // Read next block. Other records are returned directly.
+    Status s = ReadRecord(record);
+    if (!s.ok()) return s;
+    if (record->type != BLOCK_RECORD) return Status::OK;
+    s = DecompressBlock(*record, &block_);
+    if (!s.ok()) return s;
+    block_position_ = record->position;
+    block_offset_ = 0;
+  }
+}
+
+Status RecordReader::ReadRecord(Record *record) {
+  if (mapping_ != nullptr) {
+    return ReadMapped(&position_, record, &decompressed_data_);
+  }
   for (;;) {
     // Fill input buffer if it is nearly empty.
     if (input_.size() < MAX_HEADER_LEN) {
@@ -298,39 +408,230 @@ Status RecordReader::Read(Record *record) {
       }
     }
 
-    // Get record key.
-    if (hdr.key_size > 0) {
-      record->key = Slice(input_.begin(), hdr.key_size);
-      input_.consumed(hdr.key_size);
+    // Get record key and value.
+    Status s = Decode(hdr, input_.begin(), record, &decompressed_data_);
+    if (!s.ok()) return s;
+    input_.consumed(hdr.record_size);
+    position_ += hdr.record_size;
+    return Status::OK;
+  }
+}
+
+Status RecordReader::ReadMapped(uint64 *position, Record *record,
+                                RecordBuffer *decompressed) const {
+  for (;;) {
+    // Read record header. The header is copied to a zero-padded buffer near
+    // the end of the file to prevent reading past the end of the mapping.
+    if (*position >= mapped_size_) return Status(1, "Record truncated");
+    const char *data = mapping_ + *position;
+    uint64 available = mapped_size_ - *position;
+    Header hdr;
+    int hdrsize;
+    if (available >= MAX_HEADER_LEN) {
+      hdrsize = ReadHeader(data, &hdr);
     } else {
-      record->key = Slice();
-    }
-
-    // Get record value.
-    size_t value_size = hdr.record_size - hdr.key_size;
-    if (info_.compression == SNAPPY) {
-      // Decompress record value.
-      decompressed_data_.clear();
-      snappy::ByteArraySource source(input_.begin(), value_size);
-      CHECK(snappy::Uncompress(&source, &decompressed_data_));
-      input_.consumed(value_size);
-      record->value =
-          Slice(decompressed_data_.begin(), decompressed_data_.end());
-    } else if (info_.compression == UNCOMPRESSED) {
-      record->value = Slice(input_.begin(), value_size);
-      input_.consumed(value_size);
+      char header[MAX_HEADER_LEN];
+      memset(header, 0, MAX_HEADER_LEN);
+      memcpy(header, data, available);
+      hdrsize = ReadHeader(header, &hdr);
+    }
+    if (hdrsize < 0) return Status(1, "Corrupt record header");
+
+    // Skip filler records.
+    if (hdr.record_type == FILLER_RECORD) {
+      *position += hdr.record_size;
+      continue;
+    }
+
+    // Make sure the whole record is in the file.
+    if (hdrsize > available || hdr.record_size > available - hdrsize) {
+      return Status(1, "Record truncated");
+    }
+    if (hdr.key_size > hdr.record_size) {
+      return Status(1, "Corrupt record header");
+    }
+
+    // Get record key and value directly from the mapping.
+    record->position = *position;
+    record->type = hdr.record_type;
+    Status s = Decode(hdr, data + hdrsize, record, decompressed);
+    if (!s.ok()) return s;
+    *position += hdrsize + hdr.record_size;
+    return Status::OK;
+  }
+}
+
+Status RecordReader::ReadAt(uint64 position, Record *record,
+                            RecordReadBuffers *buffers, uint64 *next) const {
+  if (info_.compression != BLOCK_SNAPPY) {
+    return ReadRecordAt(position, record, buffers, next);
+  }
+
+  // Read and decompress the block unless it is already in the buffers.
+  uint64 offset = position >> BLOCK_OFFSET_SHIFT;
+  position = FileOffset(position);
+  if (buffers->block_reader != this || buffers->block_position != position) {
+    uint64 end;
+    Status s = ReadRecordAt(position, record, buffers, &end);
+    if (!s.ok()) return s;
+    if (record->type != BLOCK_RECORD) {
+      if (offset != 0) return Status(1, "Invalid record position");
+      if (next != nullptr) *next = end;
+      return Status::OK;
+    }
+    buffers->block_reader = nullptr;
+    s = DecompressBlock(*record, &buffers->block);
+    if (!s.ok()) return s;
+    buffers->block_reader = this;
+    buffers->block_position = record->position;
+    buffers->block_end = end;
+  }
+
+  // Get record from block.
+  Status s = ReadBlockRecord(buffers->block, buffers->block_position, &offset,
+                             record);
+  if (!s.ok()) return s;
+  if (next != nullptr) {
+    if (offset < buffers->block.size()) {
+      *next = buffers->block_position | (offset << BLOCK_OFFSET_SHIFT);
     } else {
-      return Status(1, "Unknown compression type");
+      *next = buffers->block_end;
     }
+  }
+  return Status::OK;
+}
 
-    position_ += hdr.record_size;
+Status RecordReader::ReadRecordAt(uint64 position, Record *record,
+                                  RecordReadBuffers *buffers,
+                                  uint64 *next) const {
+  if (mapping_ != nullptr) {
+    Status s = ReadMapped(&position, record, &buffers->decompressed);
+    if (s.ok() && next != nullptr) *next = position;
+    return s;
+  }
+
+  RecordBuffer *input = &buffers->input;
+  for (;;) {
+    // Read record header and the beginning of the record. The header is
+    // zero-padded if the read is short.
+    input->clear();
+    input->ensure(buffer_size_ + MAX_HEADER_LEN);
+    uint64 bytes;
+    Status s = file_->PRead(position, input->end(), buffer_size_, &bytes);
+    if (!s.ok()) return s;
+    if (bytes == 0) return Status(1, "Record truncated");
+    if (bytes < MAX_HEADER_LEN) {
+      memset(input->end() + bytes, 0, MAX_HEADER_LEN - bytes);
+    }
+    input->appended(bytes);
+    Header hdr;
+    int hdrsize = ReadHeader(input->begin(), &hdr);
+    if (hdrsize < 0) return Status(1, "Corrupt record header");
+
+    // Skip filler records.
+    if (hdr.record_type == FILLER_RECORD) {
+      position += hdr.record_size;
+      continue;
+    }
+
+    // Read the rest of the record.
+    uint64 size = hdrsize + hdr.record_size;
+    if (size > bytes) {
+      uint64 missing = size - bytes;
+      input->ensure(missing);
+      s = file_->PRead(position + bytes, input->end(), missing, &bytes);
+      if (!s.ok()) return s;
+      if (bytes != missing) return Status(1, "Record truncated");
+      input->appended(bytes);
+    }
+
+    // Get record key and value.
+    record->position = position;
+    record->type = hdr.record_type;
+    s = Decode(hdr, input->begin() + hdrsize, record, &buffers->decompressed);
+    if (!s.ok()) return s;
+    if (next != nullptr) *next = position + size;
     return Status::OK;
   }
 }
 
+Status RecordReader::DecompressBlock(const Record &record,
+                                     RecordBuffer *block) {
+  block->clear();
+  snappy::ByteArraySource source(record.value.data(), record.value.size());
+  if (!snappy::Uncompress(&source, block)) {
+    return Status(1, "Corrupt record block");
+  }
+  return Status::OK;
+}
+
+Status RecordReader::ReadBlockRecord(const RecordBuffer &block,
+                                     uint64 position, uint64 *offset,
+                                     Record *record) {
+  // Read record header. The header is copied to a zero-padded buffer near
+  // the end of the block to prevent reading past the end of the block.
+  uint64 available = block.size() - *offset;
+  const char *data = block.begin() + *offset;
+  Header hdr;
+  int hdrsize;
+  if (available >= MAX_HEADER_LEN) {
+    hdrsize = ReadHeader(data, &hdr);
+  } else {
+    char header[MAX_HEADER_LEN];
+    memset(header, 0, MAX_HEADER_LEN);
+    memcpy(header, data, available);
+    hdrsize = ReadHeader(header, &hdr);
+  }
+  if (hdrsize < 0 || hdr.record_type != DATA_RECORD) {
+    return Status(1, "Corrupt record header in block");
+  }
+  if (hdrsize > available || hdr.record_size > available - hdrsize ||
+      hdr.key_size > hdr.record_size) {
+    return Status(1, "Record truncated in block");
+  }
+
+  // Records in blocks are not compressed.
+  data += hdrsize;
+  record->position = position | (*offset << BLOCK_OFFSET_SHIFT);
+  record->type = DATA_RECORD;
+  record->key = Slice(data, hdr.key_size);
+  record->value = Slice(data + hdr.key_size, hdr.record_size - hdr.key_size);
+  *offset += hdrsize + hdr.record_size;
+  return Status::OK;
+}
+
+Status RecordReader::Decode(const Header &hdr, const char *data,
+                            Record *record, RecordBuffer *decompressed) const {
+  // Get record key.
+  if (hdr.key_size > 0) {
+    record->key = Slice(data, hdr.key_size);
+  } else {
+    record->key = Slice();
+  }
+
+  // Get record value.
+  const char *value = data + hdr.key_size;
+  size_t value_size = hdr.record_size - hdr.key_size;
+  if (info_.compression == SNAPPY) {
+    // Decompress record value.
+    decompressed->clear();
+    snappy::ByteArraySource source(value, value_size);
+    CHECK(snappy::Uncompress(&source, decompressed));
+    record->value = Slice(decompressed->begin(), decompressed->end());
+  } else if (info_.compression == UNCOMPRESSED ||
+             info_.compression == BLOCK_SNAPPY) {
+    record->value = Slice(value, value_size);
+  } else {
+    return Status(1, "Unknown compression type");
+  }
+
+  return Status::OK;
+}
+
 Status RecordReader::Skip(int64 n) {
   // Check if we can skip to position in input buffer.
   position_ += n;
+  if (mapping_ != nullptr) return Status::OK;
   char *ptr = input_.begin() + n;
   if (ptr >= input_.floor() && ptr < input_.end()) {
     input_.consumed(n);
@@ -344,9 +645,39 @@ Status RecordReader::Skip(int64 n) {
 }
 
 Status RecordReader::Seek(uint64 pos) {
+  if (info_.compression == BLOCK_SNAPPY) {
+    uint64 offset = pos >> BLOCK_OFFSET_SHIFT;
+    pos = FileOffset(pos);
+    if (offset != 0) {
+      // Position the reader at a record inside a block. The current block is
+      // reused if the record is in the same block.
+      if (pos != block_position_ || block_.empty()) {
+        Status s = Seek(pos);
+        if (!s.ok()) return s;
+        Record record;
+        s = ReadRecord(&record);
+        if (!s.ok()) return s;
+        if (record.type != BLOCK_RECORD) {
+          return Status(1, "Invalid record position");
+        }
+        s = DecompressBlock(record, &block_);
+        if (!s.ok()) return s;
+        block_position_ = record.position;
+      }
+      if (offset >= block_.size()) return Status(1, "Invalid record position");
+      block_offset_ = offset;
+      return Status::OK;
+    }
+
+    // Discard the current block when seeking to a file position.
+    block_.clear();
+    block_offset_ = 0;
+  }
+
   // Check if we can skip to position in input buffer.
   int64 offset = pos - position_;
   position_ = pos;
+  if (mapping_ != nullptr) return Status::OK;
   char *ptr = input_.begin() + offset;
   if (ptr >= input_.floor() && ptr < input_.end()) {
     input_.consumed(offset);
@@ -365,12 +696,45 @@ RecordFile::IndexPage *RecordReader::ReadIndexPage(uint64 position) {
   return new IndexPage(position, record.value);
 }
 
+RecordFile::IndexPage *RecordReader::ReadIndexPage(
+    uint64 position, RecordReadBuffers *buffers) const {
+  Record record;
+  CHECK(ReadAt(position, &record, buffers));
+  return new IndexPage(position, record.value);
+}
+
+// Maximum number of shards in index page cache.
+static const int kMaxCacheShards = 16;
+
 RecordIndex::RecordIndex(RecordReader *reader,
                          const RecordFileOptions &options) {
   reader_ = reader;
-  cache_size_ = std::max(options.index_cache_size, 2);
-  if (reader->info().index_root != 0 && reader->info().index_depth == 3) {
-    root_ = reader->ReadIndexPage(reader->info().index_root);
+  int shards = options.index_cache_size / 16;
+  shards = std::max(std::min(shards, kMaxCacheShards), 1);
+  cache_size_ = std::max(options.index_cache_size / shards, 2);
+  cache_ = std::vector<CacheShard>(shards);
+  const FileHeader &info = reader->info();
+  if (info.index_root != 0 && info.index_depth == 3) {
+    Record record;
+    uint64 next;
+    CHECK(reader->ReadAt(info.index_root, &record, &buffers_, &next));
+    root_ = new IndexPage(info.index_root, record.value);
+
+    // Load Bloom filter following the index root. The Bloom filter is only
+    // used for skipping the index, so lookups fall back to the index if the
+    // filter is damaged.
+    if (info.flags & BLOOM_FILTER) {
+      if (reader->ReadAt(next, &record, &buffers_) &&
+          record.type == BLOOM_RECORD) {
+        bloom_ = new BloomFilter(record.value);
+      }
+      if (bloom_ == nullptr || !bloom_->valid()) {
+        LOG(WARNING) << "Ignoring invalid Bloom filter in "
+                     << reader->file()->filename();
+        delete bloom_;
+        bloom_ = nullptr;
+      }
+    }
   } else {
     root_ = nullptr;
   }
@@ -378,28 +742,25 @@ RecordIndex::RecordIndex(RecordReader *reader,
 
 RecordIndex::~RecordIndex() {
   delete root_;
-  for (auto *p : cache_) delete p;
+  delete bloom_;
+  for (CacheShard &shard : cache_) {
+    for (auto *p : shard.pages) delete p;
+  }
 }
 
 bool RecordIndex::Lookup(const Slice &key, Record *record, uint64 fp) {
   if (root_ != nullptr) {
+    // Missing keys can often be rejected by the Bloom filter.
+    if (!MayContain(fp)) return false;
+
     // Look up key in index. Multiple keys can have the same fingerprint so we
-    // move forward until a match is found.
-    for (int l1 = root_->Find(fp); l1 < root_->size; ++l1) {
-      if (root_->entries[l1].fingerprint > fp) return false;
-      IndexPage *dir = GetIndexPage(root_->entries[l1].position);
-      for (int l2 = dir->Find(fp); l2 < dir->size; ++l2) {
-        if (dir->entries[l2].fingerprint > fp) return false;
-        IndexPage *leaf = GetIndexPage(access(dir)->entries[l2].position);
-        for (int l3 = leaf->Find(fp); l3 < leaf->size; ++l3) {
-          if (leaf->entries[l3].fingerprint > fp) return false;
-          if (leaf->entries[l3].fingerprint == fp) {
-            CHECK(reader_->Seek(leaf->entries[l3].position));
-            CHECK(reader_->Read(record));
-            if (record->key == key) return true;
-          }
-        }
-      }
+    // try all the records with the fingerprint until a match is found.
+    Index entries;
+    FindEntries(fp, &entries, &buffers_);
+    for (const IndexEntry &entry : entries) {
+      CHECK(reader_->Seek(entry.position));
+      CHECK(reader_->Read(record));
+      if (record->key == key) return true;
     }
   } else {
     // No index; find record using sequential scanning.
@@ -417,29 +778,187 @@ bool RecordIndex::Lookup(const Slice &key, Record *record) {
   return Lookup(key, record, Fingerprint(key.data(), key.size()));
 }
 
-RecordFile::IndexPage *RecordIndex::GetIndexPage(uint64 position) {
-  // Try to find index page in cache.
-  for (auto *p : cache_) {
-    if (p->position == position) return access(p);
+bool RecordIndex::Lookup(const Slice &key, Record *record, uint64 fp,
+                         RecordReadBuffers *buffers) {
+  if (root_ != nullptr) {
+    if (!MayContain(fp)) return false;
+    Index entries;
+    FindEntries(fp, &entries, buffers);
+    for (const IndexEntry &entry : entries) {
+      CHECK(reader_->ReadAt(entry.position, record, buffers));
+      if (record->key == key) return true;
+    }
+  } else {
+    uint64 position = reader_->info().hdrlen;
+    while (RecordFile::FileOffset(position) < reader_->size()) {
+      CHECK(reader_->ReadAt(position, record, buffers, &position));
+      if (record->key == key) return true;
+    }
   }
 
-  // Read new index page.
-  IndexPage *page = access(reader_->ReadIndexPage(position));
+  return false;
+}
 
-  // Insert or replace page in cache.
-  if (cache_.size() < cache_size_) {
-    cache_.push_back(page);
-  } else {
-    // Replace oldest entry in cache.
-    int oldest = 0;
-    for (int i = 1; i < cache_.size(); ++i) {
-      if (cache_[i]->lru < cache_[oldest]->lru) oldest = i;
+void RecordIndex::FindEntries(uint64 fp, Index *entries,
+                              RecordReadBuffers *buffers) {
+  // The index has three levels. The root page is always in memory, and the
+  // directory and leaf pages are read through the page cache.
+  Index dirs;
+  AddEntries(root_, fp, &dirs);
+  for (const IndexEntry &dir : dirs) {
+    Index leaves;
+    GetEntries(dir.position, fp, &leaves, buffers);
+    for (const IndexEntry &leaf : leaves) {
+      Index records;
+      GetEntries(leaf.position, fp, &records, buffers);
+      for (const IndexEntry &entry : records) {
+        if (entry.fingerprint == fp) entries->push_back(entry);
+      }
+    }
+  }
+}
+
+void RecordIndex::GetEntries(uint64 position, uint64 fp, Index *entries,
+                             RecordReadBuffers *buffers) {
+  VisitIndexPage(position, buffers, [&](const IndexPage *page) {
+    AddEntries(page, fp, entries);
+  });
+}
+
+void RecordIndex::VisitIndexPage(
+    uint64 position, RecordReadBuffers *buffers,
+    const std::function<void(const IndexPage *)> &visitor) {
+  // Look up page in cache and move it to the front of the LRU list.
+  uint64 hash = (position * 0x9E3779B97F4A7C15ULL) >> 32;
+  CacheShard &shard = cache_[hash % cache_.size()];
+  IndexPage *page = nullptr;
+  {
+    MutexLock lock(&shard.mu);
+    auto f = shard.index.find(position);
+    if (f != shard.index.end()) {
+      page = *f->second;
+      page->refs++;
+      shard.pages.splice(shard.pages.begin(), shard.pages, f->second);
+    }
+  }
+
+  if (page == nullptr) {
+    // Read new index page without holding the lock.
+    page = reader_->ReadIndexPage(position, buffers);
+
+    // Insert page in cache unless another thread has already added it in the
+    // meantime, and evict the least recently used page if the shard is full.
+    MutexLock lock(&shard.mu);
+    if (shard.index.find(position) == shard.index.end()) {
+      page->refs++;
+      shard.pages.push_front(page);
+      shard.index[position] = shard.pages.begin();
+      if (shard.pages.size() > cache_size_) {
+        IndexPage *oldest = shard.pages.back();
+        shard.index.erase(oldest->position);
+        shard.pages.pop_back();
+        ReleaseIndexPage(oldest);
+      }
     }
-    delete cache_[oldest];
-    cache_[oldest] = page;
   }
 
-  return page;
+  visitor(page);
+  ReleaseIndexPage(page);
+}
+
+int RecordIndex::LookupBatch(const std::vector<Slice> &keys,
+                             const std::vector<uint64> &fps,
+                             RecordReadBuffers *buffers,
+                             const BatchCallback &callback) {
+  Record record;
+  int found = 0;
+  std::vector<bool> done(keys.size());
+  if (root_ == nullptr) {
+    // No index; find the records with one sequential scan for the batch.
+    uint64 position = reader_->info().hdrlen;
+    while (RecordFile::FileOffset(position) < reader_->size() &&
+           found < keys.size()) {
+      CHECK(reader_->ReadAt(position, &record, buffers, &position));
+      uint64 fp = Fingerprint(record.key.data(), record.key.size());
+      auto range = std::equal_range(fps.begin(), fps.end(), fp);
+      for (auto it = range.first; it != range.second; ++it) {
+        int i = it - fps.begin();
+        if (!done[i] && record.key == keys[i]) {
+          callback(i, record);
+          done[i] = true;
+          found++;
+        }
+      }
+    }
+    return found;
+  }
+
+  // Walk the index one level at a time to find the positions of the records
+  // with the key fingerprints. At each level, the keys are sorted by index
+  // page position, so each index page is only visited once for the batch.
+  std::vector<std::pair<uint64, int>> positions;
+  Index entries;
+  for (int i = 0; i < fps.size(); ++i) {
+    if (!MayContain(fps[i])) continue;
+    entries.clear();
+    AddEntries(root_, fps[i], &entries);
+    for (const IndexEntry &e : entries) positions.emplace_back(e.position, i);
+  }
+  for (int level = 0; level < 2; ++level) {
+    std::sort(positions.begin(), positions.end());
+    std::vector<std::pair<uint64, int>> next;
+    int begin = 0;
+    while (begin < positions.size()) {
+      int end = begin + 1;
+      uint64 position = positions[begin].first;
+      while (end < positions.size() && positions[end].first == position) end++;
+      VisitIndexPage(position, buffers, [&](const IndexPage *page) {
+        for (int j = begin; j < end; ++j) {
+          int i = positions[j].second;
+          entries.clear();
+          AddEntries(page, fps[i], &entries);
+          for (const IndexEntry &e : entries) {
+            // Only leaf entries with the fingerprint refer to the records.
+            if (level == 1 && e.fingerprint != fps[i]) continue;
+            next.emplace_back(e.position, i);
+          }
+        }
+      });
+      begin = end;
+    }
+    positions.swap(next);
+  }
+
+  // Read the records in file order. Positions in block-compressed files are
+  // ordered by the file offset of the block and then by the offset in the
+  // block, so each block is only decompressed once for the batch.
+  std::sort(positions.begin(), positions.end(),
+    [](const std::pair<uint64, int> &a, const std::pair<uint64, int> &b) {
+      uint64 fa = RecordFile::FileOffset(a.first);
+      uint64 fb = RecordFile::FileOffset(b.first);
+      if (fa != fb) return fa < fb;
+      return a.first < b.first;
+    }
+  );
+  for (auto &p : positions) {
+    int i = p.second;
+    if (done[i]) continue;
+    CHECK(reader_->ReadAt(p.first, &record, buffers));
+    if (record.key == keys[i]) {
+      callback(i, record);
+      done[i] = true;
+      found++;
+    }
+  }
+  return found;
+}
+
+void RecordIndex::AddEntries(const IndexPage *page, uint64 fp,
+                             Index *entries) {
+  for (int i = page->Find(fp); i < page->size; ++i) {
+    if (page->entries[i].fingerprint > fp) break;
+    entries->push_back(page->entries[i]);
+  }
 }
 
 RecordDatabase::RecordDatabase(const string &filepattern,
@@ -483,6 +1002,55 @@ bool RecordDatabase::Lookup(const Slice &key, Record *record) {
   return shards_[current_shard_]->Lookup(key, record, fp);
 }
 
+bool RecordDatabase::Read(int shard, int64 position, Record *record,
+                          RecordReadBuffers *buffers) {
+  RecordReader *reader = shards_[shard]->reader();
+  return reader->ReadAt(position, record, buffers);
+}
+
+bool RecordDatabase::Lookup(const Slice &key, Record *record,
+                            RecordReadBuffers *buffers) {
+  uint64 fp = Fingerprint(key.data(), key.size());
+  return shards_[fp % shards_.size()]->Lookup(key, record, fp, buffers);
+}
+
+int RecordDatabase::LookupBatch(const std::vector<Slice> &keys,
+                                RecordReadBuffers *buffers,
+                                const RecordIndex::BatchCallback &callback) {
+  // Group keys by shard and sort them by fingerprint.
+  std::vector<std::vector<std::pair<uint64, int>>> batches(shards_.size());
+  for (int i = 0; i < keys.size(); ++i) {
+    uint64 fp = Fingerprint(keys[i].data(), keys[i].size());
+    batches[fp % shards_.size()].emplace_back(fp, i);
+  }
+
+  // Look up keys in each shard.
+  int found = 0;
+  std::vector<Slice> shard_keys;
+  std::vector<uint64> shard_fps;
+  for (int shard = 0; shard < shards_.size(); ++shard) {
+    auto &batch = batches[shard];
+    if (batch.empty()) continue;
+    std::sort(batch.begin(), batch.end());
+    shard_keys.clear();
+    shard_fps.clear();
+    for (auto &b : batch) {
+      shard_fps.push_back(b.first);
+      shard_keys.push_back(keys[b.second]);
+    }
+    found += shards_[shard]->LookupBatch(
+        shard_keys, shard_fps, buffers,
+        [&](int index, const Record &record) {
+          callback(batch[index].second, record);
+        });
+  }
+  return found;
+}
+
+int RecordDatabase::Shard(const Slice &key) const {
+  return Fingerprint(key.data(), key.size()) % shards_.size();
+}
+
 bool RecordDatabase::Next(Record *record) {
   while (current_shard_ < shards_.size()) {
     RecordReader *reader = shards_[current_shard_]->reader();
@@ -493,7 +1061,7 @@ bool RecordDatabase::Next(Record *record) {
 }
 
 RecordWriter::RecordWriter(File *file, const RecordFileOptions &options)
-    : file_(file) {
+    : file_(file), bloom_bits_per_key_(options.bloom_bits_per_key) {
   // Allocate output buffer.
   output_.resize(options.buffer_size);
   position_ = 0;
@@ -507,6 +1075,11 @@ RecordWriter::RecordWriter(File *file, const RecordFileOptions &options)
   if (options.indexed) {
     info_.index_page_size = options.index_page_size;
   }
+  if (options.compression == BLOCK_SNAPPY) {
+    CHECK_GT(options.block_size, 0);
+    CHECK_LT(options.block_size, 1 << (64 - BLOCK_OFFSET_SHIFT));
+    block_size_ = options.block_size;
+  }
   memcpy(output_.end(), &info_, sizeof(info_));
   output_.appended(sizeof(info_));
   position_ += sizeof(info_);
@@ -523,7 +1096,8 @@ RecordWriter::RecordWriter(const string &filename)
     : RecordWriter(filename, default_options) {}
 
 RecordWriter::RecordWriter(RecordReader *reader,
-                           const RecordFileOptions &options) {
+                           const RecordFileOptions &options)
+    : bloom_bits_per_key_(options.bloom_bits_per_key) {
   output_.resize(options.buffer_size);
   file_ = reader->file();
   info_ = reader->info();
@@ -538,6 +1112,12 @@ Status RecordWriter::Close() {
   // Check if file has already been closed.
   if (file_ == nullptr) return Status::OK;
 
+  // Write remaining records in the current block.
+  if (!block_.empty()) {
+    Status s = FlushBlock();
+    if (!s.ok()) return s;
+  }
+
   // Write index to disk.
   if (info_.index_page_size > 0) {
     Status s = WriteIndex();
@@ -564,6 +1144,11 @@ Status RecordWriter::Flush() {
 }
 
 Status RecordWriter::Write(const Record &record) {
+  // Data records are added to the current block with block compression.
+  if (info_.compression == BLOCK_SNAPPY && record.type == DATA_RECORD) {
+    return AddToBlock(record);
+  }
+
   // Compress record value if requested.
   Slice value;
   if (info_.compression == SNAPPY) {
@@ -572,15 +1157,32 @@ Status RecordWriter::Write(const Record &record) {
     compressed_data_.clear();
     snappy::Compress(&source, &compressed_data_);
     value = Slice(compressed_data_.begin(), compressed_data_.end());
-  } else if (info_.compression == UNCOMPRESSED) {
+  } else if (info_.compression == UNCOMPRESSED ||
+             info_.compression == BLOCK_SNAPPY) {
     // Store uncompressed record value.
     value = record.value;
   } else {
     return Status(1, "Unknown compression type");
   }
 
+  // Write record.
+  uint64 position;
+  Status s = WriteRecord(record.type, record.key, value, &position);
+  if (!s.ok()) return s;
+
+  // Add record to index.
+  if (info_.index_page_size > 0 && record.type == DATA_RECORD) {
+    uint64 fp = Fingerprint(record.key.data(), record.key.size());
+    index_.emplace_back(fp, position);
+  }
+
+  return Status::OK;
+}
+
+Status RecordWriter::WriteRecord(RecordType type, const Slice &key,
+                                 const Slice &value, uint64 *position) {
   // Compute on-disk record size estimate.
-  size_t maxsize = MAX_HEADER_LEN + record.key.size() + value.size();
+  size_t maxsize = MAX_HEADER_LEN + key.size() + value.size();
 
   // Records cannot be bigger than the chunk size.
   size_t size_with_skip = maxsize + MAX_SKIP_LEN;
@@ -617,28 +1219,23 @@ Status RecordWriter::Write(const Record &record) {
       if (!s.ok()) return s;
     }
   }
-
-  // Add record to index.
-  if (info_.index_page_size > 0 && record.type == DATA_RECORD) {
-    uint64 fp = Fingerprint(record.key.data(), record.key.size());
-    index_.emplace_back(fp, position_);
-  }
+  *position = position_;
 
   // Write record header.
   Header hdr;
-  hdr.record_type = record.type;
-  hdr.record_size = record.key.size() + value.size();
-  hdr.key_size = record.key.size();
+  hdr.record_type = type;
+  hdr.record_size = key.size() + value.size();
+  hdr.key_size = key.size();
   output_.ensure(maxsize);
   int hdrlen = WriteHeader(hdr, output_.end());
   output_.appended(hdrlen);
   position_ += hdrlen;
 
   // Write record key.
-  if (record.key.size() > 0) {
-    memcpy(output_.end(), record.key.data(), record.key.size());
-    output_.appended(record.key.size());
-    position_ += record.key.size();
+  if (key.size() > 0) {
+    memcpy(output_.end(), key.data(), key.size());
+    output_.appended(key.size());
+    position_ += key.size();
   }
 
   // Write record value.
@@ -649,6 +1246,66 @@ Status RecordWriter::Write(const Record &record) {
   return Status::OK;
 }
 
+Status RecordWriter::AddToBlock(const Record &record) {
+  // Write the current block first if the compressed block might not fit in a
+  // chunk with the new record.
+  size_t recsize = MAX_HEADER_LEN + record.key.size() + record.value.size();
+  if (!block_.empty() && info_.chunk_size != 0) {
+    size_t maxsize = MAX_HEADER_LEN + MAX_SKIP_LEN +
+                     snappy::MaxCompressedLength(block_.size() + recsize);
+    if (maxsize > info_.chunk_size) {
+      Status s = FlushBlock();
+      if (!s.ok()) return s;
+    }
+  }
+
+  // Add record to index with the offset in the block. The file position of
+  // the block is added when the block is written.
+  if (info_.index_page_size > 0) {
+    uint64 fp = Fingerprint(record.key.data(), record.key.size());
+    index_.emplace_back(fp, block_.size() << BLOCK_OFFSET_SHIFT);
+  }
+
+  // Add uncompressed record to block.
+  Header hdr;
+  hdr.record_type = DATA_RECORD;
+  hdr.record_size = record.key.size() + record.value.size();
+  hdr.key_size = record.key.size();
+  block_.ensure(recsize);
+  int hdrlen = WriteHeader(hdr, block_.end());
+  block_.appended(hdrlen);
+  block_.Append(record.key.data(), record.key.size());
+  block_.Append(record.value.data(), record.value.size());
+
+  // Write block when it is full.
+  if (block_.size() >= block_size_) return FlushBlock();
+  return Status::OK;
+}
+
+Status RecordWriter::FlushBlock() {
+  // Compress block.
+  compressed_data_.clear();
+  snappy::Compress(&block_, &compressed_data_);
+  block_.clear();
+
+  // Write block record.
+  Slice data(compressed_data_.begin(), compressed_data_.end());
+  uint64 position;
+  Status s = WriteRecord(BLOCK_RECORD, Slice(), data, &position);
+  if (!s.ok()) return s;
+
+  // Add the block position to the index entries for the records in the block.
+  // The file offset of the block must fit below the in-block offset.
+  CHECK_LT(position, 1ULL << BLOCK_OFFSET_SHIFT)
+      << "Block-compressed record file too big";
+  for (int i = block_index_start_; i < index_.size(); ++i) {
+    index_[i].position |= position;
+  }
+  block_index_start_ = index_.size();
+
+  return Status::OK;
+}
+
 Status RecordWriter::WriteIndex() {
   // Sort index.
   std::sort(index_.begin(), index_.end(),
@@ -675,6 +1332,25 @@ Status RecordWriter::WriteIndex() {
   s = WriteIndexLevel(root, nullptr, root.size());
   if (!s.ok()) return s;
 
+  // Write Bloom filter for the keys after the index root. The filter must fit
+  // in a chunk, so the number of bits per key is reduced for very large files.
+  int64 keys = std::max(index_.size(), size_t{1});
+  int64 bits_per_key = bloom_bits_per_key_;
+  if (info_.chunk_size != 0) {
+    int64 max_bits = info_.chunk_size * 4;
+    bits_per_key = std::min(bits_per_key, max_bits / keys);
+  }
+  if (bits_per_key > 0) {
+    BloomFilter bloom(index_.size(), bits_per_key);
+    for (const IndexEntry &entry : index_) bloom.Add(entry.fingerprint);
+    Record filter;
+    filter.value = bloom.data();
+    filter.type = BLOOM_RECORD;
+    s = Write(filter);
+    if (!s.ok()) return s;
+    info_.flags |= BLOOM_FILTER;
+  }
+
   // Update record file header.
   info_.index_depth = 3;
   s = Flush();
@@ -735,11 +1411,10 @@ Status RecordWriter::AddIndex(const string &filename,
   // Build record index.
   Record record;
   while (!reader->Done()) {
-    uint64 pos = reader->Tell();
     s = reader->Read(&record);
     if (!s.ok()) return s;
     uint64 fp = Fingerprint(record.key.data(), record.key.size());
-    writer->index_.emplace_back(fp, pos);
+    writer->index_.emplace_back(fp, record.position);
   }
 
   // Write index.
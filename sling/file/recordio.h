@@ -15,12 +15,17 @@
 #ifndef SLING_FILE_RECORDIO_H_
 #define SLING_FILE_RECORDIO_H_
 
+#include <atomic>
+#include <functional>
+#include <list>
+#include <unordered_map>
 #include <vector>
 
 #include "sling/base/slice.h"
 #include "sling/base/status.h"
 #include "sling/base/types.h"
 #include "sling/file/file.h"
+#include "sling/util/mutex.h"
 #include "sling/util/snappy.h"
 
 namespace sling {
@@ -30,6 +35,8 @@ enum RecordType {
   DATA_RECORD = 1,
   FILLER_RECORD = 2,
   INDEX_RECORD = 3,
+  BLOOM_RECORD = 4,
+  BLOCK_RECORD = 5,
 };
 
 // Record with key and value.
@@ -49,16 +56,16 @@ class RecordBuffer : public snappy::Sink, public snappy::Source {
   ~RecordBuffer();
 
   // Check if the buffer is empty.
-  bool empty() { return begin_ == end_; }
+  bool empty() const { return begin_ == end_; }
 
   // Returns the number of used bytes in the buffer.
-  size_t size() { return end_ - begin_; }
+  size_t size() const { return end_ - begin_; }
 
   // Returns the capacity of the buffer.
-  size_t capacity() { return ceil_ - floor_; }
+  size_t capacity() const { return ceil_ - floor_; }
 
   // Returns number of unused bytes remaining in the buffer.
-  size_t remaining() { return ceil_ - end_; }
+  size_t remaining() const { return ceil_ - end_; }
 
   // Clear buffer.
   void clear() { begin_ = end_ = floor_; }
@@ -103,6 +110,25 @@ class RecordBuffer : public snappy::Sink, public snappy::Source {
   char *end_ = nullptr;    // end of used part of buffer
 };
 
+// Buffers for reading records at a position with RecordReader::ReadAt(). Each
+// thread needs its own buffers for concurrent reads. The key and value of a
+// record read into the buffers are valid until the next read. The buffers
+// should not be used after the readers they have been used with are deleted.
+struct RecordReadBuffers {
+  // Buffer for record data read from file.
+  RecordBuffer input;
+
+  // Buffer for decompressed record data.
+  RecordBuffer decompressed;
+
+  // Last decompressed block for block-compressed record files together with
+  // the reader and file position of the block, and the position after it.
+  RecordBuffer block;
+  const void *block_reader = nullptr;
+  uint64 block_position = 0;
+  uint64 block_end = 0;
+};
+
 class RecordFile {
  public:
   // Maximum record header length.
@@ -115,10 +141,30 @@ class RecordFile {
   static const uint32 MAGIC1 = 0x46434552;  // RECF
   static const uint32 MAGIC2 = 0x44434552;  // RECD
 
-  // Compression types.
+  // Compression types. With block compression, data records are grouped into
+  // blocks which are compressed with snappy and stored in block records. All
+  // other records are stored uncompressed.
   enum CompressionType {
     UNCOMPRESSED = 0,
     SNAPPY = 1,
+    BLOCK_SNAPPY = 2,
+  };
+
+  // Record positions in block-compressed record files have the file offset
+  // of the block in the lower 40 bits and the offset of the record in the
+  // uncompressed block in the upper 24 bits. The position of the first record
+  // in a block is the file offset of the block.
+  static const int BLOCK_OFFSET_SHIFT = 40;
+  static const uint64 FILE_OFFSET_MASK = (1ULL << BLOCK_OFFSET_SHIFT) - 1;
+
+  // Return file offset for record position.
+  static uint64 FileOffset(uint64 position) {
+    return position & FILE_OFFSET_MASK;
+  }
+
+  // File header flags.
+  enum Flags {
+    BLOOM_FILTER = 1,  // Bloom filter record follows the index root
   };
 
   // File header information.
@@ -163,7 +209,49 @@ class RecordFile {
     uint64 position;
     int size;
     IndexEntry *entries;
-    uint64 lru;
+
+    // Reference count for pages in the index page cache. The cache holds one
+    // reference, and each reader holds one while it is using the page.
+    std::atomic<int> refs{1};
+  };
+
+  // Blocked Bloom filter over key fingerprints for indexed record files. All
+  // the bits for a key are in one 512-bit block, so testing a key only touches
+  // one cache line. The filter is stored as a header word with the number of
+  // blocks and probes followed by the blocks.
+  class BloomFilter {
+   public:
+    // Initialize empty Bloom filter for a number of keys.
+    BloomFilter(int64 keys, int bits_per_key);
+
+    // Initialize Bloom filter from record data.
+    explicit BloomFilter(const Slice &data);
+
+    // Check if filter is valid.
+    bool valid() const { return !words_.empty(); }
+
+    // Add key fingerprint to filter.
+    void Add(uint64 fp);
+
+    // Check if key fingerprint may be in the filter. If this returns false,
+    // there is no record with this key fingerprint.
+    bool MayContain(uint64 fp) const;
+
+    // Return filter data for writing the filter to a record.
+    Slice data() const {
+      return Slice(words_.data(), words_.size() * sizeof(uint64));
+    }
+
+   private:
+    // Number of 64-bit words in each block.
+    static const int kBlockWords = 8;
+
+    // Filter with header word followed by the blocks.
+    std::vector<uint64> words_;
+
+    // Number of blocks and number of bits set for each key.
+    uint32 blocks_ = 0;
+    uint32 probes_ = 0;
   };
 
   // Parse header from data. Returns the number of bytes read or -1 on error.
@@ -184,6 +272,10 @@ struct RecordFileOptions {
   // Record compression.
   RecordFile::CompressionType compression = RecordFile::SNAPPY;
 
+  // Uncompressed size of record blocks for block compression. This must be
+  // less than 16 MB.
+  int block_size = 64 * 1024;
+
   // Record files can be indexed for fast retrieval by key.
   bool indexed = false;
 
@@ -192,6 +284,16 @@ struct RecordFileOptions {
 
   // Number of pages in index page cache.
   int index_cache_size = 256;
+
+  // Number of bits per key in the Bloom filter for indexed record files. The
+  // Bloom filter lets lookups of missing keys skip the index. No Bloom filter
+  // is written if this is zero.
+  int bloom_bits_per_key = 0;
+
+  // Memory-map record files for reading instead of reading them through the
+  // input buffer. Uncompressed records are returned directly from the mapping
+  // and compressed records are decompressed straight from the mapping.
+  bool memory_map = false;
 };
 
 // Reader for reading records from a record file.
@@ -208,13 +310,16 @@ class RecordReader : public RecordFile {
   Status Close();
 
   // Return true if we have read all records in the file.
-  bool Done() { return position_ == size_; }
+  bool Done() { return position_ == size_ && block_offset_ >= block_.size(); }
 
   // Read next record from record file.
   Status Read(Record *record);
 
   // Return current position in record file.
-  uint64 Tell() { return position_; }
+  uint64 Tell() {
+    if (block_offset_ >= block_.size()) return position_;
+    return block_position_ | (block_offset_ << BLOCK_OFFSET_SHIFT);
+  }
 
   // Seek to new position in record file.
   Status Seek(uint64 pos);
@@ -225,8 +330,16 @@ class RecordReader : public RecordFile {
   // Skip bytes in input. The offset can be negative.
   Status Skip(int64 n);
 
+  // Read record at position using positional reads. This does not change the
+  // current position of the reader, so records can be read concurrently by
+  // multiple threads using separate buffers. If next is not null, it is set to
+  // the position of the following record.
+  Status ReadAt(uint64 position, Record *record, RecordReadBuffers *buffers,
+                uint64 *next = nullptr) const;
+
   // Read index page. Ownership of the index page is transferred to the caller.
   IndexPage *ReadIndexPage(uint64 position);
+  IndexPage *ReadIndexPage(uint64 position, RecordReadBuffers *buffers) const;
 
   // Record file header information.
   const FileHeader &info() const { return info_; }
@@ -237,16 +350,47 @@ class RecordReader : public RecordFile {
   // File size.
   uint64 size() const { return size_; }
 
+  // Check if record file is memory-mapped.
+  bool mapped() const { return mapping_ != nullptr; }
+
  private:
   // Fill input buffer.
   Status Fill();
 
+  // Read next record stored in the file. In block-compressed files, these are
+  // the block records and the index records.
+  Status ReadRecord(Record *record);
+
+  // Read record stored in the file at position using positional reads.
+  Status ReadRecordAt(uint64 position, Record *record,
+                      RecordReadBuffers *buffers, uint64 *next) const;
+
+  // Decompress block record.
+  static Status DecompressBlock(const Record &record, RecordBuffer *block);
+
+  // Get record at offset in decompressed block and advance the offset to the
+  // next record in the block.
+  static Status ReadBlockRecord(const RecordBuffer &block, uint64 position,
+                                uint64 *offset, Record *record);
+
+  // Read record at position from memory-mapped record file and advance the
+  // position to the next record.
+  Status ReadMapped(uint64 *position, Record *record,
+                    RecordBuffer *decompressed) const;
+
+  // Get key and value for record from record data.
+  Status Decode(const Header &hdr, const char *data, Record *record,
+                RecordBuffer *decompressed) const;
+
   // Input file.
   File *file_;
 
   // Flag to indicate that file object is owned by reader.
   bool owned_;
 
+  // Size of reads for positional reads.
+  int buffer_size_;
+
   // File size.
   uint64 size_;
 
@@ -261,6 +405,18 @@ class RecordReader : public RecordFile {
 
   // Buffer for decompressed record data.
   RecordBuffer decompressed_data_;
+
+  // Current decompressed block in block-compressed record file, the file
+  // position of the block, and the offset of the next record in the block.
+  RecordBuffer block_;
+  uint64 block_position_ = 0;
+  uint64 block_offset_ = 0;
+
+  // Memory mapping for record file, or null if the file is not mapped.
+  char *mapping_ = nullptr;
+
+  // Size of memory-mapped file.
+  uint64 mapped_size_ = 0;
 };
 
 // Index for looking up records in an indexed record file.
@@ -269,37 +425,94 @@ class RecordIndex : public RecordFile {
   RecordIndex(RecordReader *reader, const RecordFileOptions &options);
   ~RecordIndex();
 
-  // Look up record by key. Returns false if no matching record is found.
+  // Look up record by key. Returns false if no matching record is found. The
+  // record is read through the reader, so the reader is positioned after the
+  // record, and the index page buffers are shared. These lookups are not
+  // thread-safe.
   bool Lookup(const Slice &key, Record *record, uint64 fp);
   bool Lookup(const Slice &key, Record *record);
 
+  // Look up record by key using positional reads into the buffers. Only this
+  // lookup is thread-safe. It can be called concurrently from multiple threads
+  // with separate buffers.
+  bool Lookup(const Slice &key, Record *record, uint64 fp,
+              RecordReadBuffers *buffers);
+
+  // Callback for batch lookups with the position of the key in the batch and
+  // the record for the key. The record data is only valid during the call.
+  typedef std::function<void(int index, const Record &record)> BatchCallback;
+
+  // Look up records for a batch of keys with fingerprints in ascending order.
+  // The index is traversed once for the batch and the records are read in file
+  // order, i.e. by block and then by offset in the block for block-compressed
+  // files. Returns the number of keys found.
+  int LookupBatch(const std::vector<Slice> &keys,
+                  const std::vector<uint64> &fps,
+                  RecordReadBuffers *buffers,
+                  const BatchCallback &callback);
+
   // Return record reader.
   RecordReader *reader() const { return reader_; }
 
+  // Check if index has a Bloom filter for the keys.
+  bool has_bloom_filter() const { return bloom_ != nullptr; }
+
  private:
-  // Get index page at position.
-  IndexPage *GetIndexPage(uint64 position);
+  // Check if the record file can have a record with the key fingerprint.
+  bool MayContain(uint64 fp) const {
+    return bloom_ == nullptr || bloom_->MayContain(fp);
+  }
+
+  // Shard of the index page cache. Each shard has its own lock and LRU list
+  // with the most recently used page first. The pages are also indexed by
+  // position, so lookups and evictions take constant time.
+  struct CacheShard {
+    Mutex mu;
+    std::list<IndexPage *> pages;
+    std::unordered_map<uint64, std::list<IndexPage *>::iterator> index;
+  };
 
-  // Mark index page as accessed.
-  IndexPage *access(IndexPage *page) {
-    page->lru = epoch_++;
-    return page;
+  // Find the index entries for record with fingerprint in the leaf pages.
+  void FindEntries(uint64 fp, Index *entries, RecordReadBuffers *buffers);
+
+  // Get the entries in index page at position that can cover the fingerprint.
+  // These are the last entry before the fingerprint and the entries with the
+  // fingerprint.
+  void GetEntries(uint64 position, uint64 fp, Index *entries,
+                  RecordReadBuffers *buffers);
+
+  // Call visitor with the index page at position. The page is read into the
+  // cache if it is not already there. The visitor is called without holding
+  // the cache lock, and the page is kept alive until the visitor returns even
+  // if it is evicted from the cache in the meantime.
+  void VisitIndexPage(uint64 position, RecordReadBuffers *buffers,
+                      const std::function<void(const IndexPage *)> &visitor);
+
+  // Release reference to index page and delete it when it is no longer used.
+  static void ReleaseIndexPage(IndexPage *page) {
+    if (page->refs.fetch_sub(1) == 1) delete page;
   }
 
+  // Add entries in index page that can cover the fingerprint.
+  static void AddEntries(const IndexPage *page, uint64 fp, Index *entries);
+
   // Record file with index (not owned).
   RecordReader *reader_;
 
   // Root index page.
   IndexPage *root_;
 
-  // Maximum index page cache size.
+  // Bloom filter for the key fingerprints or null if the file has no filter.
+  BloomFilter *bloom_ = nullptr;
+
+  // Maximum number of index pages in each cache shard.
   int cache_size_;
 
-  // Epoch for LRU cache eviction.
-  uint64 epoch_ = 0;
+  // Index page cache sharded by page position.
+  std::vector<CacheShard> cache_;
 
-  // Index page cache.
-  std::vector<RecordFile::IndexPage *> cache_;
+  // Buffers for lookups through the reader.
+  RecordReadBuffers buffers_;
 };
 
 // A record database is a sharded set of indexed record files where records can
@@ -316,8 +529,31 @@ class RecordDatabase {
   bool Read(int shard, int64 position, Record *record);
 
   // Look up record by key. Returns false if no matching record is found.
+  // Like Read(), this changes the current shard and its reader position, so
+  // Next() continues after the record. It is not thread-safe.
   bool Lookup(const Slice &key, Record *record);
 
+  // Concurrent versions of Read() and Lookup(). These do not change the state
+  // of the database and can be called from multiple threads with separate
+  // buffers. The record data is only valid until the next read with the same
+  // buffers.
+  bool Read(int shard, int64 position, Record *record,
+            RecordReadBuffers *buffers);
+  bool Lookup(const Slice &key, Record *record, RecordReadBuffers *buffers);
+
+  // Look up records for a batch of keys. The keys are grouped by shard, the
+  // index of each shard is traversed once in key fingerprint order, and the
+  // records are read in file order. The callback is called with the index of
+  // the key and the record for each key that is found. If there are multiple
+  // records for a key, the first in the file is used. Like the concurrent
+  // lookups, this can be called from multiple threads with separate buffers.
+  // Returns the number of keys found.
+  int LookupBatch(const std::vector<Slice> &keys, RecordReadBuffers *buffers,
+                  const RecordIndex::BatchCallback &callback);
+
+  // Return shard for key.
+  int Shard(const Slice &key) const;
+
   // Retrieve the next record from the current shard.
   bool Next(Record *record);
 
@@ -372,6 +608,16 @@ class RecordWriter : public RecordFile {
   // Flush output buffer to disk.
   Status Flush();
 
+  // Write record to file and return the position of the record.
+  Status WriteRecord(RecordType type, const Slice &key, const Slice &value,
+                     uint64 *position);
+
+  // Add data record to current block for block compression.
+  Status AddToBlock(const Record &record);
+
+  // Compress current block and write it to a block record.
+  Status FlushBlock();
+
   // Write index to disk.
   Status WriteIndex();
 
@@ -395,6 +641,18 @@ class RecordWriter : public RecordFile {
 
   // Index entries for building index.
   Index index_;
+
+  // Number of bits per key in Bloom filter.
+  int bloom_bits_per_key_;
+
+  // Uncompressed records in current block for block compression.
+  RecordBuffer block_;
+
+  // Block size for block compression.
+  int block_size_ = 0;
+
+  // Index entries for the records in the current block start at this index.
+  int block_index_start_ = 0;
 };
 
 }  // namespace sling
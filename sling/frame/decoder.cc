@@ -30,6 +30,13 @@ Decoder::Decoder(Store *store, Input *input)
   if (input->Peek() == WIRE_BINARY_MARKER) input->Skip(1);
 }
 
+void Decoder::set_dictionary(const SymbolDictionary *dictionary) {
+  dictionary_ = dictionary;
+  direct_ = dictionary != nullptr &&
+            (store_ == dictionary->store() ||
+             store_->globals() == dictionary->store());
+}
+
 Object Decoder::Decode() {
   return Object(store_, DecodeObject());
 }
@@ -111,6 +118,14 @@ Handle Decoder::DecodeObject() {
           handle = DecodeFrame(slots, replace);
           break;
         }
+        case WIRE_SHARED:
+          handle = DecodeShared();
+          *references_.push() = handle;
+          break;
+        case WIRE_DICTIONARY:
+          CheckDictionary();
+          handle = DecodeObject();
+          break;
         default: LOG(FATAL) << "Invalid tag value: " << tag;
       }
   }
@@ -160,13 +175,15 @@ Handle Decoder::DecodeFrame(int slots, int replace) {
         if (existing->IsProxy()) {
           // Swap the handle for the existing proxy and the new frame.
           FrameDatum *frame = store_->Deref(handle)->AsFrame();
+          Handle proxy = existing->self;
           store_->ReplaceProxy(existing->AsProxy(), frame);
-          handle = frame->self;
+          handle = proxy;
 
           // Update the handle in the reference table.
           *(references_.base() + index) = handle;
 
           // Unbind the symbol. It will be bound to the frame later.
+          symbol = store_->GetMutableObject(value)->AsSymbol();
           symbol->value = symbol->self;
         }
       }
@@ -211,6 +228,14 @@ Handle Decoder::DecodeFrame(int slots, int replace) {
 }
 
 Handle Decoder::DecodeString(int size) {
+  // Borrow string data if it is available in the input buffer.
+  if (borrow_strings_ && size >= kMinBorrowedString) {
+    const char *data;
+    if (input_->TryRead(size, &data)) {
+      return store_->AllocateBorrowedString(Text(data, size));
+    }
+  }
+
   // Allocate string object; argument is the size of the string.
   Handle handle = store_->AllocateString(size);
 
@@ -241,6 +266,7 @@ Handle Decoder::DecodeArray() {
   ArrayDatum *array = store_->Deref(handle)->AsArray();
   Handle *dest = array->begin();
   while (source < end) *dest++ = *source++;
+  store_->Remember(handle);
 
   // Remove elements from stack.
   Release(mark);
@@ -276,5 +302,27 @@ Handle Decoder::DecodeLink(int name_size) {
   }
 }
 
-}  // namespace sling
+void Decoder::CheckDictionary() {
+  // Check that the input was encoded with the same symbol dictionary.
+  uint64 fingerprint;
+  CHECK(input_->ReadVarint64(&fingerprint));
+  CHECK(dictionary_ != nullptr) << "Symbol dictionary needed for decoding";
+  CHECK_EQ(fingerprint, dictionary_->fingerprint())
+      << "Input encoded with different symbol dictionary";
+  dictionary_checked_ = true;
+}
 
+Handle Decoder::DecodeShared() {
+  // Read dictionary number for symbol.
+  uint32 index;
+  CHECK(input_->ReadVarint32(&index));
+  CHECK(dictionary_checked_) << "Symbol dictionary has not been checked";
+  CHECK_LT(index, dictionary_->size());
+
+  // Use the frame from the dictionary if it is in the store. Otherwise, the
+  // symbol is looked up by name.
+  if (direct_) return dictionary_->frame(index);
+  return store_->Lookup(dictionary_->name(index));
+}
+
+}  // namespace sling
@@ -20,6 +20,7 @@
 #include "sling/base/macros.h"
 #include "sling/frame/object.h"
 #include "sling/frame/store.h"
+#include "sling/frame/symbol-dictionary.h"
 #include "sling/stream/input.h"
 
 namespace sling {
@@ -46,6 +47,17 @@ class Decoder {
   // Skips frames in the input which are already in the store.
   void set_skip_known_frames(bool b) { skip_known_frames_ = b; }
 
+  // Resolves links to symbols in the shared symbol dictionary. This must be
+  // the same dictionary that was used for encoding the input.
+  void set_dictionary(const SymbolDictionary *dictionary);
+
+  // Borrows the string data for large strings from the input buffer instead of
+  // copying it into the store. This is only safe if the input is backed by a
+  // memory buffer, e.g. an ArrayInputStream, that outlives the decoded
+  // strings, or if the store copies the borrowed strings with
+  // CopyBorrowedStrings() before the buffer is released.
+  void set_borrow_strings(bool b) { borrow_strings_ = b; }
+
  private:
   // Decodes frame from input.
   Handle DecodeFrame(int slots, int replace);
@@ -62,6 +74,13 @@ class Decoder {
   // Decodes bound symbol from input.
   Handle DecodeLink(int name_size);
 
+  // Checks the symbol dictionary fingerprint in the input against the
+  // fingerprint of the symbol dictionary for the decoder.
+  void CheckDictionary();
+
+  // Decodes bound symbol in shared dictionary from input.
+  Handle DecodeShared();
+
   // Gets the current location in the stack.
   Word Mark() { return stack_.offset(stack_.end()); }
 
@@ -99,6 +118,22 @@ class Decoder {
   // Frames that already exist in the store can be skipped by the decoder.
   bool skip_known_frames_ = false;
 
+  // Borrow string data from input buffer.
+  bool borrow_strings_ = false;
+
+  // Shared symbol dictionary for links (optional). If the store is the
+  // dictionary store or a local store for it, the frames in the dictionary can
+  // be used directly. Otherwise, the symbols are looked up by name.
+  const SymbolDictionary *dictionary_ = nullptr;
+  bool direct_ = false;
+
+  // The dictionary fingerprint in the input has been checked.
+  bool dictionary_checked_ = false;
+
+  // Strings shorter than this are always copied, since the borrowed string
+  // object would not be much smaller than the copy.
+  static const int kMinBorrowedString = 64;
+
   DISALLOW_IMPLICIT_CONSTRUCTORS(Decoder);
 };
 
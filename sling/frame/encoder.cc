@@ -36,6 +36,17 @@ Encoder::Encoder(const Store *store, Output *output)
   output_->WriteChar(WIRE_BINARY_MARKER);
 }
 
+void Encoder::set_dictionary(const SymbolDictionary *dictionary) {
+  // The symbols in the dictionary can only be used if the store is the
+  // dictionary store or a local store on top of it.
+  if (dictionary != nullptr &&
+      store_ != dictionary->store() &&
+      store_->globals() != dictionary->store()) {
+    dictionary = nullptr;
+  }
+  dictionary_ = dictionary;
+}
+
 void Encoder::EncodeAll() {
   const MapDatum *map = store_->GetMap(store_->symbols());
   for (Handle *bucket = map->begin(); bucket < map->end(); ++bucket) {
@@ -183,6 +194,23 @@ void Encoder::EncodeLink(Handle handle) {
 }
 
 void Encoder::EncodeSymbol(const SymbolDatum *symbol, int type) {
+  // Output link to symbol in shared dictionary by number.
+  if (type == WIRE_LINK && dictionary_ != nullptr) {
+    int index = dictionary_->Lookup(symbol->self);
+    if (index != -1) {
+      // Output dictionary fingerprint before the first dictionary number, so
+      // the decoder can check that it uses the same dictionary.
+      if (!dictionary_checked_) {
+        WriteTag(WIRE_SPECIAL, WIRE_DICTIONARY);
+        output_->WriteVarint64(dictionary_->fingerprint());
+        dictionary_checked_ = true;
+      }
+      WriteTag(WIRE_SPECIAL, WIRE_SHARED);
+      output_->WriteVarint32(index);
+      return;
+    }
+  }
+
   const StringDatum *name = store_->GetString(symbol->name);
   WriteTag(type, name->size());
   output_->Write(name->data(), name->size());
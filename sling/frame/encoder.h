@@ -20,6 +20,7 @@
 #include "sling/base/macros.h"
 #include "sling/frame/object.h"
 #include "sling/frame/store.h"
+#include "sling/frame/symbol-dictionary.h"
 #include "sling/stream/output.h"
 
 namespace sling {
@@ -34,6 +35,10 @@ class Encoder {
   void Encode(const Object &object) { EncodeObject(object.handle()); }
   void Encode(Handle handle) { EncodeObject(handle); }
 
+  // Encodes link to object. Named frames are only output as links, like the
+  // slots of an encoded frame.
+  void EncodeLink(Handle handle);
+
   // Encodes all frames in the symbol table of the store.
   void EncodeAll();
 
@@ -41,6 +46,12 @@ class Encoder {
   void set_shallow(bool shallow) { shallow_ = shallow; }
   void set_global(bool global) { global_ = global; }
 
+  // Output links to frames in the shared symbol dictionary by number instead
+  // of by name. The decoder must use the same symbol dictionary. The
+  // dictionary is only used if the store is the dictionary store or a local
+  // store on top of it.
+  void set_dictionary(const SymbolDictionary *dictionary);
+
  private:
   // Object encoding states.
   enum Status {
@@ -64,9 +75,6 @@ class Encoder {
   // Encodes object for handle.
   void EncodeObject(Handle handle);
 
-  // Encodes object link.
-  void EncodeLink(Handle handle);
-
   // Encodes symbol.
   void EncodeSymbol(const SymbolDatum *symbol, int type);
 
@@ -97,6 +105,12 @@ class Encoder {
   // Output frames in the global store by value.
   bool global_;
 
+  // Shared symbol dictionary for links (optional).
+  const SymbolDictionary *dictionary_ = nullptr;
+
+  // The dictionary fingerprint has been output.
+  bool dictionary_checked_ = false;
+
   DISALLOW_IMPLICIT_CONSTRUCTORS(Encoder);
 };
 
@@ -0,0 +1,295 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/frame/inverse-index.h"
+
+#include <algorithm>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/logging.h"
+#include "sling/file/file.h"
+#include "sling/util/thread.h"
+#include "third_party/jit/cpu.h"
+
+namespace sling {
+
+Status InverseIndex::Build(Store *store, const std::vector<Handle> &roles,
+                           int num_threads) {
+  // Only frozen global stores can be indexed since the handles must be stable.
+  if (store->globals() != nullptr) {
+    return Status(1, "local store cannot be indexed");
+  }
+  if (!store->frozen()) {
+    return Status(1, "store must be frozen before indexing");
+  }
+
+  Clock timer;
+  timer.start();
+  handles_ = store->handles_.length();
+  symbols_ = store->num_symbols();
+  fingerprint_ = store->snapshot_fingerprint();
+
+  // Sort roles so they can be found with binary search.
+  roles_ = roles;
+  std::sort(roles_.begin(), roles_.end(), [](Handle a, Handle b) {
+    return a.raw() < b.raw();
+  });
+  roles_.erase(std::unique(roles_.begin(), roles_.end()), roles_.end());
+  auto indexed = [this](Handle name) {
+    return std::binary_search(roles_.begin(), roles_.end(), name,
+                              [](Handle a, Handle b) {
+                                return a.raw() < b.raw();
+                              });
+  };
+
+  // Get heaps for store.
+  std::vector<Heap *> heaps;
+  for (Heap *heap = store->first_heap_; heap != nullptr; heap = heap->next()) {
+    heaps.push_back(heap);
+  }
+
+  // Each worker collects the edges for the frames in a subset of the heaps and
+  // sorts them.
+  struct Edge {
+    Key key;
+    Handle source;
+
+    bool operator<(const Edge &other) const {
+      if (key.target != other.key.target || key.role != other.key.role) {
+        return key < other.key;
+      }
+      return source.raw() < other.source.raw();
+    }
+    bool operator==(const Edge &other) const {
+      return key.target == other.key.target && key.role == other.key.role &&
+             source == other.source;
+    }
+  };
+  if (num_threads <= 0) num_threads = jit::CPU::Processors();
+  num_threads = std::max(std::min<int>(num_threads, heaps.size()), 1);
+  std::vector<std::vector<Edge>> edges(num_threads);
+  auto worker = [&](int index) {
+    std::vector<Edge> &out = edges[index];
+    for (int i = index; i < heaps.size(); i += num_threads) {
+      Datum *object = heaps[i]->base();
+      Datum *end = heaps[i]->end();
+      while (object < end) {
+        if (object->IsFrame()) {
+          FrameDatum *frame = object->AsFrame();
+          for (const Slot *s = frame->begin(); s < frame->end(); ++s) {
+            if (!indexed(s->name)) continue;
+            Handle target = store->Resolve(s->value);
+            if (!store->IsFrame(target) && !store->IsProxy(target)) continue;
+            out.push_back(Edge{Key{target, s->name}, frame->self});
+          }
+        }
+        object = object->next();
+      }
+    }
+    std::sort(out.begin(), out.end());
+  };
+  if (num_threads == 1) {
+    worker(0);
+  } else {
+    WorkerPool pool;
+    pool.Start(num_threads, worker);
+    pool.Join();
+  }
+
+  // Merge the sorted edges from the workers into rows, removing duplicate
+  // edges from frames with repeated slots.
+  typedef std::pair<const Edge *, const Edge *> Cursor;
+  auto later = [](const Cursor &a, const Cursor &b) {
+    return *b.first < *a.first;
+  };
+  std::priority_queue<Cursor, std::vector<Cursor>, decltype(later)>
+      queue(later);
+  int64 total = 0;
+  for (const auto &e : edges) {
+    if (!e.empty()) queue.emplace(e.data(), e.data() + e.size());
+    total += e.size();
+  }
+  keys_.clear();
+  offsets_.clear();
+  sources_.clear();
+  sources_.reserve(total);
+  const Edge *last = nullptr;
+  while (!queue.empty()) {
+    Cursor cursor = queue.top();
+    queue.pop();
+    const Edge *edge = cursor.first;
+    if (last == nullptr || !(*edge == *last)) {
+      if (last == nullptr || edge->key.target != last->key.target ||
+          edge->key.role != last->key.role) {
+        keys_.push_back(edge->key);
+        offsets_.push_back(sources_.size());
+      }
+      sources_.push_back(edge->source);
+      last = edge;
+    }
+    if (++cursor.first != cursor.second) queue.push(cursor);
+  }
+  offsets_.push_back(sources_.size());
+  timer.stop();
+
+  VLOG(1) << "Inverse index with " << keys_.size() << " rows and "
+          << sources_.size() << " edges built in " << timer.ms() << " ms using "
+          << num_threads << " threads";
+  return Status::OK;
+}
+
+Status InverseIndex::Read(Store *store, const string &filename) {
+  // Open index file.
+  File *file;
+  Status st = File::Open(filename + ".inv", "r", &file);
+  if (!st.ok()) return st;
+
+  // Read and check header. The sizes in the header must add up to the file
+  // size before any memory is allocated for the index.
+  Header hdr;
+  uint64 size;
+  st = file->GetSize(&size);
+  if (st.ok()) st = file->Read(&hdr, sizeof(Header));
+  if (st.ok()) {
+    if (hdr.magic != MAGIC || hdr.version != VERSION) {
+      st = Status(1, "invalid inverse index", filename);
+    } else if (hdr.roles < 0 || hdr.rows < 0 || hdr.edges < 0 ||
+               static_cast<uint64>(hdr.edges) > size ||
+               size != sizeof(Header) + hdr.roles * sizeof(Handle) +
+                       hdr.rows * sizeof(Key) +
+                       (hdr.rows + 1) * sizeof(int64) +
+                       hdr.edges * sizeof(Handle)) {
+      st = Status(1, "corrupt inverse index", filename);
+    } else if (hdr.fingerprint != store->snapshot_fingerprint() ||
+               hdr.handles != store->handles_.length() ||
+               hdr.symbols != store->num_symbols()) {
+      st = Status(1, "inverse index does not match store", filename);
+    }
+  }
+
+  // Read index.
+  if (st.ok()) {
+    handles_ = hdr.handles;
+    symbols_ = hdr.symbols;
+    fingerprint_ = hdr.fingerprint;
+    roles_.resize(hdr.roles);
+    keys_.resize(hdr.rows);
+    offsets_.resize(hdr.rows + 1);
+    sources_.resize(hdr.edges);
+    st = file->Read(roles_.data(), roles_.size() * sizeof(Handle));
+    if (st.ok()) st = file->Read(keys_.data(), keys_.size() * sizeof(Key));
+    if (st.ok()) {
+      st = file->Read(offsets_.data(), offsets_.size() * sizeof(int64));
+    }
+    if (st.ok()) {
+      st = file->Read(sources_.data(), sources_.size() * sizeof(Handle));
+    }
+
+    // Check that the rows are consecutive ranges covering all the sources.
+    if (st.ok()) {
+      bool valid = offsets_.front() == 0 && offsets_.back() == hdr.edges;
+      for (int64 i = 0; valid && i < hdr.rows; ++i) {
+        if (offsets_[i] > offsets_[i + 1]) valid = false;
+      }
+      if (!valid) st = Status(1, "corrupt inverse index offsets", filename);
+    }
+
+    // Do not keep a partially read index.
+    if (!st.ok()) {
+      roles_.clear();
+      keys_.clear();
+      offsets_.clear();
+      sources_.clear();
+    }
+  }
+
+  file->Close();
+  return st;
+}
+
+Status InverseIndex::Write(const string &filename) const {
+  // Open output file.
+  File *file;
+  Status st = File::Open(filename + ".inv", "w", &file);
+  if (!st.ok()) return st;
+
+  // Write header.
+  Header hdr;
+  hdr.magic = MAGIC;
+  hdr.version = VERSION;
+  hdr.handles = handles_;
+  hdr.symbols = symbols_;
+  hdr.roles = roles_.size();
+  hdr.rows = keys_.size();
+  hdr.edges = sources_.size();
+  hdr.fingerprint = fingerprint_;
+  st = file->Write(&hdr, sizeof(Header));
+
+  // Write index.
+  if (st.ok()) st = file->Write(roles_.data(), roles_.size() * sizeof(Handle));
+  if (st.ok()) st = file->Write(keys_.data(), keys_.size() * sizeof(Key));
+  if (st.ok()) {
+    st = file->Write(offsets_.data(), offsets_.size() * sizeof(int64));
+  }
+  if (st.ok()) {
+    st = file->Write(sources_.data(), sources_.size() * sizeof(Handle));
+  }
+
+  if (!st.ok()) {
+    file->Close();
+    return st;
+  }
+  return file->Close();
+}
+
+InverseIndex::Range InverseIndex::Lookup(Handle target, Handle role) const {
+  Key key{target, role};
+  const Key *begin = keys_.data();
+  const Key *end = begin + keys_.size();
+  const Key *row = std::lower_bound(begin, end, key);
+  if (row == end || row->target != target || row->role != role) {
+    return Range(nullptr, nullptr);
+  }
+  return Rows(row, row + 1);
+}
+
+InverseIndex::Range InverseIndex::Lookup(Handle target) const {
+  const Key *begin = keys_.data();
+  const Key *end = begin + keys_.size();
+  auto rows = std::equal_range(begin, end, Key{target, Handle::nil()},
+                               [](const Key &a, const Key &b) {
+                                 return a.target.raw() < b.target.raw();
+                               });
+  return Rows(rows.first, rows.second);
+}
+
+InverseIndex::Range InverseIndex::Rows(const Key *begin,
+                                       const Key *end) const {
+  if (begin == end) return Range(nullptr, nullptr);
+  const Handle *sources = sources_.data();
+  return Range(sources + offsets_[begin - keys_.data()],
+               sources + offsets_[end - keys_.data()]);
+}
+
+int64 InverseIndex::memory() const {
+  return roles_.capacity() * sizeof(Handle) +
+         keys_.capacity() * sizeof(Key) +
+         offsets_.capacity() * sizeof(int64) +
+         sources_.capacity() * sizeof(Handle);
+}
+
+}  // namespace sling
@@ -0,0 +1,141 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_FRAME_INVERSE_INDEX_H_
+#define SLING_FRAME_INVERSE_INDEX_H_
+
+#include <string>
+#include <vector>
+
+#include "sling/base/status.h"
+#include "sling/base/types.h"
+#include "sling/frame/store.h"
+
+namespace sling {
+
+// An inverse index maps frames in a frozen global store to the frames that
+// point to them through a selected set of slot names (roles), e.g. all the
+// instances of a class or all the members of a category. The index is stored
+// in compressed sparse row (CSR) format, where each row is a (target, role)
+// pair and the row contents are the source frames sorted by handle. Values
+// that are qualified with an is: slot are resolved before indexing. Since the
+// handles in a frozen store are stable, the index can be saved in a .inv file
+// next to the snapshot for the store and loaded together with the snapshot.
+class InverseIndex {
+ public:
+  // Range of source frames in the index.
+  class Range {
+   public:
+    Range(const Handle *begin, const Handle *end) : begin_(begin), end_(end) {}
+
+    const Handle *begin() const { return begin_; }
+    const Handle *end() const { return end_; }
+    int size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+    Handle operator[](int index) const { return begin_[index]; }
+
+   private:
+    const Handle *begin_;
+    const Handle *end_;
+  };
+
+  // Builds inverse index for slots with the roles in a frozen global store.
+  // The heaps are scanned in parallel. If the number of threads is zero, it is
+  // selected based on the number of heaps and cores.
+  Status Build(Store *store, const std::vector<Handle> &roles,
+               int num_threads = 0);
+
+  // Reads inverse index for store from .inv file. The store must be restored
+  // from the same snapshot that the index was built for. This is checked with
+  // the snapshot fingerprint of the store. A corrupt index file is rejected and
+  // leaves the index empty.
+  Status Read(Store *store, const string &filename);
+
+  // Writes inverse index to .inv file.
+  Status Write(const string &filename) const;
+
+  // Returns the frames that have a slot with the role pointing to the target.
+  Range Lookup(Handle target, Handle role) const;
+
+  // Returns the frames that point to the target through any of the roles.
+  // Frames pointing to the target through more than one role are repeated.
+  Range Lookup(Handle target) const;
+
+  // Indexed roles.
+  const std::vector<Handle> &roles() const { return roles_; }
+
+  // Number of rows, i.e. (target, role) pairs, in the index.
+  int num_rows() const { return keys_.size(); }
+
+  // Number of edges in the index.
+  int64 num_edges() const { return sources_.size(); }
+
+  // Memory used by the index.
+  int64 memory() const;
+
+ private:
+  // Row key with target and role.
+  struct Key {
+    Handle target;
+    Handle role;
+
+    bool operator<(const Key &other) const {
+      if (target != other.target) return target.raw() < other.target.raw();
+      return role.raw() < other.role.raw();
+    }
+  };
+
+  // Return range of sources for rows from begin to end.
+  Range Rows(const Key *begin, const Key *end) const;
+
+  // Magic number and version for inverse index files.
+  static const int MAGIC = 0x58564e49;
+  static const int VERSION = 2;
+
+  // Inverse index file header.
+  struct Header {
+    int magic;    // magic number for identifying index file
+    int version;  // index file format version
+    int handles;  // size of handle table for store
+    int symbols;  // number of symbols in store
+    int roles;    // number of indexed roles
+    int rows;     // number of rows in index
+    int64 edges;  // number of edges in index
+    uint64 fingerprint;  // snapshot fingerprint for store (version 2+)
+  };
+
+  // Indexed roles.
+  std::vector<Handle> roles_;
+
+  // Sorted row keys.
+  std::vector<Key> keys_;
+
+  // Start of each row in the source array. There is an extra entry at the end
+  // with the total number of edges.
+  std::vector<int64> offsets_;
+
+  // Source frames for all rows.
+  std::vector<Handle> sources_;
+
+  // Size of handle table and symbol table and the snapshot fingerprint for the
+  // indexed store. These are used for checking that the index matches the
+  // store when it is loaded.
+  int handles_ = 0;
+  int symbols_ = 0;
+  uint64 fingerprint_ = 0;
+};
+
+}  // namespace sling
+
+#endif  // SLING_FRAME_INVERSE_INDEX_H_
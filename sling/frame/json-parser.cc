@@ -0,0 +1,579 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/frame/json-parser.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+#include <string.h>
+#include <string>
+
+#include "sling/base/logging.h"
+#include "sling/string/numbers.h"
+
+namespace sling {
+
+// Character classes for scalar classification of input blocks.
+enum CharClass {
+  CHAR_OTHER = 0,
+  CHAR_QUOTE = 1,
+  CHAR_BACKSLASH = 2,
+  CHAR_OP = 3,
+  CHAR_SPACE = 4,
+  CHAR_NEWLINE = 5,
+};
+
+// Character class for each input byte. Quotes, backslashes, the structural
+// characters {}[]:, and whitespace have their own classes. All other bytes,
+// including all bytes above 0x7F, are CHAR_OTHER.
+static const uint8 char_class[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 5, 0, 0, 4, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  4, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 2, 3, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0, 3, 0, 0,
+};
+
+// Returns true if the character terminates a number or literal.
+static inline bool IsTerminator(char ch) {
+  return char_class[static_cast<uint8>(ch)] != CHAR_OTHER;
+}
+
+// Converts hexadecimal character to digit value.
+static int HexToDigit(int ch) {
+  if (ch >= '0' && ch <= '9') return ch - '0';
+  if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+  if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+  return -1;
+}
+
+// Appends Unicode code point to string as UTF-8. Like the tokenizer for the
+// reader, surrogates are encoded individually.
+static void AppendUTF8(uint32 code, string *str) {
+  if (code <= 0x7f) {
+    str->push_back(code);
+  } else if (code <= 0x7ff) {
+    str->push_back(0xc0 | (code >> 6));
+    str->push_back(0x80 | (code & 0x3f));
+  } else if (code <= 0xffff) {
+    str->push_back(0xe0 | (code >> 12));
+    str->push_back(0x80 | ((code >> 6) & 0x3f));
+    str->push_back(0x80 | (code & 0x3f));
+  } else {
+    str->push_back(0xf0 | (code >> 18));
+    str->push_back(0x80 | ((code >> 12) & 0x3f));
+    str->push_back(0x80 | ((code >> 6) & 0x3f));
+    str->push_back(0x80 | (code & 0x3f));
+  }
+}
+
+// Scalar block classification.
+static void ClassifyScalar(const char *data, JSONParser::Block *block) {
+  uint64 masks[6] = {0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < 64; ++i) {
+    masks[char_class[static_cast<uint8>(data[i])]] |= 1ULL << i;
+  }
+  block->quote = masks[CHAR_QUOTE];
+  block->backslash = masks[CHAR_BACKSLASH];
+  block->op = masks[CHAR_OP];
+  block->newline = masks[CHAR_NEWLINE];
+  block->space = masks[CHAR_SPACE] | block->newline;
+}
+
+#ifdef __x86_64__
+
+// Vectorized block classification using AVX2. Each half of the block is
+// compared against the special characters and the comparison results are
+// converted to bitmasks. Setting bit 5 maps '[' and ']' to '{' and '}'.
+__attribute__((target("avx2")))
+static inline uint64 Match32(__m256i eq) {
+  return static_cast<uint32>(_mm256_movemask_epi8(eq));
+}
+
+__attribute__((target("avx2")))
+static void ClassifyAVX2(const char *data, JSONParser::Block *block) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i lbrace = _mm256_set1_epi8('{');
+  const __m256i rbrace = _mm256_set1_epi8('}');
+  const __m256i bit5 = _mm256_set1_epi8(0x20);
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i nl = _mm256_set1_epi8('\n');
+
+  uint64 masks[5] = {0, 0, 0, 0, 0};
+  for (int half = 0; half < 2; ++half) {
+    __m256i v = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(data + half * 32));
+    __m256i lower = _mm256_or_si256(v, bit5);
+    __m256i op = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(lower, lbrace),
+                        _mm256_cmpeq_epi8(lower, rbrace)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, colon),
+                        _mm256_cmpeq_epi8(v, comma)));
+    __m256i newline = _mm256_cmpeq_epi8(v, nl);
+    __m256i ws = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                        _mm256_cmpeq_epi8(v, tab)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), newline));
+    int shift = half * 32;
+    masks[0] |= Match32(_mm256_cmpeq_epi8(v, quote)) << shift;
+    masks[1] |= Match32(_mm256_cmpeq_epi8(v, backslash)) << shift;
+    masks[2] |= Match32(op) << shift;
+    masks[3] |= Match32(ws) << shift;
+    masks[4] |= Match32(newline) << shift;
+  }
+  block->quote = masks[0];
+  block->backslash = masks[1];
+  block->op = masks[2];
+  block->space = masks[3];
+  block->newline = masks[4];
+}
+
+#endif
+
+// The block classification function is selected on first use. This avoids
+// probing the CPU during static initialization. Threads racing on the first
+// parse all store the same function, so relaxed atomic stores are sufficient.
+static void ClassifyFirst(const char *data, JSONParser::Block *block) {
+#ifdef __x86_64__
+  if (JSONParser::Vectorize(true)) return ClassifyAVX2(data, block);
+#endif
+  ClassifyScalar(data, block);
+}
+
+std::atomic<JSONParser::ClassifyFunc> JSONParser::classify(ClassifyFirst);
+
+bool JSONParser::Vectorize(bool enable) {
+#ifdef __x86_64__
+  // The CPU is probed with the compiler builtins, since jit::CPU also enables
+  // flush-to-zero mode for the calling thread when probing the CPU.
+  __builtin_cpu_init();
+  if (enable && __builtin_cpu_supports("avx2")) {
+    classify.store(ClassifyAVX2, std::memory_order_relaxed);
+    return true;
+  }
+#endif
+  classify.store(ClassifyScalar, std::memory_order_relaxed);
+  return false;
+}
+
+// Returns the mask of characters escaped by backslashes. A character is
+// escaped if it is preceded by an odd-length sequence of backslashes. The
+// carry is set if the block ends with an unfinished escape.
+static inline uint64 FindEscaped(uint64 backslash, uint64 *carry) {
+  // Ignore backslash at the start of the block if it is escaped by the
+  // previous block.
+  backslash &= ~*carry;
+  uint64 follows_escape = (backslash << 1) | *carry;
+
+  // Backslash sequences starting on odd bits are found by adding the
+  // sequence starts to the backslash mask, which clears the sequences and
+  // sets the bit after each sequence.
+  const uint64 even_bits = 0x5555555555555555ULL;
+  uint64 odd_starts = backslash & ~even_bits & ~follows_escape;
+  uint64 sequences_on_even;
+  *carry = __builtin_add_overflow(odd_starts, backslash, &sequences_on_even);
+  uint64 invert_mask = sequences_on_even << 1;
+
+  // Every other character after a backslash is escaped.
+  return (even_bits ^ invert_mask) & follows_escape;
+}
+
+// Returns the prefix xor of the bits, i.e. bit i in the result is the xor of
+// bits 0 to i in the input.
+static inline uint64 PrefixXor(uint64 bits) {
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+Object JSONParser::Parse(Text json) {
+  input_ = json.data();
+  size_ = json.size();
+  next_ = 0;
+  epoch_++;
+  error_message_.clear();
+  error_position_ = -1;
+
+  // Build structural index.
+  if (!Index()) return Object(store_, Handle::error());
+
+  // Parse value.
+  Handle handle = ParseValue();
+  if (error()) stack_.reset();
+  return Object(store_, handle);
+}
+
+bool JSONParser::Index() {
+  // There can be at most one structural character per input byte plus the
+  // sentinel.
+  if (structurals_.size() <= static_cast<size_t>(size_)) {
+    structurals_.resize(size_ + 1);
+  }
+  uint32 *out = structurals_.data();
+
+  uint64 escape_carry = 0;
+  uint64 in_string = 0;
+  uint64 prev_scalar = 0;
+  char padded[64];
+  for (int base = 0; base < size_; base += 64) {
+    // Classify characters in block. The last block is padded with spaces.
+    const char *data = input_ + base;
+    if (size_ - base < 64) {
+      memset(padded, ' ', 64);
+      memcpy(padded, data, size_ - base);
+      data = padded;
+    }
+    Block block;
+    ClassifyFunc classify_block = classify.load(std::memory_order_relaxed);
+    classify_block(data, &block);
+
+    // Find unescaped quotes and compute the mask of characters in strings.
+    // The mask includes the opening quote but not the closing quote.
+    uint64 escaped = FindEscaped(block.backslash, &escape_carry);
+    uint64 quotes = block.quote & ~escaped;
+    uint64 string_mask = PrefixXor(quotes) ^ in_string;
+    in_string = static_cast<uint64>(static_cast<int64>(string_mask) >> 63);
+
+    // Strings cannot span multiple lines.
+    if (block.newline & string_mask) {
+      Error("Unterminated string",
+            base + __builtin_ctzll(block.newline & string_mask));
+      return false;
+    }
+
+    // Numbers and literals start with a non-special character outside strings
+    // that follows a special character.
+    uint64 scalar = ~(block.op | block.space | quotes | string_mask);
+    uint64 scalar_start = scalar & ~((scalar << 1) | prev_scalar);
+    prev_scalar = scalar >> 63;
+
+    // Output positions of structural characters.
+    uint64 structural = (block.op & ~string_mask) | quotes | scalar_start;
+    while (structural != 0) {
+      *out++ = base + __builtin_ctzll(structural);
+      structural &= structural - 1;
+    }
+  }
+  if (in_string) {
+    Error("Unterminated string", size_);
+    return false;
+  }
+
+  // Add sentinel at the end.
+  *out++ = size_;
+  return true;
+}
+
+Handle JSONParser::ParseValue() {
+  switch (current()) {
+    case '"': {
+      Text str;
+      if (!ParseString(&str)) return Handle::error();
+      return store_->AllocateString(str);
+    }
+
+    case '{':
+      return ParseObject();
+
+    case '[':
+      return ParseArray();
+
+    case 0:
+      return Error("Unexpected end of input", position());
+
+    case '}': case ']': case ':': case ',':
+      return Error("Syntax error", position());
+
+    default:
+      return ParseScalar();
+  }
+}
+
+Handle JSONParser::ParseObject() {
+  // Skip open bracket.
+  next_++;
+
+  // Put frame slots on the stack while parsing.
+  Word mark = Mark();
+  if (current() == '}') {
+    next_++;
+  } else {
+    for (;;) {
+      // Parse slot name.
+      if (current() != '"') return Error("Missing object key", position());
+      Text key;
+      if (!ParseString(&key)) return Handle::error();
+      if (key.empty()) return Error("Empty object key", position());
+      Push(LookupKey(key));
+
+      // Skip colon between slot name and value.
+      if (current() != ':') {
+        return Error("Missing colon in object slot", position());
+      }
+      next_++;
+
+      // Parse slot value.
+      Handle value = ParseValue();
+      if (error()) return Handle::error();
+      Push(value);
+
+      // Skip comma between slots.
+      char ch = current();
+      if (ch != ',' && ch != '}') {
+        return Error("Missing comma in object", position());
+      }
+      next_++;
+      if (ch == '}') break;
+    }
+  }
+
+  // Create new frame from slots.
+  Slot *begin = reinterpret_cast<Slot *>(stack_.address(mark));
+  Slot *end = reinterpret_cast<Slot *>(stack_.end());
+  Handle handle = store_->AllocateFrame(begin, end, Handle::nil());
+
+  // Remove slots from stack.
+  Release(mark);
+  return handle;
+}
+
+Handle JSONParser::ParseArray() {
+  // Skip open bracket.
+  next_++;
+
+  // Put elements on the stack while parsing.
+  Word mark = Mark();
+  if (current() == ']') {
+    next_++;
+  } else {
+    for (;;) {
+      // Parse next element and push it on the stack.
+      Handle value = ParseValue();
+      if (error()) return Handle::error();
+      Push(value);
+
+      // Skip comma between elements.
+      char ch = current();
+      if (ch != ',' && ch != ']') {
+        return Error("Missing comma in array", position());
+      }
+      next_++;
+      if (ch == ']') break;
+    }
+  }
+
+  // Create new array from elements.
+  Handle handle = store_->AllocateArray(stack_.address(mark), stack_.end());
+
+  // Remove elements from stack.
+  Release(mark);
+  return handle;
+}
+
+bool JSONParser::ParseString(Text *str) {
+  // The structural index has both the opening and the closing quote.
+  int start = structurals_[next_] + 1;
+  int end = structurals_[next_ + 1];
+  next_ += 2;
+  const char *s = input_ + start;
+  const char *send = input_ + end;
+
+  // Strings without escapes are used directly from the input.
+  const char *escape = static_cast<const char *>(memchr(s, '\\', send - s));
+  if (escape == nullptr) {
+    *str = Text(s, send - s);
+    return true;
+  }
+
+  // Expand escape sequences into the buffer. The same escapes as in the
+  // tokenizer are supported.
+  buffer_.assign(s, escape - s);
+  s = escape;
+  while (s < send) {
+    char ch = *s++;
+    if (ch != '\\') {
+      buffer_.push_back(ch);
+      continue;
+    }
+    ch = *s++;
+    switch (ch) {
+      case 'a': buffer_.push_back('\a'); break;
+      case 'b': buffer_.push_back('\b'); break;
+      case 'f': buffer_.push_back('\f'); break;
+      case 'n': buffer_.push_back('\n'); break;
+      case 'r': buffer_.push_back('\r'); break;
+      case 't': buffer_.push_back('\t'); break;
+      case 'v': buffer_.push_back('\v'); break;
+      case 'x': case 'u': case 'U': {
+        int digits = ch == 'x' ? 2 : (ch == 'u' ? 4 : 8);
+        if (send - s < digits) {
+          Error("Invalid escape in string", s - input_);
+          return false;
+        }
+        uint32 code = 0;
+        for (int i = 0; i < digits; ++i) {
+          int digit = HexToDigit(*s++);
+          if (digit < 0 || code > 0x10ffff) {
+            Error("Invalid escape in string", s - input_ - 1);
+            return false;
+          }
+          code = (code << 4) + digit;
+        }
+        if (code > 0x10ffff) {
+          Error("Invalid Unicode escape in string", s - input_);
+          return false;
+        }
+        if (ch == 'x') {
+          buffer_.push_back(code);
+        } else {
+          AppendUTF8(code, &buffer_);
+        }
+        break;
+      }
+      default:
+        buffer_.push_back(ch);
+    }
+  }
+  *str = Text(buffer_);
+  return true;
+}
+
+Handle JSONParser::ParseScalar() {
+  // Find the end of the number or literal.
+  int start = position();
+  const char *s = input_ + start;
+  const char *end = s;
+  const char *limit = input_ + size_;
+  while (end < limit && !IsTerminator(*end)) end++;
+  int length = end - s;
+  next_++;
+
+  // Parse literals.
+  switch (*s) {
+    case 't':
+      if (length == 4 && memcmp(s, "true", 4) == 0) return Handle::Bool(true);
+      return Error("Invalid literal", start);
+    case 'f':
+      if (length == 5 && memcmp(s, "false", 5) == 0) {
+        return Handle::Bool(false);
+      }
+      return Error("Invalid literal", start);
+    case 'n':
+      if (length == 4 && memcmp(s, "null", 4) == 0) return Handle::nil();
+      return Error("Invalid literal", start);
+  }
+
+  // Check number syntax.
+  const char *p = s;
+  if (p < end && *p == '-') p++;
+  int integral_digits = 0;
+  int32 value = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    if (integral_digits < 9) value = value * 10 + (*p - '0');
+    integral_digits++;
+    p++;
+  }
+  bool fractional = false;
+  if (p < end && *p == '.') {
+    fractional = true;
+    p++;
+    while (p < end && *p >= '0' && *p <= '9') p++;
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    fractional = true;
+    p++;
+    if (p < end && (*p == '-' || *p == '+')) p++;
+    if (p == end) return Error("Missing exponent in number", start);
+    while (p < end && *p >= '0' && *p <= '9') p++;
+  }
+  if (p != end || integral_digits == 0) {
+    return Error("Invalid number", start);
+  }
+
+  if (fractional) {
+    // Convert floating-point number.
+    float number;
+    char buffer[64];
+    if (length < static_cast<int>(sizeof(buffer))) {
+      memcpy(buffer, s, length);
+      buffer[length] = 0;
+      if (!safe_strtof(buffer, &number)) return Error("Invalid number", start);
+    } else {
+      if (!safe_strtof(string(s, length), &number)) {
+        return Error("Invalid number", start);
+      }
+    }
+    return Handle::Float(number);
+  } else {
+    // Integers with up to nine digits cannot overflow.
+    if (integral_digits > 9) {
+      if (!safe_strto32(s, length, &value)) {
+        return Error("Integer overflow", start);
+      }
+    } else if (*s == '-') {
+      value = -value;
+    }
+    return Handle::Integer(value);
+  }
+}
+
+Handle JSONParser::LookupKey(Text key) {
+  // Keys with escape sequences are not cached since they are not in the
+  // input.
+  const char *data = key.data();
+  int size = key.size();
+  bool cacheable = data >= input_ && data < input_ + size_;
+  CachedKey *entry = nullptr;
+  if (cacheable) {
+    if (key_cache_.empty()) {
+      key_cache_.resize(kKeyCacheSize, CachedKey{nullptr, 0, 0, Handle::nil()});
+    }
+    uint32 hash = size;
+    for (int i = 0; i < size; ++i) hash = hash * 33 + data[i];
+    entry = &key_cache_[hash & (kKeyCacheSize - 1)];
+    if (entry->epoch == epoch_ && entry->size == size &&
+        memcmp(entry->data, data, size) == 0) {
+      return entry->name;
+    }
+  }
+
+  // Look up slot name in store. Like the reader, the id key is mapped to _id.
+  Handle name = store_->Lookup(key);
+  if (name.IsId()) name = store_->Lookup("_id");
+  if (cacheable) *entry = CachedKey{data, size, epoch_, name};
+  return name;
+}
+
+Handle JSONParser::Error(const char *message, int pos) {
+  if (error_message_.empty()) {
+    error_message_ = message;
+    error_position_ = pos;
+  }
+  return Handle::error();
+}
+
+}  // namespace sling
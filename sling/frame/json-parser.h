@@ -0,0 +1,177 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_FRAME_JSON_PARSER_H_
+#define SLING_FRAME_JSON_PARSER_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "sling/base/macros.h"
+#include "sling/base/types.h"
+#include "sling/frame/object.h"
+#include "sling/frame/store.h"
+#include "sling/string/text.h"
+
+namespace sling {
+
+// The JSON parser converts JSON text in memory to objects in a store. It
+// produces the same objects as the Reader in JSON mode, i.e. JSON objects are
+// converted to frames with the keys as slot names, but it only accepts
+// standard JSON. Like the reader, it rejects objects with empty keys, since
+// symbols cannot have empty names.
+//
+// The input is parsed in two passes. The first pass builds a structural index
+// with the positions of all brackets, colons, commas, and quotes outside
+// strings as well as the start of all numbers and literals. This is done 64
+// bytes at a time by computing bitmasks for quotes, backslashes, brackets, and
+// whitespace, using AVX2 if the CPU supports it. Escaped quotes are removed
+// using the backslash mask, and the string mask is computed as the prefix xor
+// of the quote mask. The second pass builds the objects from the structural
+// index, so only the contents of strings and numbers need to be read.
+class JSONParser {
+ public:
+  // Initializes parser for parsing JSON into store.
+  explicit JSONParser(Store *store) : store_(store), stack_(store) {}
+
+  // Parses the first JSON value in the input. Any input after the value is
+  // ignored. Returns an error object if the input is not valid JSON.
+  Object Parse(Text json);
+
+  // Re-targets the parser at another store. The structural index and the
+  // other buffers are kept, so one parser can be reused for parsing each input
+  // into a new local store.
+  void set_store(Store *store) {
+    store_ = store;
+    stack_.reset();
+    stack_.Attach(store);
+  }
+
+  // Returns true if the last input could not be parsed.
+  bool error() const { return !error_message_.empty(); }
+
+  // Returns error message and byte position of error in input.
+  const string &error_message() const { return error_message_; }
+  int error_position() const { return error_position_; }
+
+  // Selects vectorized or scalar structural scanning. Vectorized scanning is
+  // only selected if it is supported by the CPU. Returns true if vectorized
+  // scanning is used.
+  static bool Vectorize(bool enable);
+
+  // Bitmasks for a 64-byte block of input with one bit per input byte.
+  struct Block {
+    uint64 quote;      // double quotes
+    uint64 backslash;  // backslashes
+    uint64 op;         // brackets, colons, and commas
+    uint64 space;      // whitespace
+    uint64 newline;    // newlines
+  };
+
+  // Function for computing bitmasks for a 64-byte input block.
+  typedef void (*ClassifyFunc)(const char *data, Block *block);
+
+ private:
+  // Builds structural index for input. Returns false on error.
+  bool Index();
+
+  // Parses value at the current structural position.
+  Handle ParseValue();
+
+  // Parses JSON object as frame.
+  Handle ParseObject();
+
+  // Parses JSON array.
+  Handle ParseArray();
+
+  // Parses string starting at current structural position. Escape sequences
+  // are expanded into the buffer.
+  bool ParseString(Text *str);
+
+  // Parses number or literal starting at current structural position.
+  Handle ParseScalar();
+
+  // Returns the position in the input of the current structural character.
+  int position() const { return structurals_[next_]; }
+
+  // Returns the current structural character. The end of the input is
+  // returned as a nul character.
+  char current() const {
+    int pos = position();
+    return pos < size_ ? input_[pos] : 0;
+  }
+
+  // Looks up slot name for object key.
+  Handle LookupKey(Text key);
+
+  // Records error at input position and returns the error handle.
+  Handle Error(const char *message, int pos);
+
+  // Gets the current location in the handle stack.
+  Word Mark() { return stack_.offset(stack_.end()); }
+
+  // Pops elements off the stack.
+  void Release(Word mark) { stack_.set_end(stack_.address(mark)); }
+
+  // Push value onto stack.
+  void Push(Handle h) { *stack_.push() = h; }
+
+  // Object store for parsed objects.
+  Store *store_;
+
+  // Stack for storing intermediate objects while parsing.
+  HandleSpace stack_;
+
+  // Input text.
+  const char *input_ = nullptr;
+  int size_ = 0;
+
+  // Positions of structural characters in the input followed by a sentinel
+  // with the input size.
+  std::vector<uint32> structurals_;
+
+  // Index of current structural character.
+  int next_ = 0;
+
+  // Buffer for strings with escape sequences.
+  string buffer_;
+
+  // Cache for looking up slot names for object keys. Most JSON documents use
+  // the same keys over and over, so this saves a symbol table lookup for most
+  // keys. Entries are only valid for the input with the same epoch, since the
+  // keys point into the input.
+  struct CachedKey {
+    const char *data;
+    int size;
+    int epoch;
+    Handle name;
+  };
+  static const int kKeyCacheSize = 256;
+  std::vector<CachedKey> key_cache_;
+  int epoch_ = 0;
+
+  // Last error message and position.
+  string error_message_;
+  int error_position_ = -1;
+
+  // Classification function for input blocks.
+  static std::atomic<ClassifyFunc> classify;
+
+  DISALLOW_IMPLICIT_CONSTRUCTORS(JSONParser);
+};
+
+}  // namespace sling
+
+#endif  // SLING_FRAME_JSON_PARSER_H_
@@ -14,6 +14,9 @@
 
 #include "sling/frame/json.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <string>
 
 #include "sling/base/logging.h"
@@ -22,6 +25,64 @@
 
 namespace sling {
 
+// Returns true if the character needs to be escaped in JSON strings.
+static inline bool NeedsEscape(unsigned char ch) {
+  return ch < 0x20 || ch == '"' || ch == '\\';
+}
+
+// Returns the first character in the range that needs to be escaped, or end
+// if there is none.
+static const unsigned char *FindEscapeScalar(const unsigned char *s,
+                                             const unsigned char *end) {
+  while (s < end && !NeedsEscape(*s)) s++;
+  return s;
+}
+
+#ifdef __SSE2__
+
+// Vectorized search for characters that need to be escaped, checking 16
+// characters at a time. Control characters are found with an unsigned
+// minimum, since SSE2 only has signed byte comparisons.
+static const unsigned char *FindEscapeSSE2(const unsigned char *s,
+                                           const unsigned char *end) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1f);
+  while (end - s >= 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+        _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+    int mask = _mm_movemask_epi8(special);
+    if (mask != 0) return s + __builtin_ctz(mask);
+    s += 16;
+  }
+  return FindEscapeScalar(s, end);
+}
+
+// SSE2 is part of the x86-64 baseline, so vectorized escaping is selected at
+// compile time without probing the CPU.
+std::atomic<JSONWriter::FindEscapeFunc> JSONWriter::find_escape(
+    FindEscapeSSE2);
+
+#else
+
+std::atomic<JSONWriter::FindEscapeFunc> JSONWriter::find_escape(
+    FindEscapeScalar);
+
+#endif
+
+bool JSONWriter::Vectorize(bool enable) {
+#ifdef __SSE2__
+  if (enable) {
+    find_escape.store(FindEscapeSSE2, std::memory_order_relaxed);
+    return true;
+  }
+#endif
+  find_escape.store(FindEscapeScalar, std::memory_order_relaxed);
+  return false;
+}
+
 void JSONWriter::Write(const Object &object) {
   CHECK(object.store() == nullptr ||
         object.store() == store_ ||
@@ -69,19 +130,35 @@ void JSONWriter::Write(Handle handle) {
 
 void JSONWriter::WriteString(const StringDatum *str) {
   WriteChar('"');
-  unsigned char *s = str->payload();
-  unsigned char *end = str->limit();
+  const unsigned char *s = reinterpret_cast<const unsigned char *>(str->data());
+  const unsigned char *end = s + str->size();
+  FindEscapeFunc find = find_escape.load(std::memory_order_relaxed);
   while (s < end) {
+    // Output characters that do not need to be escaped in one go.
+    const unsigned char *safe = find(s, end);
+    if (safe != s) {
+      output_->Write(s, safe - s);
+      s = safe;
+      if (s == end) break;
+    }
+
+    // Output escaped character.
     switch (*s) {
-      case '"': WriteChars('\\', '"'); s++; break;
-      case '\\': WriteChars('\\', '\\'); s++; break;
-      case '\n': WriteChars('\\', 'n'); s++; break;
-      case '\t': WriteChars('\\', 't'); s++; break;
-      case '\b': WriteChars('\\', 'b'); s++; break;
-      case '\f': WriteChars('\\', 'f'); s++; break;
-      case '\r': WriteChars('\\', 'r'); s++; break;
-      default:   WriteChar(*s++);
+      case '"': WriteChars('\\', '"'); break;
+      case '\\': WriteChars('\\', '\\'); break;
+      case '\n': WriteChars('\\', 'n'); break;
+      case '\t': WriteChars('\\', 't'); break;
+      case '\b': WriteChars('\\', 'b'); break;
+      case '\f': WriteChars('\\', 'f'); break;
+      case '\r': WriteChars('\\', 'r'); break;
+      default: {
+        // Other control characters are output as Unicode escapes.
+        static const char hex[] = "0123456789abcdef";
+        char escape[6] = {'\\', 'u', '0', '0', hex[*s >> 4], hex[*s & 0xf]};
+        output_->Write(escape, sizeof(escape));
+      }
     }
+    s++;
   }
   WriteChar('"');
 }
@@ -133,7 +210,7 @@ void JSONWriter::WriteFrame(const FrameDatum *frame) {
     if (!first) WriteChar(',');
     if (pretty()) {
       WriteChar('\n');
-      for (int i = 0; i < current_indentation_; ++i) WriteChar(' ');
+      WriteIndentation();
     }
 
     WriteLink(slot->name, true);
@@ -149,7 +226,7 @@ void JSONWriter::WriteFrame(const FrameDatum *frame) {
     current_indentation_ -= indent_;
     if (frame->begin() != frame->end()) {
       WriteChar('\n');
-      for (int i = 0; i < current_indentation_; ++i) WriteChar(' ');
+      WriteIndentation();
     }
   }
   WriteChar('}');
@@ -203,14 +280,25 @@ void JSONWriter::WriteLink(Handle handle, bool reference) {
 
 void JSONWriter::WriteInt(int number) {
   char buffer[kFastToBufferSize];
-  char *str = FastInt32ToBuffer(number, buffer);
-  output_->Write(str, strlen(str));
+  char *end = FastInt32ToBufferLeft(number, buffer);
+  output_->Write(buffer, end - buffer);
 }
 
 void JSONWriter::WriteFloat(float number) {
   char buffer[kFastToBufferSize];
-  char *str = FloatToBuffer(number, buffer);
-  output_->Write(str, strlen(str));
+  char *end = FastFloatToBufferLeft(number, buffer);
+  output_->Write(buffer, end - buffer);
+}
+
+void JSONWriter::WriteIndentation() {
+  static const char spaces[] = "                                ";
+  static const int kMaxSpaces = sizeof(spaces) - 1;
+  int n = current_indentation_;
+  while (n > 0) {
+    int chunk = n < kMaxSpaces ? n : kMaxSpaces;
+    output_->Write(spaces, chunk);
+    n -= chunk;
+  }
 }
 
 }  // namespace sling
@@ -15,6 +15,7 @@
 #ifndef SLING_FRAME_JSON_H_
 #define SLING_FRAME_JSON_H_
 
+#include <atomic>
 #include <string>
 
 #include "sling/base/macros.h"
@@ -41,6 +42,11 @@ class JSONWriter {
   void set_global(bool global) { global_ = global; }
   void set_byref(bool byref) { byref_ = byref; }
 
+  // Selects vectorized or scalar scanning for characters that need to be
+  // escaped in strings. Returns true if vectorized scanning is used. This can
+  // be called while other threads are writing JSON.
+  static bool Vectorize(bool enable);
+
  private:
   // Returns true if the output should be pretty-printed.
   bool pretty() const { return indent_ > 0; }
@@ -56,6 +62,9 @@ class JSONWriter {
     output_->WriteChar(ch2);
   }
 
+  // Writes newline indentation.
+  void WriteIndentation();
+
   // Writes quoted string with escapes.
   void WriteString(const StringDatum *str);
 
@@ -104,6 +113,12 @@ class JSONWriter {
   // Next index reference.
   int next_index_ = 1;
 
+  // Function for finding the first character in a string that needs to be
+  // escaped.
+  typedef const unsigned char *(*FindEscapeFunc)(const unsigned char *s,
+                                                 const unsigned char *end);
+  static std::atomic<FindEscapeFunc> find_escape;
+
   DISALLOW_IMPLICIT_CONSTRUCTORS(JSONWriter);
 };
 
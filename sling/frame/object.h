@@ -358,7 +358,10 @@ class Array : public Object {
   Handle get(int index) const { return array()->get(index); }
 
   // Sets element in array.
-  void set(int index, Handle value) const { *array()->at(index) = value; }
+  void set(int index, Handle value) const {
+    *store_->GetMutableObject(handle_)->AsArray()->at(index) = value;
+    store_->Remember(handle_);
+  }
 
  private:
   // Dereferences array reference.
@@ -487,6 +490,12 @@ class Frame : public Object {
   Handle GetHandle(const Name &name) const;
   Handle GetHandle(Text name) const;
 
+  // Get all values for slot name.
+  void GetAll(Handle name, Handles *values) const;
+  void GetAll(const Object &name, Handles *values) const;
+  void GetAll(const Name &name, Handles *values) const;
+  void GetAll(Text name, Handles *values) const;
+
   // Resolve slot value by following is: chain.
   Handle Resolve(Handle name) const;
   Handle Resolve(const Object &name) const;
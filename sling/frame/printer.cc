@@ -133,11 +133,11 @@ void Printer::PrintString(const StringDatum *str) {
 
   WriteChar('"');
   bool done = false;
-  unsigned char *s = str->payload();
-  unsigned char *end = str->limit();
+  const unsigned char *s = reinterpret_cast<const unsigned char *>(str->data());
+  const unsigned char *end = s + str->size();
   while (!done) {
     // Search forward until first character that needs escaping.
-    unsigned char *t = s;
+    const unsigned char *t = s;
     Escaping escape = NONE;
     while (t != end) {
       escape = escaping[*t];
@@ -209,6 +209,11 @@ Handle Reader::ParseFrame() {
       // Parse slot name.
       Handle name;
       if (token() == STRING_TOKEN) {
+        // Symbols cannot have empty names.
+        if (token_text().empty()) {
+          SetError("empty object key");
+          return Handle::error();
+        }
         name = store_->Lookup(token_text());
         NextToken();
       } else {
@@ -14,9 +14,16 @@
 
 #include "sling/frame/serialization.h"
 
+#include <algorithm>
+#include <atomic>
+
+#include "sling/base/clock.h"
 #include "sling/base/logging.h"
+#include "sling/file/recordio.h"
 #include "sling/frame/snapshot.h"
 #include "sling/frame/wire.h"
+#include "sling/util/thread.h"
+#include "third_party/jit/cpu.h"
 
 namespace sling {
 
@@ -91,9 +98,9 @@ string Encode(const Object &object) {
   return encoder.buffer();
 }
 
-void LoadStore(const string &filename, Store *store) {
+void LoadStore(const string &filename, Store *store, bool map) {
   if (store->Pristine() && Snapshot::Valid(filename)) {
-    Status st = Snapshot::Read(store, filename);
+    Status st = Snapshot::Read(store, filename, map);
     if (st.ok()) {
       VLOG(1) << "Loaded " << filename << " from snapshot";
       return;
@@ -108,5 +115,108 @@ void LoadStore(const string &filename, Store *store) {
   store->UnlockGC();
 }
 
+// Part of a store file that can be decoded independently.
+struct StorePart {
+  string filename;    // file name for part
+  int64 begin = -1;   // start of part in record file (-1 if not record file)
+  int64 end = -1;     // end of part in record file
+};
+
+// Decodes part of a store file into a store.
+static void DecodePart(const StorePart &part, Store *store) {
+  if (part.begin == -1) {
+    // Decode all objects in text or binary file.
+    FileInputStream stream(part.filename);
+    InputParser parser(store, &stream);
+    while (!parser.done()) {
+      parser.Read();
+      CHECK(!parser.error()) << part.filename << ":" << parser.line() << ":"
+                             << parser.column() << ": "
+                             << parser.error_message();
+    }
+  } else {
+    // Decode the records in the record file chunk.
+    RecordReader reader(part.filename);
+    CHECK(reader.Seek(part.begin));
+    Record record;
+    while (!reader.Done() && RecordFile::FileOffset(reader.Tell()) < part.end) {
+      CHECK(reader.Read(&record));
+      if (RecordFile::FileOffset(record.position) >= part.end) break;
+      if (record.type != DATA_RECORD) continue;
+      Decode(store, Text(record.value.data(), record.value.size()));
+    }
+  }
+}
+
+void LoadStores(const std::vector<string> &filenames, Store *store,
+                int num_threads) {
+  // Split record files into chunks since records never cross chunk boundaries.
+  std::vector<StorePart> parts;
+  for (const string &filename : filenames) {
+    uint32 magic = 0;
+    File *file = File::OpenOrDie(filename, "r");
+    uint64 read;
+    CHECK(file->Read(&magic, sizeof(magic), &read));
+    CHECK(file->Close());
+    if (magic != RecordFile::MAGIC1 && magic != RecordFile::MAGIC2) {
+      parts.emplace_back();
+      parts.back().filename = filename;
+      continue;
+    }
+    RecordReader reader(filename);
+    int64 chunk = reader.info().chunk_size;
+    int64 size = reader.size();
+    if (chunk == 0) chunk = size;
+    for (int64 pos = 0; pos < size; pos += chunk) {
+      parts.emplace_back();
+      parts.back().filename = filename;
+      parts.back().begin = std::max<int64>(pos, reader.info().hdrlen);
+      parts.back().end = std::min(pos + chunk, size);
+    }
+    CHECK(reader.Close());
+  }
+
+  // Decode the parts in order directly into the store if there is no
+  // parallelism to exploit. Generational stores cannot be merged.
+  if (num_threads <= 0) num_threads = jit::CPU::Processors();
+  num_threads = std::min<int>(num_threads, parts.size());
+  if (num_threads <= 1 || store->generational()) {
+    store->LockGC();
+    for (const StorePart &part : parts) DecodePart(part, store);
+    store->UnlockGC();
+    return;
+  }
+
+  // Decode the parts into separate stores in parallel. Garbage collection is
+  // disabled for these stores, so their handles are allocated densely.
+  Clock timer;
+  timer.start();
+  std::vector<Store *> stores(parts.size());
+  std::atomic<int> next(0);
+  WorkerPool pool;
+  pool.Start(num_threads, [&](int index) {
+    for (;;) {
+      int i = next++;
+      if (i >= parts.size()) break;
+      stores[i] = new Store(store->options());
+      stores[i]->LockGC();
+      DecodePart(parts[i], stores[i]);
+    }
+  });
+  pool.Join();
+  timer.stop();
+  double decode_time = timer.ms();
+
+  // Merge the stores into the global store.
+  timer.start();
+  store->Merge(stores, num_threads);
+  for (Store *s : stores) delete s;
+  timer.stop();
+
+  VLOG(1) << parts.size() << " store parts decoded in " << decode_time
+          << " ms and merged in " << timer.ms() << " ms using "
+          << num_threads << " threads";
+}
+
 }  // namespace sling
 
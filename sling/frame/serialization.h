@@ -25,6 +25,9 @@
 #ifndef SLING_FRAME_SERIALIZATION_H_
 #define SLING_FRAME_SERIALIZATION_H_
 
+#include <string>
+#include <vector>
+
 #include "sling/file/file.h"
 #include "sling/frame/decoder.h"
 #include "sling/frame/encoder.h"
@@ -379,8 +382,19 @@ Object Decode(Store *store, Text encoded);
 string Encode(const Store *store, Handle handle);
 string Encode(const Object &object);
 
-// Load store from file.
-void LoadStore(const string &filename, Store *store);
+// Load store from file. If the store is pristine and there is a valid snapshot
+// for the file, the store is loaded from the snapshot. If map is true, the
+// snapshot heaps are memory-mapped and the store is frozen after loading, so
+// this should only be used for stores that are not modified after loading.
+void LoadStore(const string &filename, Store *store, bool map = false);
+
+// Load store from multiple files in parallel. Each file is decoded into a
+// separate store, and record files are split into chunks that are decoded
+// into separate stores. These are then merged into the global store, which
+// resolves the symbols in the same way as decoding the files in order. If the
+// number of threads is zero, one thread per core is used.
+void LoadStores(const std::vector<string> &filenames, Store *store,
+                int num_threads = 0);
 
 }  // namespace sling
 
@@ -14,11 +14,27 @@
 
 #include "sling/frame/snapshot.h"
 
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "sling/base/clock.h"
 #include "sling/base/logging.h"
 #include "sling/base/status.h"
 #include "sling/base/types.h"
 #include "sling/file/file.h"
+#include "sling/frame/decoder.h"
+#include "sling/frame/encoder.h"
+#include "sling/frame/object.h"
 #include "sling/frame/store.h"
+#include "sling/stream/file.h"
+#include "sling/stream/input.h"
+#include "sling/stream/memory.h"
+#include "sling/stream/output.h"
+#include "sling/util/fingerprint.h"
+#include "sling/util/thread.h"
+#include "third_party/jit/cpu.h"
 
 namespace sling {
 
@@ -38,12 +54,59 @@ bool Snapshot::Valid(const string &filename) {
   // Check snapshot version.
   Header hdr;
   if (ok) ok = file->Read(&hdr, sizeof(Header)).ok();
-  if (ok) ok = hdr.magic == MAGIC && hdr.version == VERSION;
+  if (ok) ok = hdr.magic == MAGIC;
+  if (ok) ok = hdr.version >= MIN_VERSION && hdr.version <= VERSION;
   file->Close();
   return ok;
 }
 
-Status Snapshot::Read(Store *store, const string &filename) {
+Status Snapshot::ReadHeader(File *file, const string &filename, Header *hdr) {
+  Status st = file->Read(hdr, sizeof(Header));
+  if (!st.ok()) return st;
+
+  if (hdr->magic != MAGIC) return Status(1, "invalid snapshot", filename);
+  if (hdr->version < MIN_VERSION || hdr->version > VERSION) {
+    return Status(1, "unsupported version", filename);
+  }
+
+  // Snapshots before version 5 have a shorter header without a fingerprint,
+  // and snapshots before version 4 also have no perfect symbol table. Version
+  // 1 snapshots also have unaligned heaps.
+  if (hdr->version < 5) hdr->fingerprint = 0;
+  if (hdr->version < 4) {
+    hdr->phbuckets = 0;
+    hdr->phsize = 0;
+  }
+  if (hdr->version == 1) hdr->alignment = 1;
+  uint64 position = HeaderSize(hdr->version);
+  if (position != sizeof(Header)) {
+    st = file->Seek(position);
+    if (!st.ok()) return st;
+  }
+  return Status::OK;
+}
+
+uint64 Snapshot::HeaderSize(int version) {
+  if (version == 1) return offsetof(Header, alignment);
+  if (version < 4) return offsetof(Header, phbuckets);
+  if (version < 5) return offsetof(Header, fingerprint);
+  return sizeof(Header);
+}
+
+Status Snapshot::Fingerprint(const string &filename, uint64 *fingerprint) {
+  File *file;
+  Status st = File::Open(filename + ".snap", "r", &file);
+  if (!st.ok()) return st;
+  Header hdr;
+  st = ReadHeader(file, filename, &hdr);
+  file->Close();
+  if (!st.ok()) return st;
+  if (hdr.fingerprint == 0) return Status(1, "snapshot has no fingerprint");
+  *fingerprint = hdr.fingerprint;
+  return Status::OK;
+}
+
+Status Snapshot::Read(Store *store, const string &filename, bool map) {
   // Only global stores can be restored from snapshot.
   if (store->globals() != nullptr) {
     return Status(1, "local store cannot be loaded from snapshot");
@@ -55,11 +118,15 @@ Status Snapshot::Read(Store *store, const string &filename) {
   if (!st.ok()) return st;
 
   Header hdr;
-  st = file->Read(&hdr, sizeof(Header));
-  if (!st.ok()) return st;
+  st = ReadHeader(file, filename, &hdr);
+  if (!st.ok()) {
+    file->Close();
+    return st;
+  }
+  uint64 position = file->Tell();
 
-  if (hdr.magic != MAGIC) return Status(1, "invalid snapshot", filename);
-  if (hdr.version != VERSION) return Status(1, "unsupported version", filename);
+  // Heaps can only be memory-mapped if they are page aligned.
+  bool mappable = map && hdr.alignment % File::PageSize() == 0;
 
   // Delete existing heaps.
   Heap *heap = store->first_heap_;
@@ -69,69 +136,237 @@ Status Snapshot::Read(Store *store, const string &filename) {
     heap = next;
   }
   store->first_heap_ = store->last_heap_ = store->current_heap_ = heap;
+  store->nursery_ = store->old_heap_ = nullptr;
 
   // Read heaps from snapshot.
+  Clock timer;
+  timer.start();
   for (int i = 0; i < hdr.heaps; ++i) {
     // Read heap size.
     uint64 heapsize;
     st = file->Read(&heapsize, sizeof(uint64));
-    if (!st.ok()) return st;
+    if (!st.ok()) {
+      file->Close();
+      return st;
+    }
+    position += sizeof(uint64);
+
+    // Heap data is aligned in the snapshot file.
+    position = (position + hdr.alignment - 1) & ~(hdr.alignment - 1);
 
     // Allocate new heap.
     Heap *heap = new Heap();
-    heap->reserve(heapsize);
+    heap->set_huge_pages(store->options_->huge_pages);
     store->current_heap_ = heap;
     if (store->first_heap_ == nullptr) store->first_heap_ = heap;
     if (store->last_heap_ != nullptr) store->last_heap_->set_next(heap);
     store->last_heap_ = heap;
 
-    // Read heap into memory.
-    st = file->Read(heap->base(), heapsize);
-    if (!st.ok()) return st;
+    // Try to memory-map heap from snapshot file.
+    void *mapping = nullptr;
+    if (mappable && heapsize > 0) mapping = file->MapMemory(position, heapsize);
+    if (mapping != nullptr) {
+#ifdef MADV_HUGEPAGE
+      // Request huge pages for the mapped heap. This is only a hint, since
+      // huge pages for file mappings depend on the file system.
+      if (store->options_->huge_pages) {
+        madvise(mapping, heapsize, MADV_HUGEPAGE);
+      }
+#endif
+      heap->map(mapping, heapsize);
+      st = file->Seek(position + heapsize);
+      if (!st.ok()) {
+        file->Close();
+        return st;
+      }
+    } else {
+      // Read heap into memory.
+      heap->reserve(heapsize);
+      st = file->Seek(position);
+      if (st.ok()) st = file->Read(heap->base(), heapsize);
+      if (!st.ok()) {
+        file->Close();
+        return st;
+      }
 
-    // Mark all space in heap as used.
-    heap->set_end(heap->address(heapsize));
+      // Mark all space in heap as used.
+      heap->set_end(heap->address(heapsize));
+    }
+    position += heapsize;
   }
+  timer.stop();
+  int64 heap_time = timer.us();
 
   // Allocate handle table.
+  timer.start();
   size_t handle_table_size = hdr.handles * sizeof(Store::Reference);
   auto &handles = store->handles_;
   handles.reserve(handle_table_size);
   handles.set_end(handles.base() + hdr.handles);
   store->pools_[Handle::kGlobal] = reinterpret_cast<Address>(handles.base());
+  store->free_handle_ = nullptr;
 
-  // Clear handle table, leaving the nil entry intact.
-  memset(handles.base() + 1, 0, (hdr.handles - 1) * sizeof(Store::Reference));
+  if (hdr.version >= 3) {
+    // Read handle table with heap positions, leaving the nil entry intact, and
+    // convert these to object pointers.
+    st = file->Read(handles.base() + 1,
+                    (hdr.handles - 1) * sizeof(Store::Reference));
+    if (!st.ok()) {
+      file->Close();
+      return st;
+    }
+    RelocateHandles(store);
+  } else {
+    // Clear handle table, leaving the nil entry intact, and restore it from the
+    // self handles in the objects.
+    memset(handles.base() + 1, 0, (hdr.handles - 1) * sizeof(Store::Reference));
+    RebuildHandles(store);
+  }
+  timer.stop();
+  VLOG(1) << "Snapshot " << filename << " loaded, heaps " << heap_time
+          << " us, handles " << timer.us() << " us";
 
-  // Restore handle table from self handles in objects.
-  store->free_handle_ = nullptr;
-  for (Heap *heap = store->first_heap_; heap != nullptr; heap = heap->next()) {
-    Datum *object = heap->base();
-    Datum *end = heap->end();
-    while (object < end) {
-      if (!object->IsInvalid()) {
-        store->Assign(object->self, object);
-        DCHECK(store->IsValidReference(object->self));
-      }
-      object = object->next();
+  // Read perfect symbol table. This is used for symbol lookup when the store
+  // is frozen.
+  if (hdr.phsize > 0) {
+    PerfectSymbolTable *table = new PerfectSymbolTable();
+    table->displacements_.resize(hdr.phbuckets);
+    table->entries_.resize(hdr.phsize);
+    st = file->Read(table->displacements_.data(), hdr.phbuckets * sizeof(Word));
+    if (st.ok()) {
+      st = file->Read(table->entries_.data(),
+                      hdr.phsize * sizeof(PerfectSymbolTable::Entry));
     }
+    if (!st.ok()) {
+      delete table;
+      file->Close();
+      return st;
+    }
+    delete store->perfect_symbols_;
+    store->perfect_symbols_ = table;
   }
 
   // Set up symbol table.
   if (store->symbols_.bits != hdr.symtab) {
+    file->Close();
     return Status(1, "invalid symbol table handle", filename);
   }
   store->num_symbols_ = hdr.symbols;
   store->num_buckets_ = hdr.buckets;
+  store->snapshot_fingerprint_ = hdr.fingerprint;
+
+  // Memory-mapped heaps are shared with other processes mapping the same
+  // snapshot, so the store is frozen without garbage collection to prevent
+  // modification of the mapped pages.
+  if (map) {
+    store->LockGC();
+    store->Freeze();
+    store->UnlockGC();
+  }
 
   return file->Close();
 }
 
-Status Snapshot::Write(Store *store, const string &filename) {
+void Snapshot::RebuildHandles(Store *store) {
+  // Collect heaps.
+  std::vector<Heap *> heaps;
+  for (Heap *heap = store->first_heap_; heap != nullptr; heap = heap->next()) {
+    heaps.push_back(heap);
+  }
+
+  // Scan the heaps in parallel. Each object has a unique handle, so the workers
+  // update disjoint parts of the handle table.
+  std::atomic<int> next{0};
+  auto worker = [store, &heaps, &next](int index) {
+    for (;;) {
+      int h = next++;
+      if (h >= heaps.size()) break;
+      Datum *object = heaps[h]->base();
+      Datum *end = heaps[h]->end();
+      while (object < end) {
+        if (!object->IsInvalid()) store->Assign(object->self, object);
+        object = object->next();
+      }
+    }
+  };
+
+  int threads = std::min(NumThreads(store->handles_.length()),
+                         static_cast<int>(heaps.size()));
+  if (threads <= 1) {
+    worker(0);
+  } else {
+    WorkerPool pool;
+    pool.Start(threads, worker);
+    pool.Join();
+  }
+}
+
+void Snapshot::RelocateHandles(Store *store) {
+  // Get heap addresses.
+  std::vector<Address> bases;
+  for (Heap *heap = store->first_heap_; heap != nullptr; heap = heap->next()) {
+    bases.push_back(reinterpret_cast<Address>(heap->base()));
+  }
+
+  // Convert heap positions to object pointers in parallel.
+  Store::Reference *handles = store->handles_.base();
+  int size = store->handles_.length();
+  int threads = NumThreads(size);
+  int chunk = (size + threads - 1) / threads;
+  auto worker = [handles, size, chunk, &bases](int index) {
+    int begin = std::max(index * chunk, 1);
+    int end = std::min((index + 1) * chunk, size);
+    for (int i = begin; i < end; ++i) {
+      Store::Reference &ref = handles[i];
+      uint64 heap = ref.bits >> HEAP_SHIFT;
+      if (heap == 0) {
+        ref.object = nullptr;
+      } else {
+        DCHECK_LE(heap, bases.size());
+        Address base = bases[heap - 1];
+        ref.object = reinterpret_cast<Datum *>(base + (ref.bits & OFFSET_MASK));
+      }
+    }
+  };
+
+  if (threads == 1) {
+    worker(0);
+  } else {
+    WorkerPool pool;
+    pool.Start(threads, worker);
+    pool.Join();
+  }
+}
+
+int Snapshot::NumThreads(int64 work) {
+  // Use a thread for each million units of work up to the number of cores.
+  int threads = work / 1000000 + 1;
+  return std::min(threads, jit::CPU::Processors());
+}
+
+Status Snapshot::Write(Store *store, const string &filename, int version) {
   // Only global stores can be snapshot.
   if (store->globals() != nullptr) {
     return Status(1, "local store cannot be snapshot");
   }
+  if (version < MIN_VERSION || version > VERSION) {
+    return Status(1, "unsupported snapshot version");
+  }
+
+  // Overlay stores share objects with their base store.
+  if (store->base() != nullptr) {
+    return Status(1, "overlay store cannot be snapshot");
+  }
+
+  // The snapshot must contain the string data for borrowed strings.
+  store->CopyBorrowedStrings();
+
+  // Merge identical strings in store before writing snapshot if requested.
+  // The duplicates are removed by garbage collection.
+  if (store->options_->coalesce_strings && !store->frozen()) {
+    store->CoalesceStrings();
+    store->GC();
+  }
 
   // Open output file.
   File *file;
@@ -141,34 +376,359 @@ Status Snapshot::Write(Store *store, const string &filename) {
   // Write header.
   Header hdr;
   hdr.magic = MAGIC;
-  hdr.version = VERSION;
+  hdr.version = version;
   hdr.handles = store->handles_.length();
   hdr.symtab = store->symbols_.bits;
   hdr.symbols = store->num_symbols_;
   hdr.buckets = store->num_buckets_;
+  hdr.alignment = version == 1 ? 1 : ALIGNMENT;
+  const PerfectSymbolTable *table = store->perfect_symbols_;
+  if (store->frozen() && table != nullptr && version >= 4) {
+    hdr.phbuckets = table->buckets();
+    hdr.phsize = table->size();
+  } else {
+    hdr.phbuckets = 0;
+    hdr.phsize = 0;
+  }
   hdr.heaps = 0;
+  hdr.fingerprint = hdr.handles;
   for (Heap *heap = store->first_heap_; heap != nullptr; heap = heap->next()) {
+    const char *data = reinterpret_cast<const char *>(heap->base());
+    hdr.fingerprint = FingerprintCat(hdr.fingerprint,
+                                     sling::Fingerprint(data, heap->size()));
     hdr.heaps++;
   }
-  st = file->Write(&hdr, sizeof(Header));
+  uint64 position = HeaderSize(version);
+  st = file->Write(&hdr, position);
   if (!st.ok()) {
     file->Close();
     return st;
   }
 
-  // Write heaps.
+  // Write heaps. Each heap is padded to start at an aligned file position.
+  // The heap positions of all live objects are recorded in the handle table
+  // for the snapshot.
+  std::vector<uint64> positions(hdr.handles);
+  string padding(hdr.alignment, 0);
+  uint64 heapno = 1;
   for (Heap *heap = store->first_heap_; heap != nullptr; heap = heap->next()) {
     uint64 heapsize = heap->size();
+    CHECK_LE(heapsize, OFFSET_MASK);
     st = file->Write(&heapsize, sizeof(uint64));
+    position += sizeof(uint64);
+    uint64 aligned = (position + hdr.alignment - 1) & ~(hdr.alignment - 1);
+    if (st.ok()) st = file->Write(padding.data(), aligned - position);
     if (st.ok()) st = file->Write(heap->base(), heapsize);
     if (!st) {
       file->Close();
       return st;
     }
+    position = aligned + heapsize;
+
+    Datum *object = heap->base();
+    Datum *end = heap->end();
+    while (object < end) {
+      if (!object->IsInvalid()) {
+        uint64 offset = Region::size(heap->base(), object);
+        positions[object->self.offset() / sizeof(Store::Reference)] =
+            (heapno << HEAP_SHIFT) | offset;
+      }
+      object = object->next();
+    }
+    heapno++;
   }
 
+  // Write handle table without the nil entry. Snapshots before version 3 have
+  // no handle table.
+  if (version >= 3) {
+    st = file->Write(positions.data() + 1,
+                     (hdr.handles - 1) * sizeof(uint64));
+    if (!st) {
+      file->Close();
+      return st;
+    }
+  }
+
+  // Write perfect symbol table.
+  if (hdr.phsize > 0) {
+    st = file->Write(table->displacements_.data(),
+                     hdr.phbuckets * sizeof(Word));
+    if (st.ok()) {
+      st = file->Write(table->entries_.data(),
+                       hdr.phsize * sizeof(PerfectSymbolTable::Entry));
+    }
+    if (!st) {
+      file->Close();
+      return st;
+    }
+  }
+
+  // A frozen store has the same heaps as the snapshot, so it is marked as
+  // loaded from the snapshot.
+  st = file->Close();
+  if (st.ok() && store->frozen() && version >= 5) {
+    store->snapshot_fingerprint_ = hdr.fingerprint;
+  }
+  return st;
+}
+
+Status Snapshot::WriteDelta(Store *overlay,
+                            const string &base,
+                            const string &filename) {
+  // Only frozen overlay stores can be saved as deltas.
+  if (overlay->base() == nullptr) return Status(1, "not an overlay store");
+  if (!overlay->frozen()) return Status(1, "overlay store is not frozen");
+  const Store *basestore = overlay->base_;
+
+  // Get fingerprint for base snapshot and check that the base store was
+  // loaded from it.
+  DeltaHeader hdr;
+  memset(&hdr, 0, sizeof(DeltaHeader));
+  hdr.magic = DELTA_MAGIC;
+  hdr.version = DELTA_VERSION;
+  Status st = Fingerprint(base, &hdr.base);
+  if (!st.ok()) return st;
+  if (basestore->snapshot_fingerprint() != hdr.base) {
+    return Status(1, "base store was not loaded from snapshot", base);
+  }
+
+  // Collect the named frames that are new or have been modified in the overlay
+  // store. These are the frames bound to new symbols and the modified base
+  // frames and symbols.
+  HandleSet frames;
+  auto add = [overlay, &frames](Handle handle) {
+    const Datum *datum = overlay->GetObject(handle);
+    if (datum->IsSymbol()) {
+      const SymbolDatum *symbol = datum->AsSymbol();
+      if (!symbol->bound()) return;
+      handle = symbol->value;
+      datum = overlay->GetObject(handle);
+    }
+    if (datum->IsFrame() && !datum->IsProxy() &&
+        datum->AsFrame()->IsNamed()) {
+      frames.insert(handle);
+    }
+  };
+  const MapDatum *map = overlay->GetMap(overlay->symbols());
+  for (Handle *bucket = map->begin(); bucket < map->end(); ++bucket) {
+    for (Handle h = *bucket; !h.IsNil(); h = overlay->GetSymbol(h)->next) {
+      add(h);
+    }
+  }
+  HandleSet anonymous;
+  for (Handle h : overlay->shadowed_) {
+    const Datum *datum = overlay->GetObject(h);
+    if (!datum->IsSymbol() && !datum->IsFrame()) {
+      anonymous.insert(h);
+    } else if (datum->IsFrame() && datum->AsFrame()->IsAnonymous()) {
+      anonymous.insert(h);
+    } else {
+      add(h);
+    }
+  }
+
+  // Modified anonymous base objects, e.g. qualifiers, are saved as part of the
+  // named frames that refer to them, either directly or through other anonymous
+  // frames and arrays. These named frames are saved as replaced frames.
+  if (!anonymous.empty()) {
+    std::vector<Handle> stack;
+    HandleSet visited;
+    auto refers = [&](Handle handle) {
+      stack.clear();
+      visited.clear();
+      stack.push_back(handle);
+      while (!stack.empty()) {
+        const Datum *datum = overlay->GetObject(stack.back());
+        stack.pop_back();
+        auto *begin = reinterpret_cast<const Handle *>(datum->payload());
+        auto *end = reinterpret_cast<const Handle *>(datum->limit());
+        for (const Handle *h = begin; h < end; ++h) {
+          if (!h->IsRef() || h->IsNil()) continue;
+          if (anonymous.count(*h) > 0) return true;
+          const Datum *target = overlay->GetObject(*h);
+          bool nested = target->IsArray() ||
+                        (target->IsFrame() && !target->IsProxy() &&
+                         target->AsFrame()->IsAnonymous());
+          if (nested && visited.insert(*h).second) stack.push_back(*h);
+        }
+      }
+      return false;
+    };
+    overlay->ForAll([&](Handle handle) {
+      const Datum *datum = overlay->GetObject(handle);
+      if (!datum->IsFrame() || datum->IsProxy()) return;
+      if (frames.count(handle) > 0) return;
+      if (refers(handle)) frames.insert(handle);
+    });
+  }
+  std::vector<Handle> changed(frames.begin(), frames.end());
+  std::sort(changed.begin(), changed.end(), [](Handle a, Handle b) {
+    return a.raw() < b.raw();
+  });
+
+  // Open delta file and write header. The counts are updated at the end.
+  File *file;
+  st = File::Open(filename, "w", &file);
+  if (!st.ok()) return st;
+  st = file->Write(&hdr, sizeof(DeltaHeader));
+  if (!st.ok()) {
+    file->Close();
+    return st;
+  }
+
+  // Write the changed frames. The records are built in a local store, so
+  // references to named frames are encoded as links.
+  {
+    Store local(overlay);
+    FileOutputStream stream(file);
+    Output output(&stream);
+    Encoder encoder(&local, &output);
+    for (Handle handle : changed) {
+      const FrameDatum *frame = overlay->GetFrame(handle);
+      const Datum *original = nullptr;
+      if (handle.offset() < overlay->base_limit_) {
+        original = basestore->GetObject(handle);
+      }
+
+      // Determine the type of change.
+      Change change = ADDED;
+      if (original != nullptr && original->IsFrame() && !original->IsProxy()) {
+        change = REPLACED;
+        bool ids_only = true;
+        for (const Slot *s = frame->begin(); s < frame->end(); ++s) {
+          if (!s->name.IsId()) ids_only = false;
+        }
+        if (ids_only) change = DELETED;
+      }
+      switch (change) {
+        case ADDED: hdr.added++; break;
+        case REPLACED: hdr.replaced++; break;
+        case DELETED: hdr.deleted++; break;
+      }
+
+      // Encode change type and number of slots followed by the frame slots.
+      // Named frames in the slots are encoded as links.
+      encoder.Encode(Handle::Integer(change));
+      encoder.Encode(Handle::Integer(frame->slots()));
+      for (const Slot *s = frame->begin(); s < frame->end(); ++s) {
+        encoder.EncodeLink(s->name);
+        encoder.EncodeLink(s->value);
+      }
+    }
+    output.Flush();
+    if (!stream.Close()) return Status(1, "error writing delta", filename);
+  }
+
+  // Update the header with the change counts.
+  st = File::Open(filename, "r+", &file);
+  if (st.ok()) st = file->Write(&hdr, sizeof(DeltaHeader));
+  if (!st.ok()) return st;
   return file->Close();
 }
 
-}  // namespace sling
+Status Snapshot::ReadDelta(Store *overlay,
+                           const string &base,
+                           const string &filename) {
+  // Delta must be applied to an overlay store that has not been frozen.
+  if (overlay->base() == nullptr) return Status(1, "not an overlay store");
+  if (overlay->frozen()) return Status(1, "overlay store is frozen");
+
+  // Read delta file and check that the delta is for the base snapshot.
+  string data;
+  Status st = File::ReadContents(filename, &data);
+  if (!st.ok()) return st;
+  if (data.size() < sizeof(DeltaHeader)) {
+    return Status(1, "invalid delta file", filename);
+  }
+  DeltaHeader hdr;
+  memcpy(&hdr, data.data(), sizeof(DeltaHeader));
+  if (hdr.magic != DELTA_MAGIC) {
+    return Status(1, "invalid delta file", filename);
+  }
+  if (hdr.version != DELTA_VERSION) {
+    return Status(1, "unsupported delta version", filename);
+  }
+  uint64 fingerprint;
+  st = Fingerprint(base, &fingerprint);
+  if (!st.ok()) return st;
+  if (fingerprint != hdr.base) {
+    return Status(1, "delta is for another base snapshot", filename);
+  }
+  if (overlay->base()->snapshot_fingerprint() != fingerprint) {
+    return Status(1, "base store was not loaded from snapshot", base);
+  }
+
+  // Check the records in the delta by decoding them into a local store on top
+  // of the base store, so the overlay store is left unchanged if the delta is
+  // invalid.
+  Clock timer;
+  timer.start();
+  {
+    Store local(overlay->base());
+    st = DecodeDelta(&local, hdr, data, filename);
+    if (!st.ok()) return st;
+  }
+
+  // Replace or add the frames in the delta. Frames with existing ids replace
+  // the frames in the base store.
+  st = DecodeDelta(overlay, hdr, data, filename);
+  CHECK(st) << st;
+  overlay->Freeze();
+  timer.stop();
+  VLOG(1) << "Delta " << filename << " applied, " << hdr.added << " added, "
+          << hdr.replaced << " replaced, " << hdr.deleted << " deleted, "
+          << timer.us() << " us";
+
+  return Status::OK;
+}
+
+Status Snapshot::DecodeDelta(Store *store,
+                             const DeltaHeader &hdr,
+                             const string &data,
+                             const string &filename) {
+  // The slots are decoded one at a time, so only the slot values end up in the
+  // store heaps.
+  ArrayInputStream stream(data.data() + sizeof(DeltaHeader),
+                          data.size() - sizeof(DeltaHeader));
+  Input input(&stream);
+  Decoder decoder(store, &input);
+  int counts[3] = {0, 0, 0};
+  while (!decoder.done()) {
+    Handle change = decoder.DecodeObject();
+    if (!change.IsInt() || decoder.done() ||
+        change.AsInt() < ADDED || change.AsInt() > DELETED) {
+      return Status(1, "invalid delta record", filename);
+    }
+    Handle size = decoder.DecodeObject();
+    if (!size.IsInt() || size.AsInt() < 0) {
+      return Status(1, "invalid delta record", filename);
+    }
+    Builder b(store);
+    for (int i = 0; i < size.AsInt(); ++i) {
+      if (decoder.done()) return Status(1, "truncated delta file", filename);
+      Handle name = decoder.DecodeObject();
+      if (decoder.done()) return Status(1, "truncated delta file", filename);
+      Handle value = decoder.DecodeObject();
+
+      // Deleted frames are replaced by frames that only have id slots.
+      if (change.AsInt() == DELETED && !name.IsId()) {
+        return Status(1, "deleted frame with non-id slots", filename);
+      }
+      b.Add(name, value);
+    }
+    if (change.AsInt() == DELETED && size.AsInt() == 0) {
+      return Status(1, "deleted frame without id", filename);
+    }
+    b.Create();
+    counts[change.AsInt()]++;
+  }
 
+  if (counts[ADDED] != hdr.added ||
+      counts[REPLACED] != hdr.replaced ||
+      counts[DELETED] != hdr.deleted) {
+    return Status(1, "delta records do not match header", filename);
+  }
+  return Status::OK;
+}
+
+}  // namespace sling
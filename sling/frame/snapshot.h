@@ -19,28 +19,84 @@
 
 #include "sling/base/status.h"
 #include "sling/base/types.h"
+#include "sling/file/file.h"
 #include "sling/frame/store.h"
 
 namespace sling {
 
 // Global frame stores can be snapshot and saved to .snap files. These can then
 // be loaded into a new empty global store. For large stores, this is faster
-// than reading the frame store in encoded format.
+// than reading the frame store in encoded format. The heaps are aligned to page
+// boundaries in the snapshot file, so they can also be memory-mapped directly
+// from the file. This allows multiple processes to share the same physical
+// copy of the store. The handle table is saved after the heaps as a table of
+// heap positions, so it can be restored without scanning the heaps. If the
+// store has a perfect symbol table, it is saved after the handle table.
+//
+// The changes in an overlay store on top of a store loaded from a snapshot can
+// be saved to a delta file. The delta file records the frames that have been
+// added, replaced, or deleted in the overlay store together with the
+// fingerprint of the base snapshot. A frame is deleted by replacing it with a
+// frame that only has id slots. The delta can then be applied to a new overlay
+// store on top of the base snapshot without re-decoding the base store.
 class Snapshot {
  public:
   // Check if there is a valid snapshot file for the store.
   static bool Valid(const string &filename);
 
-  // Read snapshot into empty global store.
-  static Status Read(Store *store, const string &filename);
+  // Read snapshot into empty global store. If map is true, the heaps are
+  // memory-mapped from the snapshot file instead of being read into memory. A
+  // memory-mapped store is frozen after it has been loaded, so no new objects
+  // can be added to it.
+  static Status Read(Store *store, const string &filename, bool map = false);
+
+  // Write store to snapshot file. If the store is not frozen and the
+  // coalesce_strings option is set, identical strings are merged and garbage
+  // collected before the snapshot is written. A frozen store gets the
+  // fingerprint of the snapshot, as if it had been loaded from it. Older
+  // snapshot versions can be written for compatibility and benchmarking.
+  static Status Write(Store *store, const string &filename,
+                      int version = VERSION);
+
+  // Get the fingerprint of the heaps in a snapshot. Snapshots before version 5
+  // do not have a fingerprint.
+  static Status Fingerprint(const string &filename, uint64 *fingerprint);
+
+  // Write the changes in a frozen overlay store to a delta file. The base
+  // store of the overlay store must have been loaded unchanged from the base
+  // snapshot. It is an error if the base store was loaded from another
+  // snapshot. Named frames that refer to modified anonymous base objects, e.g.
+  // qualifiers, are saved as replaced frames.
+  static Status WriteDelta(Store *overlay,
+                           const string &base,
+                           const string &filename);
 
-  // Write store to snapshot file.
-  static Status Write(Store *store, const string &filename);
+  // Apply delta file to a new overlay store on top of a store loaded from the
+  // base snapshot. It is an error if the delta file was made for another base
+  // snapshot or if the base store was not loaded from the base snapshot. The
+  // delta is checked before it is applied, so the overlay store is unchanged
+  // and not frozen if an error is returned. The overlay store is frozen after
+  // the delta has been applied.
+  static Status ReadDelta(Store *overlay,
+                          const string &base,
+                          const string &filename);
 
  private:
-  // Current magic and version for snapshots.
+  // Current magic and version for snapshots. Version 1 snapshots have no heap
+  // alignment, version 1 and 2 snapshots do not contain a handle table,
+  // snapshots before version 4 do not contain a perfect symbol table, and
+  // snapshots before version 5 do not have a fingerprint.
   static const int MAGIC = 0x50414e53;
-  static const int VERSION = 1;
+  static const int VERSION = 5;
+  static const int MIN_VERSION = 1;
+
+  // Magic and version for delta files.
+  static const int DELTA_MAGIC = 0x41544c44;
+  static const int DELTA_VERSION = 2;
+
+  // Alignment of heaps in snapshot file. This must be a multiple of the page
+  // size for memory mapping the heaps.
+  static const int ALIGNMENT = 1 << 16;
 
   // Snapshot file header.
   struct Header {
@@ -51,7 +107,56 @@ class Snapshot {
     Word symtab;    // symbol table handle
     int symbols;    // number of symbols in symbol table
     int buckets;    // number of hash buckets in the symbol table
+    int alignment;  // alignment of heaps in snapshot file (version 2+)
+    int phbuckets;  // number of buckets in perfect symbol table (version 4+)
+    int phsize;     // number of entries in perfect symbol table (version 4+)
+    uint64 fingerprint;  // fingerprint of heaps (version 5+)
+  };
+
+  // Delta file header. For each changed frame, the header is followed by the
+  // encoded change type, the number of slots in the frame, and the names and
+  // values of the slots. Version 1 delta files encoded each frame as an array,
+  // which is no longer supported.
+  struct DeltaHeader {
+    int magic;      // magic number for identifying delta file
+    int version;    // delta file format version
+    uint64 base;    // fingerprint of base snapshot
+    int added;      // number of added frames
+    int replaced;   // number of replaced frames
+    int deleted;    // number of deleted frames
+    int unused;     // padding
   };
+
+  // Types of frame changes in delta file.
+  enum Change {ADDED = 0, REPLACED = 1, DELETED = 2};
+
+  // Decode the changed frames in a delta file into a store and check them
+  // against the change counts in the delta header.
+  static Status DecodeDelta(Store *store,
+                            const DeltaHeader &hdr,
+                            const string &data,
+                            const string &filename);
+
+  // Read header from snapshot file.
+  static Status ReadHeader(File *file, const string &filename, Header *hdr);
+
+  // Return the size of the snapshot file header for a snapshot version.
+  static uint64 HeaderSize(int version);
+
+  // Handle table entries are saved as heap positions with the heap number in
+  // the upper bits and the offset into the heap in the lower bits. Heap numbers
+  // start at one, so zero is used for unused handles.
+  static const int HEAP_SHIFT = 40;
+  static const uint64 OFFSET_MASK = (1ULL << HEAP_SHIFT) - 1;
+
+  // Restore handle table from the self handles of the objects in the heaps.
+  static void RebuildHandles(Store *store);
+
+  // Convert handle table from heap positions to object pointers.
+  static void RelocateHandles(Store *store);
+
+  // Return the number of threads for restoring the handle table.
+  static int NumThreads(int64 work);
 };
 
 }  // namespace sling
@@ -14,13 +14,33 @@
 
 #include "sling/frame/store.h"
 
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <numeric>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 #include "sling/base/clock.h"
 #include "sling/base/logging.h"
+#include "sling/file/file.h"
 #include "sling/string/strcat.h"
 #include "sling/string/text.h"
 #include "sling/util/city.h"
+#include "sling/util/fingerprint.h"
+#include "sling/util/thread.h"
+#include "third_party/jit/cpu.h"
 
 namespace sling {
 
@@ -53,6 +73,14 @@ static const Word kInitialHeap[] = {
 static const int kPristineSymbols = 3;
 static const int kPristineHandles = 11;
 
+// Handle offsets are 32 bits, so this is the maximum size of a handle table.
+// The handle table of an overlay store is reserved with this size up front.
+static const size_t kMaxHandleTableSize = 1ULL << 32;
+
+// Smaller handle tables are not moved to shared memory when the store is
+// frozen, since copying them into overlay stores is cheap.
+static const size_t kMinSharedHandleTableSize = 1 << 20;
+
 // Default store options.
 const Store::Options Store::kDefaultOptions;
 
@@ -69,10 +97,87 @@ static inline uint64 HashMix(uint64 fp1, uint64 fp2) {
   return CityHash64Mix(fp1, fp2);
 }
 
+// Size of huge pages.
+static const size_t kHugePageSize = 2 << 20;
+
+// Allocates memory backed by huge pages. The size must be a multiple of the
+// huge page size. Explicit huge pages are tried first, and if these are not
+// available, an aligned anonymous mapping is allocated and transparent huge
+// pages are requested for it. Returns null if the memory cannot be mapped.
+static Address AllocateHugePages(size_t bytes) {
+  void *memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (memory != MAP_FAILED) return static_cast<Address>(memory);
+
+  // Transparent huge pages require the mapping to be aligned to the huge page
+  // size, so allocate an extra huge page and trim the mapping.
+  size_t size = bytes + kHugePageSize;
+  memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) return nullptr;
+  uintptr_t start = reinterpret_cast<uintptr_t>(memory);
+  uintptr_t aligned = (start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  if (aligned > start) munmap(memory, aligned - start);
+  size_t tail = start + size - (aligned + bytes);
+  if (tail > 0) munmap(reinterpret_cast<void *>(aligned + bytes), tail);
+  Address base = reinterpret_cast<Address>(aligned);
+#ifdef MADV_HUGEPAGE
+  madvise(base, bytes, MADV_HUGEPAGE);
+#endif
+  return base;
+}
+
+// Requests transparent huge pages for memory that has not been touched yet.
+// Only the aligned huge pages inside the memory range can use huge pages.
+static void AdviseHugePages(void *memory, size_t bytes) {
+#ifdef MADV_HUGEPAGE
+  if (bytes >= kHugePageSize) madvise(memory, bytes, MADV_HUGEPAGE);
+#endif
+}
+
+Region::~Region() {
+  if (mapped_) return;
+  if (huge_) {
+    munmap(base_, capacity());
+  } else {
+    free(base_);
+  }
+}
+
 void Region::reserve(size_t bytes) {
+  CHECK(!mapped_) << "Memory-mapped regions cannot be resized";
   size_t used = size();
   DCHECK_LE(used, bytes);
-  base_ = static_cast<Address>(realloc(base_, bytes));
+  if (huge_pages_ && bytes >= kHugePageSize) {
+    // Move region to new memory backed by huge pages.
+    bytes = (bytes + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    if (huge_ && bytes == capacity()) return;
+    Address memory = AllocateHugePages(bytes);
+    if (memory != nullptr) {
+      if (used > 0) memcpy(memory, base_, used);
+      if (huge_) {
+        munmap(base_, capacity());
+      } else {
+        free(base_);
+      }
+      base_ = memory;
+      end_ = base_ + used;
+      limit_ = base_ + bytes;
+      huge_ = true;
+      return;
+    }
+  }
+  if (huge_) {
+    // Move region from huge pages back to normal memory.
+    Address memory = static_cast<Address>(malloc(bytes));
+    CHECK(memory != nullptr || bytes == 0);
+    if (used > 0) memcpy(memory, base_, used);
+    munmap(base_, capacity());
+    base_ = memory;
+    huge_ = false;
+  } else {
+    base_ = static_cast<Address>(realloc(base_, bytes));
+  }
   CHECK(base_ != nullptr || bytes == 0);
   CHECK_EQ((reinterpret_cast<uintptr_t>(base_) & (kObjectAlign - 1)), 0);
   end_ = base_ + used;
@@ -103,6 +208,128 @@ Address Region::expand(size_t bytes) {
   return ptr;
 }
 
+// Scalar slot scanning.
+static const Slot *FindSlotScalar(const Slot *begin, const Slot *end,
+                                  Handle name) {
+  for (const Slot *slot = begin; slot < end; ++slot) {
+    if (slot->name == name) return slot;
+  }
+  return end;
+}
+
+static const Slot *MatchSlotScalar(const Slot *begin, const Slot *end,
+                                   Handle name, Handle value) {
+  for (const Slot *slot = begin; slot < end; ++slot) {
+    if (slot->name == name && slot->value == value) return slot;
+  }
+  return end;
+}
+
+#ifdef __x86_64__
+
+// Vectorized slot scanning using AVX2. Each 256-bit vector holds four slots
+// with the slot names in the even lanes and the slot values in the odd lanes.
+// The comparison masks have one bit per lane, so the bit index divided by two
+// is the slot number.
+__attribute__((target("avx2")))
+static inline int CompareSlotsAVX2(const Slot *slots, __m256i key) {
+  __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(slots));
+  __m256i eq = _mm256_cmpeq_epi32(data, key);
+  return _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+}
+
+__attribute__((target("avx2")))
+static const Slot *FindSlotAVX2(const Slot *begin, const Slot *end,
+                                Handle name) {
+  const __m256i key = _mm256_set1_epi32(name.raw());
+  const Slot *slot = begin;
+
+  // Compare eight slot names per iteration.
+  while (end - slot >= 8) {
+    int lo = CompareSlotsAVX2(slot, key);
+    int hi = CompareSlotsAVX2(slot + 4, key);
+    int mask = (lo | (hi << 8)) & 0x5555;
+    if (mask != 0) return slot + (__builtin_ctz(mask) >> 1);
+    slot += 8;
+  }
+
+  // Compare the next four slot names.
+  if (end - slot >= 4) {
+    int mask = CompareSlotsAVX2(slot, key) & 0x55;
+    if (mask != 0) return slot + (__builtin_ctz(mask) >> 1);
+    slot += 4;
+  }
+
+  // Compare the remaining slots.
+  while (slot < end) {
+    if (slot->name == name) return slot;
+    slot++;
+  }
+  return end;
+}
+
+__attribute__((target("avx2")))
+static const Slot *MatchSlotAVX2(const Slot *begin, const Slot *end,
+                                 Handle name, Handle value) {
+  const __m256i key = _mm256_setr_epi32(name.raw(), value.raw(),
+                                        name.raw(), value.raw(),
+                                        name.raw(), value.raw(),
+                                        name.raw(), value.raw());
+  const Slot *slot = begin;
+
+  // Compare four slots at a time. Both the name and value lanes must match.
+  while (end - slot >= 4) {
+    int eq = CompareSlotsAVX2(slot, key);
+    int mask = eq & (eq >> 1) & 0x55;
+    if (mask != 0) return slot + (__builtin_ctz(mask) >> 1);
+    slot += 4;
+  }
+
+  // Compare the remaining slots.
+  while (slot < end) {
+    if (slot->name == name && slot->value == value) return slot;
+    slot++;
+  }
+  return end;
+}
+
+#endif
+
+// The slot scanning functions are selected on first use. This avoids probing
+// the CPU during static initialization. Threads racing on the first scan all
+// store the same functions, so relaxed atomic stores are sufficient.
+static const Slot *FindSlotFirst(const Slot *begin, const Slot *end,
+                                 Handle name) {
+  SlotScan::Vectorize(true);
+  return SlotScan::find.load(std::memory_order_relaxed)(begin, end, name);
+}
+
+static const Slot *MatchSlotFirst(const Slot *begin, const Slot *end,
+                                  Handle name, Handle value) {
+  SlotScan::Vectorize(true);
+  SlotScan::MatchFunc match = SlotScan::match.load(std::memory_order_relaxed);
+  return match(begin, end, name, value);
+}
+
+std::atomic<SlotScan::FindFunc> SlotScan::find(FindSlotFirst);
+std::atomic<SlotScan::MatchFunc> SlotScan::match(MatchSlotFirst);
+
+bool SlotScan::Vectorize(bool enable) {
+#ifdef __x86_64__
+  // The CPU is probed with the compiler builtins, since jit::CPU also enables
+  // flush-to-zero mode for the calling thread when probing the CPU.
+  __builtin_cpu_init();
+  if (enable && __builtin_cpu_supports("avx2")) {
+    find.store(FindSlotAVX2, std::memory_order_relaxed);
+    match.store(MatchSlotAVX2, std::memory_order_relaxed);
+    return true;
+  }
+#endif
+  find.store(FindSlotScalar, std::memory_order_relaxed);
+  match.store(MatchSlotScalar, std::memory_order_relaxed);
+  return false;
+}
+
 External::External() : prev_(this), next_(this) {}
 
 External::External(Store *store) {
@@ -113,18 +340,30 @@ External::~External() {
   Unlink();
 }
 
+void External::Attach(Store *store) {
+  Unlink();
+  store->RegisterExternal(this);
+}
+
 Store::Store() : Store(&kDefaultOptions) {}
 
 Store::Store(const Options *options) : options_(options) {
-  // Allocate initial heap.
+  // Allocate initial heap. This is used as the nursery in generational mode.
   Heap *heap = new Heap();
-  heap->reserve(options_->initial_heap_size);
+  heap->set_huge_pages(options_->huge_pages);
+  if (options_->generational) {
+    heap->reserve(options_->nursery_size);
+    nursery_ = heap;
+  } else {
+    heap->reserve(options_->initial_heap_size);
+  }
   first_heap_ = last_heap_ = current_heap_ = heap;
 
   // The symbol table will be allocated later.
   symbols_ = Handle::nil();
 
   // Initialize handle table.
+  handles_.set_huge_pages(options_->huge_pages);
   handles_.reserve(options_->initial_handles);
   free_handle_ = nullptr;
 
@@ -173,12 +412,22 @@ Store::Store(const Store *globals) : globals_(globals) {
   // Get configuration options for local store.
   options_ = globals->options_->local;
 
-  // Allocate initial heap.
+  // Use the slot index from the global store.
+  slot_index_ = globals->slot_index_;
+
+  // Allocate initial heap. This is used as the nursery in generational mode.
   Heap *heap = new Heap();
-  heap->reserve(options_->initial_heap_size);
+  heap->set_huge_pages(options_->huge_pages);
+  if (options_->generational) {
+    heap->reserve(options_->nursery_size);
+    nursery_ = heap;
+  } else {
+    heap->reserve(options_->initial_heap_size);
+  }
   first_heap_ = last_heap_ = current_heap_ = heap;
 
   // Initialize handle table.
+  handles_.set_huge_pages(options_->huge_pages);
   handles_.reserve(options_->initial_handles);
   free_handle_ = nullptr;
 
@@ -194,6 +443,60 @@ Store::Store(const Store *globals) : globals_(globals) {
   roots_.handle_ = symbols_;
 }
 
+Store::Store(const Options *options, const Store *base)
+    : base_(base), options_(options) {
+  // Base store must be a frozen global store.
+  CHECK(base->frozen_);
+  CHECK(base->globals_ == nullptr) << "Base store must be a global store";
+  CHECK(base->base_ == nullptr) << "Base store cannot be an overlay store";
+
+  // Add reference to shared base store.
+  if (base->shared()) base->AddRef();
+
+  // Allocate initial heap.
+  Heap *heap = new Heap();
+  heap->set_huge_pages(options_->huge_pages);
+  heap->reserve(options_->initial_heap_size);
+  first_heap_ = last_heap_ = current_heap_ = heap;
+
+  // Reserve address space for the handle table and map the handle table of
+  // the base store into the beginning of it. The pages are copied on write,
+  // so only the pages with modified handles use memory in the overlay store.
+  // If the base handle table is not in shared memory, it is copied instead.
+  size_t size = base->handles_.size();
+  void *table = mmap(nullptr, kMaxHandleTableSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  CHECK(table != MAP_FAILED) << "Unable to reserve handle table";
+  void *mapping = MAP_FAILED;
+  if (base->handle_file_ != -1) {
+    mapping = mmap(table, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_FIXED, base->handle_file_, 0);
+  }
+  if (mapping == MAP_FAILED) {
+    if (size >= kMinSharedHandleTableSize) {
+      LOG(INFO) << "Copying " << size << " bytes of unshared base handle table "
+                << "into overlay store";
+    }
+    memcpy(table, base->handles_.base(), size);
+  }
+  handles_.map(table, kMaxHandleTableSize);
+  handles_.set_end(handles_.base() + size / sizeof(Reference));
+  free_handle_ = nullptr;
+  base_limit_ = size;
+
+  // Set up pools.
+  globals_ = nullptr;
+  store_tag_ = Handle::kGlobalTag;
+  pools_[Handle::kGlobal] = reinterpret_cast<Address>(handles_.base());
+  pools_[Handle::kLocal] = nullptr;
+
+  // Allocate symbol map for the new symbols in the overlay store. Symbols that
+  // are not found in this map are looked up in the base store.
+  num_buckets_ = 1;
+  symbols_ = AllocateArray(num_buckets_);
+  roots_.handle_ = symbols_;
+}
+
 Store::~Store() {
   // Make sure there are no references to store.
   CHECK(refs_ <= 0) << "Delete with live references to store";
@@ -203,16 +506,40 @@ Store::~Store() {
   roots_.Unlink();
   externals_.Unlink();
 
+  // Delete NUMA replicas.
+  for (Store *replica : replicas_) {
+    if (replica != this) delete replica;
+  }
+
   // Delete all object heaps.
   Heap *heap = first_heap_;
   while (heap != nullptr) {
     Heap *next = heap->next();
+    if (heap->mapped()) {
+      if (primary_ != nullptr) {
+        NUMA::Free(heap->base(), heap->capacity());
+      } else {
+        File::FreeMappedMemory(heap->base(), heap->capacity());
+      }
+    }
     delete heap;
     heap = next;
   }
 
-  // Release reference to shared global store.
+  // Delete slot index. The slot index is owned by the global store, and
+  // replicas share the slot index and perfect symbol table with the primary.
+  if (primary_ == nullptr) {
+    if (globals_ == nullptr) delete slot_index_;
+    delete perfect_symbols_;
+  }
+
+  // Release handle table if it is mapped.
+  if (handles_.mapped()) munmap(handles_.base(), handles_.capacity());
+  if (handle_file_ != -1) close(handle_file_);
+
+  // Release reference to shared global or base store.
   if (globals_ != nullptr && globals_->shared()) globals_->Release();
+  if (base_ != nullptr && base_->shared()) base_->Release();
 }
 
 void Store::Share() {
@@ -246,6 +573,43 @@ Handle Store::AllocateString(Text str) {
   return AllocateHandle(object);
 }
 
+Handle Store::AllocateBorrowedString(Text str) {
+  CHECK_LE(str.size(), kSizeMask);
+  Type type = static_cast<Type>(STRING | BORROWED);
+  Datum *object = AllocateDatum(type, sizeof(StringDatum::Borrowed));
+  auto *borrowed = reinterpret_cast<StringDatum::Borrowed *>(object->payload());
+  borrowed->data = str.data();
+  borrowed->size = str.size();
+  borrowed_strings_ = true;
+  return AllocateHandle(object);
+}
+
+void Store::CopyBorrowedStrings() {
+  if (!borrowed_strings_) return;
+
+  // Find all the borrowed strings.
+  std::vector<Handle> strings;
+  for (Heap *heap = first_heap_; heap != nullptr; heap = heap->next()) {
+    Datum *object = heap->base();
+    Datum *end = heap->end();
+    while (object < end) {
+      if (object->IsBorrowed()) strings.push_back(object->self);
+      object = object->next();
+    }
+  }
+
+  // Replace the borrowed strings with copies.
+  LockGC();
+  for (Handle handle : strings) {
+    Text str = GetString(handle)->str();
+    StringDatum *copy = AllocateDatum(STRING, str.size())->AsString();
+    memcpy(copy->data(), str.data(), str.size());
+    Replace(handle, copy);
+  }
+  borrowed_strings_ = false;
+  UnlockGC();
+}
+
 Handle Store::AllocateFrame(Slot *begin, Slot *end, Handle original) {
   // Determine the handle for the new frame. The handle for the new frame can
   // be supplied as an argument, but if this is nil, we look at the id slots
@@ -289,6 +653,19 @@ Handle Store::AllocateFrame(Slot *begin, Slot *end, Handle original) {
     }
   }
 
+  // In an overlay store, the symbols that are bound and unbound below are
+  // copied from the base store before the new frame is allocated, since the
+  // copying can trigger a garbage collection.
+  if (base_limit_ != 0) {
+    for (Slot *s = begin; s < begin + ids; ++s) GetMutableObject(s->value);
+    if (!handle.IsNil()) {
+      for (int i = 0; i < GetFrame(handle)->slots(); ++i) {
+        Slot *slot = GetFrame(handle)->begin() + i;
+        if (slot->name.IsId()) GetMutableObject(slot->value);
+      }
+    }
+  }
+
   // Allocate frame object.
   size_t size = (end - begin) * sizeof(Slot);
   FrameDatum *frame = AllocateDatum(FRAME, size)->AsFrame();
@@ -342,6 +719,7 @@ Handle Store::AllocateFrame(Slot *begin, Slot *end, Handle original) {
 
         // Bind symbol to frame.
         symbol->value = handle;
+        Remember(symbol->self);
         frame->AddFlags(NAMED);
       } else if (id->IsProxy()) {
         // This proxy is not the one used for replacement, because otherwise the
@@ -373,8 +751,16 @@ void Store::UpdateFrame(Handle handle, Slot *begin, Slot *end) {
   // Make sure that handle is owned by this store.
   CHECK(Owned(handle));
 
+  // Copy the symbols for the id slots and the frame itself if they are in the
+  // base store of an overlay store.
+  if (base_limit_ != 0) {
+    for (Slot *s = begin; s < end; ++s) {
+      if (s->name.IsId()) GetMutableObject(s->value);
+    }
+  }
+
   // Make sure that the frame has the right number of slots.
-  FrameDatum *frame = GetFrame(handle);
+  FrameDatum *frame = GetMutableObject(handle)->AsFrame();
   CHECK(frame->IsFrame());
   CHECK_EQ(end - begin, frame->end() - frame->begin());
 
@@ -382,6 +768,7 @@ void Store::UpdateFrame(Handle handle, Slot *begin, Slot *end) {
   CHECK(frame->IsAnonymous());
 
   // Copy new slots to the frame.
+  Remember(handle);
   Slot *t = frame->begin();
   for (Slot *s = begin; s < end; ++s, ++t) {
     // Get slot name and value.
@@ -411,6 +798,7 @@ void Store::UpdateFrame(Handle handle, Slot *begin, Slot *end) {
 
       // Bind symbol to frame.
       symbol->value = handle;
+      Remember(symbol->self);
       frame->AddFlags(NAMED);
     }
   }
@@ -451,7 +839,10 @@ void Store::Set(Handle frame, Handle name, Handle value) {
   for (Slot *s = datum->begin(); s < datum->end(); ++s) {
     if (s->name == name) {
       // Update slot and return.
-      s->value = value;
+      int index = s - datum->begin();
+      datum = GetMutableObject(frame)->AsFrame();
+      datum->begin()[index].value = value;
+      Remember(frame);
       return;
     }
   }
@@ -550,6 +941,12 @@ void Store::Delete(Handle frame, Handle name) {
   Slot *end = datum->end();
   while (slot < end && slot->name != name) slot++;
   if (slot == end) return;
+
+  // Get frame for modification.
+  int index = slot - datum->begin();
+  datum = GetMutableObject(frame)->AsFrame();
+  slot = datum->begin() + index;
+  end = datum->end();
   Slot *current = slot;
   while (slot < end) {
     if (slot->name == name) {
@@ -624,6 +1021,7 @@ Handle Store::AllocateSymbol(Text name, Handle hash) {
 void Store::InsertSymbol(SymbolDatum *symbol) {
   // Insert symbol in symbol table.
   GetMap(symbols_)->insert(symbol);
+  Remember(symbols_);
   num_symbols_++;
 
   // Resize symbol table if fill factor is more than 1:1, unless this would
@@ -650,6 +1048,7 @@ void Store::InsertSymbol(SymbolDatum *symbol) {
         SymbolDatum *symbol = GetSymbol(h);
         Handle next = symbol->next;
         map->insert(symbol);
+        Remember(h);
         h = next;
       }
     }
@@ -660,6 +1059,18 @@ void Store::InsertSymbol(SymbolDatum *symbol) {
 }
 
 Handle Store::FindSymbol(Text name, Handle hash) const {
+  if (perfect_symbols_ != nullptr && frozen_) {
+    // Look up symbol in perfect symbol table.
+    uint64 fp = sling::Fingerprint(name.data(), name.size());
+    Handle h = perfect_symbols_->Find(fp);
+    if (!h.IsNil()) {
+      const SymbolDatum *symbol = GetSymbol(h);
+      const Datum *symname = GetObject(symbol->name);
+      if (symname->IsString() && symname->AsString()->equals(name)) return h;
+    }
+    return Handle::nil();
+  }
+
   if (num_symbols_ > 0) {
     const MapDatum *symbols = GetMap(symbols_);
     Handle h = *symbols->bucket(hash);
@@ -672,6 +1083,10 @@ Handle Store::FindSymbol(Text name, Handle hash) const {
       h = symbol->next;
     }
   }
+
+  // Look up symbol in base store for overlay store.
+  if (base_ != nullptr) return base_->FindSymbol(name, hash);
+
   return Handle::nil();
 }
 
@@ -786,8 +1201,10 @@ Handle Store::Lookup(Text name) {
   if (frozen_) return Handle::nil();
 
   // Symbol is unbound. Bind it to a new proxy.
+  GetMutableObject(sym);
   Handle proxy = AllocateProxy(sym);
   GetSymbol(sym)->value = proxy;
+  Remember(sym);
   return proxy;
 }
 
@@ -805,8 +1222,10 @@ Handle Store::Lookup(Handle name) {
   if (frozen_) return Handle::nil();
 
   // Symbol is unbound. Bind it to a new proxy.
+  GetMutableObject(sym);
   Handle proxy = AllocateProxy(sym);
   GetSymbol(sym)->value = proxy;
+  Remember(sym);
   return proxy;
 }
 
@@ -865,7 +1284,7 @@ bool Store::Equal(Handle x, Handle y, bool byref) const {
     const Datum *xdatum = GetObject(x);
     const Datum *ydatum = GetObject(y);
     if (xdatum->type() != ydatum->type()) return false;
-    if (xdatum->size() != ydatum->size()) return false;
+    if (!xdatum->IsString() && xdatum->size() != ydatum->size()) return false;
     switch (xdatum->type()) {
       case FRAME: {
         // Already tested if handles are equal.
@@ -955,7 +1374,7 @@ uint64 Store::Fingerprint(Handle handle, bool byref, uint64 seed) const {
         return fp;
       }
     } else {
-      switch (datum->typebits()) {
+      switch (datum->type()) {
         case STRING: {
           // Hash string content.
           const StringDatum *str = datum->AsString();
@@ -998,6 +1417,13 @@ void Store::ReplaceProxy(ProxyDatum *proxy, FrameDatum *frame) {
   CHECK(Owned(proxy->self));
   CHECK(Owned(frame->self));
 
+  // Copy proxy from base store in overlay store.
+  if (InBase(proxy->self)) {
+    Handle h = frame->self;
+    proxy = GetMutableObject(proxy->self)->AsProxy();
+    frame = GetFrame(h);
+  }
+
   // Swap the handles for the proxy and the frame.
   Assign(proxy->self, frame);
   Assign(frame->self, proxy);
@@ -1011,6 +1437,13 @@ void Store::ReplaceProxy(ProxyDatum *proxy, FrameDatum *frame) {
   Handle tmp = proxy->self;
   proxy->self = frame->self;
   frame->self = tmp;
+
+  // Objects referencing the proxy now reference the frame, so the handles
+  // need to be traced in the next nursery collection.
+  if (nursery_ != nullptr) {
+    *remembered_.push() = proxy->self;
+    *remembered_.push() = frame->self;
+  }
 }
 
 Datum *Store::AllocateDatumSlow(Type type, Word size) {
@@ -1021,6 +1454,9 @@ Datum *Store::AllocateDatumSlow(Type type, Word size) {
   Word bytes = Align(sizeof(Datum) + size);
   CHECK_LT(bytes, kObjectSizeLimit) << "Object too big";
 
+  // In generational mode, the current heap is always the nursery.
+  if (nursery_ != nullptr) return AllocateNurserySlow(type, size);
+
   // This is called when the current heap is full.
   Datum *object;
   while (current_heap_->next() != nullptr) {
@@ -1063,23 +1499,90 @@ Datum *Store::AllocateDatumSlow(Type type, Word size) {
     }
   }
 
-  // All heaps are still (nearly) full; compute size of new heap.
+  // All heaps are still (nearly) full; allocate new heap.
+  AddHeap(bytes);
+  current_heap_ = last_heap_;
+
+  // Allocate object on new heap.
+  CHECK(current_heap_->consume(bytes, &object));
+  object->info = size | type;
+  return object;
+}
+
+Datum *Store::AllocateNurserySlow(Type type, Word size) {
+  Word bytes = Align(sizeof(Datum) + size);
+  Datum *object;
+
+  // Collect the nursery to make room for the new object unless the object is
+  // too big for the nursery.
+  if (bytes <= nursery_->capacity() / 2) {
+    if (gc_locks_ > 0) {
+      gc_pending_ = true;
+    } else {
+      CollectNursery();
+
+      // Perform full garbage collection if the old generation has grown since
+      // the last full collection. If there is still not enough free memory in
+      // the old generation, it is expanded to prevent cascades of garbage
+      // collections.
+      if (old_expanded_) {
+        GC();
+        int64 total = 0;
+        int64 free = 0;
+        for (Heap *heap = nursery_->next(); heap != nullptr;
+             heap = heap->next()) {
+          total += heap->capacity();
+          free += heap->available();
+        }
+        if (free * options_->expansion_free_fraction <= total) AddHeap(bytes);
+      }
+
+      if (nursery_->consume(bytes, &object)) {
+        object->info = size | type;
+        return object;
+      }
+    }
+  }
+
+  // Allocate object directly in the old generation. These objects can be
+  // initialized with references to objects in the nursery, so they are traced
+  // in the next nursery collection.
+  object = AllocateOld(bytes);
+  *pretenured_.push() = object;
+  object->info = size | type;
+  return object;
+}
+
+Datum *Store::AllocateOld(Word bytes) {
+  Datum *object;
+  while (old_heap_ != nullptr) {
+    if (old_heap_->consume(bytes, &object)) return object;
+    old_heap_ = old_heap_->next();
+  }
+
+  // The old generation is full; expand it with a new heap.
+  AddHeap(bytes);
+  old_expanded_ = true;
+  CHECK(old_heap_->consume(bytes, &object));
+  return object;
+}
+
+void Store::AddHeap(Word bytes) {
+  // Compute size of new heap.
   size_t heap_size = last_heap_->capacity() * 2;
   if (heap_size > options_->maximum_heap_size) {
     heap_size = options_->maximum_heap_size;
   }
+  if (heap_size == 0) heap_size = options_->initial_heap_size;
   while (heap_size < bytes) heap_size *= 2;
 
   // Allocate new heap.
-  current_heap_ = new Heap();
-  current_heap_->reserve(heap_size);
-  last_heap_->set_next(current_heap_);
-  last_heap_ = current_heap_;
-
-  // Allocate object on new heap.
-  CHECK(current_heap_->consume(bytes, &object));
-  object->info = size | type;
-  return object;
+  Heap *heap = new Heap();
+  heap->set_huge_pages(options_->huge_pages);
+  heap->reserve(heap_size);
+  last_heap_->set_next(heap);
+  last_heap_ = heap;
+  if (nursery_ != nullptr && old_heap_ == nullptr) old_heap_ = heap;
 }
 
 Handle Store::AllocateHandleSlow(Datum *object) {
@@ -1103,6 +1606,20 @@ Handle Store::AllocateHandleSlow(Datum *object) {
   return handle;
 }
 
+Datum *Store::ShadowObject(Handle handle) {
+  // Return existing overlay copy if the object has already been copied.
+  Datum *object = Deref(handle);
+  if (shadowed_.count(handle) > 0) return object;
+
+  // Copy object into overlay store and redirect the handle to the copy.
+  CHECK(!frozen_) << "Overlay store is frozen";
+  Datum *copy = AllocateDatum(object->type(), object->size());
+  memcpy(copy, object, Region::size(object, object->next()));
+  Assign(handle, copy);
+  shadowed_.insert(handle);
+  return copy;
+}
+
 Handle Store::Resolve(Handle handle) {
   for (;;) {
     if (!handle.IsRef() || handle.IsNil()) return handle;
@@ -1124,7 +1641,133 @@ bool Store::Pristine() const {
          handles_.length() == kPristineHandles;
 }
 
-void Store::Mark() {
+// Minimum heap size in bytes for parallel garbage collection.
+static const int64 kParallelGCThreshold = 64 * (1 << 20);
+
+// Number of handles traced between checks for idle marking threads.
+static const int kDonateInterval = 1024;
+
+// Minimum number of handles in a range for splitting it between threads.
+static const int kMinSplit = 256;
+
+// Work pool for marking objects from multiple threads. Each thread traces
+// objects from a private marking stack. When some threads are out of work,
+// the busy threads donate the bottom half of their marking stack, or half of
+// the top range if the stack only has one range, to a shared pool of ranges
+// from where the idle threads steal their work. Marking is complete when all
+// the threads are idle and the shared pool is empty.
+class MarkingPool {
+ public:
+  MarkingPool(int threads, Address pool, Word tag, Word limit)
+      : threads_(threads), pool_(pool), tag_(tag), limit_(limit) {}
+
+  // Adds range to shared pool.
+  void Add(const Range &range) {
+    if (!range.empty()) ranges_.push_back(range);
+  }
+
+  // Marks objects until all reachable objects have been marked.
+  void Work() {
+    Space<Range> stack;
+    while (Steal(&stack)) Trace(&stack);
+  }
+
+ private:
+  // Traces and marks the objects reachable from the marking stack.
+  void Trace(Space<Range> *stack) {
+    int countdown = kDonateInterval;
+    while (!stack->empty()) {
+      Range *top = stack->top();
+      if (top->empty()) {
+        stack->pop();
+      } else {
+        // This is the same as the serial marking in Store::Mark() except that
+        // objects are marked atomically.
+        Handle h = *top->begin++;
+        if (!h.IsNil() && h.tag() == tag_ && h.offset() >= limit_) {
+          Datum *object = *reinterpret_cast<Datum **>(pool_ + h.offset());
+          if (object->atomic_mark() && !object->IsBinary()) {
+            object->range(stack->push());
+          }
+        }
+
+        // Share work with idle threads.
+        if (--countdown == 0) {
+          countdown = kDonateInterval;
+          if (idle_.load(std::memory_order_relaxed) > 0) Donate(stack);
+        }
+      }
+    }
+  }
+
+  // Moves part of the marking stack to the shared pool.
+  void Donate(Space<Range> *stack) {
+    std::vector<Range> work;
+    int size = stack->length();
+    if (size > 1) {
+      int half = size / 2;
+      Range *base = stack->base();
+      work.assign(base, base + half);
+      memmove(base, base + half, (size - half) * sizeof(Range));
+      stack->set_end(base + size - half);
+    } else {
+      Range *top = stack->top();
+      int length = top->end - top->begin;
+      if (length < 2 * kMinSplit) return;
+      Handle *middle = top->begin + length / 2;
+      work.push_back(Range{middle, top->end});
+      top->end = middle;
+    }
+
+    std::unique_lock<std::mutex> lock(mu_);
+    ranges_.insert(ranges_.end(), work.begin(), work.end());
+    available_.notify_all();
+  }
+
+  // Moves a range from the shared pool to the marking stack. Returns false
+  // when marking is complete.
+  bool Steal(Space<Range> *stack) {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (ranges_.empty()) {
+      if (done_) return false;
+      if (idle_ + 1 == threads_) {
+        // All other threads are idle and there is no more work.
+        done_ = true;
+        available_.notify_all();
+        return false;
+      }
+      idle_++;
+      available_.wait(lock);
+      idle_--;
+    }
+    *stack->push() = ranges_.back();
+    ranges_.pop_back();
+    return true;
+  }
+
+  // Number of marking threads.
+  int threads_;
+
+  // Shared pool of ranges that need to be traced.
+  std::vector<Range> ranges_;
+
+  // Number of threads waiting for work.
+  std::atomic<int> idle_{0};
+
+  // Marking is done when all threads are idle and the pool is empty.
+  bool done_ = false;
+
+  // Mutex and condition for shared pool.
+  std::mutex mu_;
+  std::condition_variable available_;
+
+  // Handle table, tag, and base limit for owned objects.
+  Address pool_;
+  Word tag_;
+  Word limit_;
+};
+
+void Store::Mark(int threads) {
   // The marking stack keeps track of memory regions with handles that have not
   // yet been marked and traversed.
   Space<Range> stack;
@@ -1149,9 +1792,37 @@ void Store::Mark() {
     ext = ext->next_;
   } while (ext != &externals_);
 
+  // In an overlay store, the objects in the base store are always live and
+  // they are never traced. The overlay copies of modified base objects are
+  // marked and traced as roots instead.
+  for (Handle h : shadowed_) {
+    Datum *object = Deref(h);
+    object->mark();
+    if (!object->IsBinary()) object->range(stack.push());
+  }
+
   // Traverse all the objects reachable from the roots.
   Word pool_tag = store_tag_;
   Address pool = pools_[pool_tag];
+  Word limit = base_limit_;
+  if (threads > 1) {
+    // Split the root ranges between the marking threads. The set of marked
+    // objects is the same regardless of the order they are traced in.
+    MarkingPool marking(threads, pool, pool_tag, limit);
+    for (Range *r = stack.base(); r < stack.end(); ++r) {
+      Handle *begin = r->begin;
+      while (r->end - begin > kMinSplit) {
+        marking.Add(Range{begin, begin + kMinSplit});
+        begin += kMinSplit;
+      }
+      marking.Add(Range{begin, r->end});
+    }
+    WorkerPool workers;
+    workers.Start(threads, [&marking](int index) { marking.Work(); });
+    workers.Join();
+    return;
+  }
+
   while (!stack.empty()) {
     Range *top = stack.top();
     if (top->empty()) {
@@ -1164,7 +1835,8 @@ void Store::Mark() {
       // Only owned objects need to be marked. Number handles (i.e. ints and
       // floats) represent themselves, and references to global objects in a
       // local store are regarded as static since the global store is frozen.
-      if (!h.IsNil() && h.tag() == pool_tag) {
+      // Likewise, objects in the base store of an overlay store are static.
+      if (!h.IsNil() && h.tag() == pool_tag && h.offset() >= limit) {
         // Dereference the handle. Here we take advantage of the fact that the
         // object is known to be owned so we can dereference the handle directly
         // through the owned handle table for the store.
@@ -1183,48 +1855,86 @@ void Store::Mark() {
   }
 }
 
-void Store::Compact() {
-  // The handles for the garbage collected objects are added to the handle
-  // free list.
-  Reference *fh = free_handle_;
+void Store::CompactHeap(Heap *heap, Reference **head, Reference **tail) {
+  // Traverse all the objects in the heap and move all the surviving objects
+  // to the beginning of the heap.
+  Reference *fh = nullptr;
+  Reference *last = nullptr;
+  Datum *object = heap->base();
+  Datum *end = heap->end();
+  Datum *unused = object;
+  while (object < end) {
+    Datum *next = object->next();
+    if (!object->IsInvalid()) {
+      if (object->marked()) {
+        // Object survived. Clear the mark.
+        object->unmark();
+
+        size_t size = Region::size(object, next);
+        if (object != unused) {
+          // Update handle table to point to the new object location.
+          Assign(object->self, unused);
+
+          // Move it to the new location at the start of the unused section.
+          memmove(unused, object, size);
+        }
+        unused = Heap::address(unused, size);
+      } else {
+        // Object is dead. Free the associated handle.
+        Reference *ref = handles_.address(object->self.offset());
+        ref->next = fh;
+        fh = ref;
+        if (last == nullptr) last = ref;
+      }
+    }
+    object = next;
+  }
+  heap->set_end(unused);
+  *head = fh;
+  *tail = last;
+}
 
-  // Compact all the heaps.
+void Store::Compact(int threads) {
+  // Compact all the heaps. The heaps are independent, so these can be
+  // compacted in parallel.
+  std::vector<Heap *> heaps;
   for (Heap *heap = first_heap_; heap != nullptr; heap = heap->next()) {
-    // Traverse all the objects in the heap and move all the surviving objects
-    // to the beginning of the heap.
-    Datum *object = heap->base();
-    Datum *end = heap->end();
-    Datum *unused = object;
-    while (object < end) {
-      Datum *next = object->next();
-      if (!object->IsInvalid()) {
-        if (object->marked()) {
-          // Object survived. Clear the mark.
-          object->unmark();
-
-          size_t size = Region::size(object, next);
-          if (object != unused) {
-            // Update handle table to point to the new object location.
-            Assign(object->self, unused);
-
-            // Move it to the new location at the start of the unused section.
-            memmove(unused, object, size);
-          }
-          unused = Heap::address(unused, size);
-        } else {
-          // Object is dead. Free the associated handle.
-          Reference *ref = handles_.address(object->self.offset());
-          ref->next = fh;
-          fh = ref;
-        }
+    heaps.push_back(heap);
+  }
+  int num_heaps = heaps.size();
+  std::vector<Reference *> heads(num_heaps);
+  std::vector<Reference *> tails(num_heaps);
+  threads = std::min(threads, num_heaps);
+  if (threads > 1) {
+    std::atomic<int> next{0};
+    WorkerPool workers;
+    workers.Start(threads, [&](int index) {
+      for (int i = next++; i < num_heaps; i = next++) {
+        CompactHeap(heaps[i], &heads[i], &tails[i]);
       }
-      object = next;
+    });
+    workers.Join();
+  } else {
+    for (int i = 0; i < num_heaps; ++i) {
+      CompactHeap(heaps[i], &heads[i], &tails[i]);
     }
-    heap->set_end(unused);
+  }
+
+  // The handles for the garbage collected objects are added to the handle
+  // free list in heap order.
+  Reference *fh = free_handle_;
+  for (int i = 0; i < num_heaps; ++i) {
+    if (heads[i] == nullptr) continue;
+    tails[i]->next = fh;
+    fh = heads[i];
   }
 
   // Start allocating from the first heap.
   current_heap_ = first_heap_;
+  if (nursery_ != nullptr) {
+    old_heap_ = nursery_->next();
+    old_expanded_ = false;
+  }
 
   // Update the handle free list.
   free_handle_ = fh;
@@ -1242,15 +1952,29 @@ void Store::GC() {
     return;
   }
 
+  // Promote all surviving objects in the nursery to the old generation before
+  // collecting the whole store.
+  if (nursery_ != nullptr) CollectNursery();
+
+  // Large stores are collected in parallel.
+  int threads = 1;
+  if (options_->gc_threads > 1) {
+    int64 used = 0;
+    for (Heap *heap = first_heap_; heap != nullptr; heap = heap->next()) {
+      used += heap->size();
+    }
+    if (used >= kParallelGCThreshold) threads = options_->gc_threads;
+  }
+
   // Mark all the objects reachable from the roots.
   timer.start();
-  Mark();
+  Mark(threads);
   timer.stop();
   int64 mark_time = timer.us();
 
   // Compact heaps.
   timer.start();
-  Compact();
+  Compact(threads);
   gc_pending_ = false;
   timer.stop();
   int64 compact_time = timer.us();
@@ -1262,7 +1986,124 @@ void Store::GC() {
 
   VLOG(15) << "GC " << total_time << " us, "
            << "mark " << mark_time << " us, "
-           << "compact " << compact_time << " us";
+           << "compact " << compact_time << " us, "
+           << threads << " threads";
+}
+
+void Store::RememberObject(Handle handle) {
+  if (InNursery(Deref(handle))) return;
+  int index = handle.offset() / sizeof(Reference);
+  if (index >= remembered_flags_.size()) {
+    remembered_flags_.resize(handles_.capacity() / sizeof(Reference));
+  }
+  if (!remembered_flags_[index]) {
+    remembered_flags_[index] = true;
+    *remembered_.push() = handle;
+  }
+}
+
+void Store::CollectNursery() {
+  Clock timer;
+  timer.start();
+
+  // Build table with all the roots. Remembered handles for objects in the
+  // nursery are also roots, since these can be referenced from old objects.
+  Space<Range> stack;
+  Space<Handle> root_table;
+  const Root *root = &roots_;
+  do {
+    *root_table.push() = root->handle_;
+    root = root->next_;
+  } while (root != &roots_);
+
+  // Add the payloads of all modified and pretenured old objects to the marking
+  // stack.
+  for (Handle *h = remembered_.base(); h < remembered_.end(); ++h) {
+    int index = h->offset() / sizeof(Reference);
+    if (index < remembered_flags_.size()) remembered_flags_[index] = false;
+    Datum *object = Deref(*h);
+    if (InNursery(object)) {
+      *root_table.push() = *h;
+    } else if (!object->IsInvalid() && !object->IsBinary()) {
+      object->range(stack.push());
+    }
+  }
+  for (Datum **d = pretenured_.base(); d < pretenured_.end(); ++d) {
+    Datum *object = *d;
+    if (!object->IsInvalid() && !object->IsBinary()) {
+      object->range(stack.push());
+    }
+  }
+
+  // Add root table and all external object references to the marking stack.
+  Range *range = stack.push();
+  range->begin = root_table.base();
+  range->end = root_table.end();
+  External *ext = &externals_;
+  do {
+    ext->GetReferences(stack.push());
+    ext = ext->next_;
+  } while (ext != &externals_);
+
+  // Mark all objects in the nursery that are reachable from the roots. Objects
+  // in the old generation are not traversed.
+  Word pool_tag = store_tag_;
+  Address pool = pools_[pool_tag];
+  while (!stack.empty()) {
+    Range *top = stack.top();
+    if (top->empty()) {
+      stack.pop();
+    } else {
+      Handle h = *top->begin++;
+      if (!h.IsNil() && h.tag() == pool_tag) {
+        Datum *object = *reinterpret_cast<Datum **>(pool + h.offset());
+        if (InNursery(object) && !object->marked()) {
+          object->mark();
+          if (!object->IsBinary()) object->range(stack.push());
+        }
+      }
+    }
+  }
+
+  // Promote all the surviving objects to the old generation and free the
+  // handles for the dead objects.
+  Reference *fh = free_handle_;
+  Datum *object = nursery_->base();
+  Datum *end = nursery_->end();
+  int64 promoted = 0;
+  while (object < end) {
+    Datum *next = object->next();
+    if (!object->IsInvalid()) {
+      if (object->marked()) {
+        object->unmark();
+        size_t size = Region::size(object, next);
+        Datum *copy = AllocateOld(size);
+        memcpy(copy, object, size);
+        Assign(copy->self, copy);
+        promoted += size;
+      } else {
+        Reference *ref = handles_.address(object->self.offset());
+        ref->next = fh;
+        fh = ref;
+      }
+    }
+    object = next;
+  }
+  free_handle_ = fh;
+
+  // The nursery is now empty and there are no references from the old
+  // generation to the nursery.
+  nursery_->reset();
+  remembered_.reset();
+  pretenured_.reset();
+
+  timer.stop();
+  num_minor_gcs_++;
+  minor_gc_time_ += timer.us();
+  promoted_bytes_ += promoted;
+
+  VLOG(15) << "Minor GC " << timer.us() << " us, "
+           << "promoted " << promoted << " bytes";
 }
 
 bool Store::IsValidReference(Handle handle) const {
@@ -1325,9 +2166,14 @@ void Store::ReplaceHandle(Handle handle, Handle replacement) {
       if (!object->IsInvalid() && !object->IsBinary()) {
         Handle *begin = reinterpret_cast<Handle *>(object->payload());
         Handle *end = reinterpret_cast<Handle *>(object->limit());
+        bool replaced = false;
         for (Handle *h = begin; h < end; ++h) {
-          if (*h == handle) *h = replacement;
+          if (*h == handle) {
+            *h = replacement;
+            replaced = true;
+          }
         }
+        if (replaced) Remember(object->self);
       }
       object = object->next();
     }
@@ -1361,7 +2207,13 @@ void Store::Freeze() {
   // Local stores cannot be frozen.
   CHECK(globals_ == nullptr);
 
-  // Run garbage collection to free up unused space.
+  // Copy borrowed strings into the store since the frozen store can outlive
+  // the buffers they are borrowed from.
+  CopyBorrowedStrings();
+
+  // Merge identical strings and run garbage collection to free up unused
+  // space.
+  if (options_->coalesce_strings) CoalesceStrings();
   if (gc_locks_ == 0) GC();
 
   // Shrink all the heaps to fit the allocated data. This will force slow case
@@ -1401,8 +2253,11 @@ void Store::Freeze() {
     handles_.pop();
     num_dead_handles_--;
   }
-  handles_.reserve(handles_.size());
-  pools_[store_tag_] = reinterpret_cast<Address>(handles_.base());
+  if (base_ == nullptr) {
+    handles_.reserve(handles_.size());
+    if (options_->share_handles) ShareHandles();
+    pools_[store_tag_] = reinterpret_cast<Address>(handles_.base());
+  }
 
   // Remove all roots from store. After the store has been frozen the roots no
   // longer need to be tracked.
@@ -1420,73 +2275,800 @@ void Store::Freeze() {
     ext = next;
   } while (ext != &externals_);
 
-  // Store is now frozen.
+  // Store is now frozen. A frozen store is no longer generational.
+  nursery_ = old_heap_ = nullptr;
+  remembered_.reset();
+  pretenured_.reset();
   frozen_ = true;
+
+  // Overlay stores do not have slot indices or perfect symbol tables, since
+  // these would have to cover the base store as well.
+  if (base_ != nullptr) return;
+
+  // Build slot index for wide frames.
+  if (options_->slot_index_threshold > 0) {
+    slot_index_ = new SlotIndex(this, options_->slot_index_threshold);
+  }
+
+  // Build perfect hash table for the symbols unless a matching table has
+  // already been loaded from a snapshot.
+  if (perfect_symbols_ != nullptr && perfect_symbols_->size() != num_symbols_) {
+    delete perfect_symbols_;
+    perfect_symbols_ = nullptr;
+  }
+  if (perfect_symbols_ == nullptr && options_->perfect_symbols) {
+    perfect_symbols_ = new PerfectSymbolTable();
+    if (!perfect_symbols_->Build(this)) {
+      LOG(WARNING) << "Unable to build perfect symbol table";
+      delete perfect_symbols_;
+      perfect_symbols_ = nullptr;
+    }
+  }
+
+  // Place the frozen store on the NUMA nodes.
+  if (NUMA::Nodes() > 1) {
+    if (options_->numa_replicas && Replicate()) return;
+    if (options_->numa_replicas || options_->numa_interleave) Interleave();
+  }
+}
+
+Store::Store(const Store *primary, int node)
+    : globals_(nullptr), primary_(primary), options_(primary->options_) {
+  first_heap_ = last_heap_ = current_heap_ = nullptr;
+  free_handle_ = nullptr;
+  store_tag_ = Handle::kGlobalTag;
+  pools_[Handle::kGlobal] = nullptr;
+  pools_[Handle::kLocal] = nullptr;
+  symbols_ = primary->symbols_;
+  roots_.handle_ = symbols_;
+  num_symbols_ = primary->num_symbols_;
+  num_buckets_ = primary->num_buckets_;
+  slot_index_ = primary->slot_index_;
+  perfect_symbols_ = primary->perfect_symbols_;
+  snapshot_fingerprint_ = primary->snapshot_fingerprint_;
+  frozen_ = true;
+
+  // Heaps and the handle table are copied with the same layout, so only the
+  // object addresses in the handle table need to be relocated.
+  struct Relocation {
+    Address begin;   // start of heap in primary store
+    Address end;     // end of heap in primary store
+    Address target;  // start of heap in replica
+  };
+
+  // Copy heaps to memory on the node.
+  std::vector<Relocation> relocations;
+  for (Heap *heap = primary->first_heap_; heap != nullptr;
+       heap = heap->next()) {
+    size_t size = std::max(heap->size(), sizeof(Datum));
+    void *memory = NUMA::Allocate(size, node);
+    if (memory == nullptr) return;
+    if (options_->huge_pages) AdviseHugePages(memory, size);
+    memcpy(memory, heap->base(), heap->size());
+    Heap *copy = new Heap();
+    copy->map(memory, size);
+    copy->set_end(copy->address(heap->size()));
+    if (first_heap_ == nullptr) first_heap_ = copy;
+    if (last_heap_ != nullptr) last_heap_->set_next(copy);
+    last_heap_ = current_heap_ = copy;
+    Address begin = reinterpret_cast<Address>(heap->base());
+    relocations.push_back({begin, begin + heap->size(),
+                           reinterpret_cast<Address>(copy->base())});
+  }
+  std::sort(relocations.begin(), relocations.end(),
+            [](const Relocation &a, const Relocation &b) {
+              return a.begin < b.begin;
+            });
+
+  // Copy handle table to memory on the node.
+  size_t size = primary->handles_.size();
+  void *table = NUMA::Allocate(size, node);
+  if (table == nullptr) return;
+  if (options_->huge_pages) AdviseHugePages(table, size);
+  memcpy(table, primary->handles_.base(), size);
+  handles_.map(table, size);
+  pools_[Handle::kGlobal] = reinterpret_cast<Address>(handles_.base());
+
+  // Relocate object addresses in the handle table in parallel.
+  Reference *handles = handles_.base();
+  int length = handles_.length();
+  int threads = std::min(length / 1000000 + 1, jit::CPU::Processors());
+  int chunk = (length + threads - 1) / threads;
+  auto worker = [handles, length, chunk, &relocations](int index) {
+    int begin = index * chunk;
+    int end = std::min((index + 1) * chunk, length);
+    for (int i = begin; i < end; ++i) {
+      Address object = reinterpret_cast<Address>(handles[i].object);
+      auto it = std::upper_bound(
+          relocations.begin(), relocations.end(), object,
+          [](Address address, const Relocation &r) {
+            return address < r.begin;
+          });
+      if (it == relocations.begin()) continue;
+      --it;
+      if (object >= it->end) continue;
+      handles[i].object =
+          reinterpret_cast<Datum *>(it->target + (object - it->begin));
+    }
+  };
+  if (threads == 1) {
+    worker(0);
+  } else {
+    WorkerPool pool;
+    pool.Start(threads, worker);
+    pool.Join();
+  }
+}
+
+bool Store::Replicate() {
+  int nodes = NUMA::Nodes();
+  std::vector<Store *> replicas(nodes, this);
+  bool ok = true;
+  for (int node = 1; ok && node < nodes; ++node) {
+    replicas[node] = new Store(this, node);
+    ok = replicas[node]->handles_.mapped();
+  }
+
+  if (!ok) {
+    LOG(WARNING) << "Unable to replicate store on NUMA nodes";
+    for (Store *replica : replicas) {
+      if (replica != this) delete replica;
+    }
+    return false;
+  }
+
+  // Move the primary store to the first node.
+  for (Heap *heap = first_heap_; heap != nullptr; heap = heap->next()) {
+    NUMA::Bind(heap->base(), heap->size(), 0);
+  }
+  NUMA::Bind(handles_.base(), handles_.size(), 0);
+  replicas_.swap(replicas);
+  return true;
+}
+
+void Store::Interleave() {
+  for (Heap *heap = first_heap_; heap != nullptr; heap = heap->next()) {
+    NUMA::Interleave(heap->base(), heap->size());
+  }
+  NUMA::Interleave(handles_.base(), handles_.size());
+}
+
+void Store::ShareHandles() {
+#ifdef SYS_memfd_create
+  // Huge pages are generally not available for shared memory, so a handle
+  // table in huge pages is kept private. Small handle tables are also kept
+  // private.
+  size_t size = handles_.size();
+  if (handles_.huge() || size < kMinSharedHandleTableSize) return;
+
+  // Create shared memory file for the handle table.
+  int fd = syscall(SYS_memfd_create, "handles", 1 /* MFD_CLOEXEC */);
+  if (fd == -1) return;
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return;
+  }
+
+  // Copy the handle table to shared memory and release the original.
+  void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+  if (mapping == MAP_FAILED) {
+    close(fd);
+    return;
+  }
+  memcpy(mapping, handles_.base(), size);
+  handles_.reset();
+  handles_.reserve(0);
+  handles_.map(mapping, size);
+  handle_file_ = fd;
+#endif
+}
+
+bool PerfectSymbolTable::Build(const Store *store) {
+  // Compute fingerprints for all the symbol names.
+  struct Key {
+    uint64 fp;
+    Handle symbol;
+  };
+  std::vector<Key> keys;
+  keys.reserve(store->num_symbols_);
+  const MapDatum *map = store->GetMap(store->symbols_);
+  for (const Handle *bucket = map->begin(); bucket < map->end(); ++bucket) {
+    Handle h = *bucket;
+    while (!h.IsNil()) {
+      const SymbolDatum *symbol = store->GetSymbol(h);
+      Text name = store->GetString(symbol->name)->str();
+      keys.push_back({Fingerprint(name.data(), name.size()), h});
+      h = symbol->next;
+    }
+  }
+  Word n = keys.size();
+  if (n == 0) return false;
+
+  // Distribute the keys into buckets with two keys per bucket on average.
+  Word num_buckets = std::max(n / 2, 1U);
+  std::vector<Word> start(num_buckets + 1);
+  for (const Key &key : keys) start[Reduce(key.fp, num_buckets) + 1]++;
+  for (Word b = 0; b < num_buckets; ++b) start[b + 1] += start[b];
+  std::vector<Key> sorted(n);
+  std::vector<Word> fill(start.begin(), start.end() - 1);
+  for (const Key &key : keys) {
+    sorted[fill[Reduce(key.fp, num_buckets)]++] = key;
+  }
+  keys.swap(sorted);
+
+  // Duplicate fingerprints cannot be separated by the hash function.
+  for (Word b = 0; b < num_buckets; ++b) {
+    for (Word i = start[b]; i < start[b + 1]; ++i) {
+      for (Word j = start[b]; j < i; ++j) {
+        if (keys[i].fp == keys[j].fp) return false;
+      }
+    }
+  }
+
+  // Place the largest buckets first, since these are harder to place.
+  std::vector<Word> order(num_buckets);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&start](Word a, Word b) {
+    return start[a + 1] - start[a] > start[b + 1] - start[b];
+  });
+
+  displacements_.assign(num_buckets, 0);
+  entries_.assign(n, Entry{0, Handle::nil()});
+  std::vector<bool> used(n);
+  std::vector<Word> positions;
+  Word next_free = 0;
+  for (Word b : order) {
+    const Key *bucket = keys.data() + start[b];
+    Word size = start[b + 1] - start[b];
+    if (size == 0) break;
+
+    if (size == 1) {
+      // Map single key directly to the next free position.
+      while (used[next_free]) next_free++;
+      used[next_free] = true;
+      displacements_[b] = kDirect | next_free;
+      entries_[next_free] = Entry{Word(bucket->fp >> 32), bucket->symbol};
+      continue;
+    }
+
+    // Find displacement that maps all keys in bucket to free positions.
+    Word d = 0;
+    for (;;) {
+      if (d >= kDirect) return false;
+      positions.clear();
+      for (Word i = 0; i < size; ++i) {
+        Word pos = Reduce(Mix(bucket[i].fp, d), n);
+        if (used[pos]) break;
+        if (std::find(positions.begin(), positions.end(), pos) !=
+            positions.end()) {
+          break;
+        }
+        positions.push_back(pos);
+      }
+      if (positions.size() == size) break;
+      d++;
+    }
+
+    // Add keys to table.
+    displacements_[b] = d;
+    for (Word i = 0; i < size; ++i) {
+      used[positions[i]] = true;
+      entries_[positions[i]] = Entry{Word(bucket[i].fp >> 32),
+                                     bucket[i].symbol};
+    }
+  }
+
+  return true;
 }
 
-void Store::CoalesceStrings() {
+SlotIndex::SlotIndex(const Store *store, int min_slots)
+    : min_slots_(min_slots) {
+  // Find all the wide frames.
+  std::vector<const FrameDatum *> wide;
+  int64 num_buckets = 0;
+  for (const Heap *heap = store->first_heap_; heap; heap = heap->next()) {
+    const Datum *object = heap->base();
+    const Datum *end = heap->end();
+    while (object < end) {
+      if (object->IsFrame()) {
+        const FrameDatum *frame = object->AsFrame();
+        int slots = frame->slots();
+        if (slots >= min_slots && slots <= kMaxSlots) {
+          wide.push_back(frame);
+          Word size = 1;
+          while (size < frame->slots() * 2) size <<= 1;
+          num_buckets += size + 1;
+        }
+      }
+      object = object->next();
+    }
+  }
+
+  // Allocate side table with a load factor of at most 50%.
+  Word size = 1;
+  while (size < wide.size() * 2) size <<= 1;
+  frames_.resize(size);
+  frame_mask_ = size - 1;
+  tables_.reserve(num_buckets);
+
+  // Build slot hash tables for wide frames.
+  for (const FrameDatum *frame : wide) Add(frame);
+}
+
+void SlotIndex::Add(const FrameDatum *frame) {
+  // Add frame to side table.
+  Word f = Hash(frame->self) & frame_mask_;
+  while (!frames_[f].frame.IsNil()) f = (f + 1) & frame_mask_;
+  frames_[f].frame = frame->self;
+  frames_[f].table = tables_.size();
+  num_frames_++;
+
+  // Allocate hash table for slots.
+  Word size = 1;
+  while (size < frame->slots() * 2) size <<= 1;
+  Word mask = size - 1;
+  tables_.push_back(mask);
+  Word base = tables_.size();
+  tables_.resize(base + size);
+  Word *table = tables_.data() + base;
+
+  // Insert the first slot for each slot name.
+  const Slot *slots = frame->begin();
+  for (int pos = 0; pos < frame->slots(); ++pos) {
+    Handle name = slots[pos].name;
+    Word hash = Hash(name);
+    Word b = hash & mask;
+    while (table[b] != 0) {
+      if (slots[(table[b] & kPositionMask) - 1].name == name) break;
+      b = (b + 1) & mask;
+    }
+    if (table[b] == 0) table[b] = (hash & kTagMask) | (pos + 1);
+  }
+}
+
+void Store::Reset() {
+  // Only local stores can be reset.
+  CHECK(globals_ != nullptr) << "Only local stores can be reset";
+  CHECK_EQ(gc_locks_, 0) << "Reset of locked store";
+  CHECK(roots_.next_ == &roots_) << "Reset with live roots";
+  CHECK(externals_.next_ == &externals_) << "Reset with live externals";
+
+  // Clear all heaps and the handle table.
+  for (Heap *heap = first_heap_; heap != nullptr; heap = heap->next()) {
+    heap->reset();
+  }
+  current_heap_ = first_heap_;
+  handles_.reset();
+  free_handle_ = nullptr;
+  borrowed_strings_ = false;
+
+  // Clear generational state.
+  if (nursery_ != nullptr) {
+    old_heap_ = nursery_->next();
+    old_expanded_ = false;
+    remembered_.reset();
+    remembered_flags_.assign(remembered_flags_.size(), false);
+    pretenured_.reset();
+  }
+
+  // Clear statistics.
+  gc_pending_ = false;
+  num_gcs_ = 0;
+  gc_time_ = 0;
+  num_minor_gcs_ = 0;
+  minor_gc_time_ = 0;
+  promoted_bytes_ = 0;
+  num_coalesced_strings_ = 0;
+  coalesced_bytes_ = 0;
+
+  // Allocate new symbol map with a single bucket.
+  num_symbols_ = 0;
+  num_buckets_ = 1;
+  symbols_ = AllocateArray(num_buckets_);
+  roots_.handle_ = symbols_;
+}
+
+void Store::CoalesceStrings(int num_threads) {
   // Do not coalesce strings in frozen store.
   if (frozen_) return;
 
-  // Allocate cache for matching strings.
-  Word num_buckets = options_->string_buckets;
-  StringDatum **cache = new StringDatum *[num_buckets]();
+  // Do not coalesce strings in memory-mapped heaps. These are shared with
+  // other processes mapping the same snapshot, and updating the references
+  // would make private copies of the mapped pages.
+  for (Heap *heap = first_heap_; heap != nullptr; heap = heap->next()) {
+    if (heap->mapped()) return;
+  }
 
   // Scan the heaps to find all strings.
+  std::vector<Heap *> heaps;
+  std::vector<StringDatum *> strings;
   for (Heap *heap = first_heap_; heap != nullptr; heap = heap->next()) {
+    heaps.push_back(heap);
     Datum *object = heap->base();
     Datum *end = heap->end();
     while (object < end) {
-      if (object->IsString()) {
-        // Assign string to hash bucket in cache if it is not already used.
-        StringDatum *str = object->AsString();
-        Word b = HashBytes(str->data(), str->size()) % num_buckets;
-        if (cache[b] == nullptr) cache[b] = str;
-      }
+      if (object->IsString()) strings.push_back(object->AsString());
       object = object->next();
     }
   }
+  if (strings.empty()) return;
+
+  // Use a thread for each million strings up to the number of cores.
+  if (num_threads <= 0) {
+    num_threads = std::min<int64>(strings.size() / 1000000 + 1,
+                                  jit::CPU::Processors());
+  }
+  auto run = [num_threads](const WorkerPool::Worker &worker) {
+    if (num_threads == 1) {
+      worker(0);
+    } else {
+      WorkerPool pool;
+      pool.Start(num_threads, worker);
+      pool.Join();
+    }
+  };
+
+  // Compute fingerprints for all the strings and bucket the strings by
+  // fingerprint shard. Each thread handles a contiguous range of strings, so
+  // the strings in each bucket are in heap order.
+  struct Fingerprinted {
+    uint64 fp;
+    StringDatum *str;
+  };
+  typedef std::vector<std::vector<Fingerprinted>> Buckets;
+  std::vector<Buckets> buckets(num_threads, Buckets(num_threads));
+  size_t chunk = (strings.size() + num_threads - 1) / num_threads;
+  run([&](int index) {
+    size_t begin = index * chunk;
+    size_t end = std::min(begin + chunk, strings.size());
+    Buckets &shards = buckets[index];
+    for (size_t i = begin; i < end; ++i) {
+      StringDatum *str = strings[i];
+      uint64 fp = sling::Fingerprint(str->data(), str->size());
+      shards[fp % num_threads].push_back({fp, str});
+    }
+  });
+
+  // Each thread finds the duplicates for the strings in its fingerprint shard.
+  // The first occurrence of each string in heap order is kept, and all other
+  // occurrences are mapped to it. Fingerprint collisions are resolved by
+  // comparing the string contents, so all identical strings are found. The
+  // duplicates are marked so the replacement table only needs to be consulted
+  // for these, and they are partitioned by handle for building the replacement
+  // tables.
+  typedef std::pair<Handle, Handle> Duplicate;
+  typedef std::vector<std::vector<Duplicate>> Partitions;
+  std::vector<Partitions> duplicates(num_threads, Partitions(num_threads));
+  std::vector<int64> saved(num_threads);
+  HandleHash hash;
+  run([&](int shard) {
+    std::unordered_multimap<uint64, StringDatum *> unique;
+    for (int index = 0; index < num_threads; ++index) {
+      for (const Fingerprinted &f : buckets[index][shard]) {
+        StringDatum *intern = nullptr;
+        auto range = unique.equal_range(f.fp);
+        for (auto it = range.first; it != range.second; ++it) {
+          if (it->second->equals(*f.str)) {
+            intern = it->second;
+            break;
+          }
+        }
+        if (intern == nullptr) {
+          unique.emplace(f.fp, f.str);
+        } else {
+          Handle handle = f.str->self;
+          int partition = hash(handle) % num_threads;
+          duplicates[shard][partition].emplace_back(handle, intern->self);
+          saved[shard] += reinterpret_cast<char *>(f.str->next()) -
+                          reinterpret_cast<char *>(f.str);
+          f.str->mark();
+        }
+      }
+      std::vector<Fingerprinted>().swap(buckets[index][shard]);
+    }
+  });
+
+  // Build a replacement table for each partition of the duplicate strings.
+  typedef std::unordered_map<Handle, Handle, HandleHash> Replacements;
+  std::vector<Replacements> replacements(num_threads);
+  run([&](int partition) {
+    Replacements &table = replacements[partition];
+    for (int shard = 0; shard < num_threads; ++shard) {
+      for (const Duplicate &d : duplicates[shard][partition]) {
+        table[d.first] = d.second;
+      }
+    }
+  });
+
+  // Run through all objects in the heaps and replace references to duplicate
+  // strings with the first occurrence.
+  std::vector<int> replaced(num_threads);
+  std::vector<std::vector<Handle>> modified(num_threads);
+  run([&](int index) {
+    for (int i = index; i < heaps.size(); i += num_threads) {
+      Datum *object = heaps[i]->base();
+      Datum *end = heaps[i]->end();
+      while (object < end) {
+        if (!object->IsInvalid() && !object->IsBinary()) {
+          Handle *begin = reinterpret_cast<Handle *>(object->payload());
+          Handle *end = reinterpret_cast<Handle *>(object->limit());
+          bool updated = false;
+          for (Handle *cell = begin; cell < end; ++cell) {
+            // Check if value is a duplicate string.
+            Handle h = *cell;
+            if (h.IsNil() || !h.IsRef() || !Owned(h)) continue;
+            Datum *o = Deref(h);
+            if (!o->IsString() || !o->marked()) continue;
+
+            // Replace string with the first occurrence. The duplicate string
+            // will be removed during the next GC.
+            const Replacements &table = replacements[hash(h) % num_threads];
+            auto f = table.find(h);
+            DCHECK(f != table.end());
+            *cell = f->second;
+            replaced[index]++;
+            updated = true;
+          }
+          if (updated && nursery_ != nullptr) {
+            modified[index].push_back(object->self);
+          }
+        }
+        object = object->next();
+      }
+    }
+  });
+
+  // Clear marks on the duplicate strings.
+  for (const Replacements &table : replacements) {
+    for (const auto &r : table) Deref(r.first)->unmark();
+  }
 
-  // Run through all objects and replace references to strings that match the
-  // strings in the buckets.
+  // Old objects that now reference strings in the nursery must be remembered.
   int num_replaced = 0;
-  for (Heap *heap = first_heap_; heap != nullptr; heap = heap->next()) {
-    Datum *object = heap->base();
-    Datum *end = heap->end();
-    while (object < end) {
-      if (!object->IsInvalid() && !object->IsBinary()) {
-        // Replace all string matches in the object values.
-        Handle *begin = reinterpret_cast<Handle *>(object->payload());
-        Handle *end = reinterpret_cast<Handle *>(object->limit());
-        for (Handle *cell = begin; cell < end; ++cell) {
-          // Check if value is a string.
-          Handle h = *cell;
-          if (h.IsNil() || !h.IsRef()) continue;
-          Datum *o = Deref(h);
-          if (!o->IsString()) continue;
-          StringDatum *str = o->AsString();
-
-          // Check if string is equal to the one in the cache. If it is the
-          // string in the cache we leave it, but if it is a different string
-          // with the same contents we replace it with the string in the cache.
-          Word b = HashBytes(str->data(), str->size()) % num_buckets;
-          StringDatum *intern = cache[b];
-          DCHECK(intern != nullptr);
-          if (intern == str) continue;
-          if (str->equals(*intern)) {
-            // Replace string with the cached string. The original string will
-            // be removed during the next GC.
-            *cell = intern->self;
-            num_replaced++;
+  int num_duplicates = 0;
+  int64 saved_bytes = 0;
+  for (int i = 0; i < num_threads; ++i) {
+    num_replaced += replaced[i];
+    num_duplicates += replacements[i].size();
+    saved_bytes += saved[i];
+    for (Handle h : modified[i]) Remember(h);
+  }
+
+  num_coalesced_strings_ += num_duplicates;
+  coalesced_bytes_ += saved_bytes;
+  VLOG(1) << num_duplicates << " strings coalesced in "
+          << num_replaced << " references using " << num_threads
+          << " threads, " << saved_bytes << " bytes saved";
+}
+
+void Store::Merge(const std::vector<Store *> &stores, int num_threads) {
+  // Only unfrozen global stores with a single generation can be merged.
+  CHECK(!frozen_);
+  CHECK(globals_ == nullptr);
+  CHECK(base_ == nullptr);
+  CHECK(nursery_ == nullptr);
+  LockGC();
+
+  // Expand the handle table to make room for the objects in the other stores
+  // up front. The pointers in the handle free list are updated if the handle
+  // table is moved.
+  size_t needed = handles_.size();
+  for (Store *other : stores) {
+    needed += (other->handles_.length() - kPristineHandles) * sizeof(Reference);
+  }
+  if (needed > handles_.capacity()) {
+    Reference *old = handles_.base();
+    handles_.reserve(needed);
+    pools_[store_tag_] = reinterpret_cast<Address>(handles_.base());
+    for (Reference **ref = &free_handle_; *ref; ref = &(*ref)->next) {
+      *ref = handles_.base() + (*ref - old);
+    }
+  }
+
+  // Objects in the other stores that are replaced by existing objects in this
+  // store. These are invalidated and their handles are freed at the end.
+  std::vector<Handle> unused;
+
+  for (Store *other : stores) {
+    CHECK(other != this);
+    CHECK(!other->frozen_);
+    CHECK(other->globals_ == nullptr);
+    CHECK(other->nursery_ == nullptr);
+    CHECK(other->free_handle_ == nullptr);
+
+    // Allocate handles in this store for all the objects in the other store
+    // except the standard objects, which are the same in all stores.
+    int n = other->handles_.length();
+    int base = handles_.length();
+    Reference *refs = handles_.add(n - kPristineHandles);
+    std::vector<Handle> reloc(n);
+    for (int i = 0; i < n; ++i) {
+      if (i < kPristineHandles) {
+        reloc[i] = Handle::Ref(i * sizeof(Reference), store_tag_);
+      } else {
+        reloc[i] = Handle::Ref((base + i - kPristineHandles) *
+                               sizeof(Reference), store_tag_);
+        refs[i - kPristineHandles].object = other->handles_.base()[i].object;
+      }
+    }
+    auto index = [](Handle h) { return h.offset() / sizeof(Reference); };
+    auto discard = [&](Datum *object) {
+      unused.push_back(reloc[index(object->self)]);
+      object->invalidate();
+    };
+
+    // Resolve the symbols in the other store against the symbols in this
+    // store. Symbols that are bound to frames are bound after all the
+    // relocations are known.
+    std::vector<std::pair<SymbolDatum *, Datum *>> bindings;
+    std::vector<std::pair<Handle, Datum *>> replacements;
+    std::vector<bool> replaced(n);
+    std::vector<SymbolDatum *> adopted;
+    MapDatum *map = other->GetMap(other->symbols_);
+    for (Handle *bucket = map->begin(); bucket < map->end(); ++bucket) {
+      Handle h = *bucket;
+      while (!h.IsNil()) {
+        SymbolDatum *symbol = other->GetSymbol(h);
+        h = symbol->next;
+        if (index(symbol->self) < kPristineHandles) continue;
+
+        StringDatum *name = other->GetString(symbol->name);
+        Handle existing = FindSymbol(name->str(), symbol->hash);
+        Datum *value = symbol->bound() ? other->Deref(symbol->value) : nullptr;
+        if (existing.IsNil()) {
+          // Move new symbol to this store.
+          symbol->self = reloc[index(symbol->self)];
+          symbol->name = reloc[index(symbol->name)];
+          adopted.push_back(symbol);
+          if (value == nullptr) {
+            symbol->value = symbol->self;
+          } else if (value->IsProxy()) {
+            ProxyDatum *proxy = value->AsProxy();
+            proxy->self = reloc[index(proxy->self)];
+            proxy->symbol = symbol->self;
+            symbol->value = proxy->self;
+          } else {
+            bindings.emplace_back(symbol, value);
+          }
+          continue;
+        }
+
+        // The symbol already exists in this store, so all references to the
+        // symbol in the other store are redirected to the existing symbol.
+        SymbolDatum *sym = GetSymbol(existing);
+        discard(symbol);
+        reloc[index(symbol->self)] = existing;
+        if (value == nullptr) continue;
+
+        if (value->IsProxy()) {
+          if (sym->bound()) {
+            // Use existing binding for proxy.
+            discard(value);
+            reloc[index(value->self)] = sym->value;
+          } else {
+            // Move proxy to this store and bind existing symbol to it.
+            ProxyDatum *proxy = value->AsProxy();
+            proxy->self = reloc[index(proxy->self)];
+            proxy->symbol = existing;
+            sym->value = proxy->self;
+          }
+        } else if (!sym->bound()) {
+          // Bind existing symbol to new frame.
+          bindings.emplace_back(sym, value);
+        } else {
+          // The existing symbol is bound to a proxy or a frame in this store.
+          // The new frame takes over the handle for the existing proxy or
+          // frame like when a frame is decoded into the store. The ids of a
+          // redefined frame are unbound before the new frame is bound.
+          Handle target = sym->value;
+          Datum *object = Deref(target);
+          int f = index(value->self);
+          if (object == value) {
+            // The new frame has already taken over the handle through
+            // another id.
+          } else if (!replaced[f]) {
+            if (object->IsFrame()) {
+              FrameDatum *frame = object->AsFrame();
+              for (Slot *slot = frame->begin(); slot < frame->end(); ++slot) {
+                if (!slot->name.IsId()) continue;
+                SymbolDatum *id = GetSymbol(slot->value);
+                id->value = id->self;
+              }
+            }
+            replaced[f] = true;
+            unused.push_back(reloc[f]);
+            reloc[f] = target;
+            object->invalidate();
+            Assign(target, value);
+          } else if (object->IsProxy()) {
+            // The frame has multiple proxies, so the references to the
+            // existing proxy must be replaced with the frame.
+            replacements.emplace_back(target, value);
+          } else {
+            // The frame has ids bound to different frames. Another frame can
+            // only be redefined if symbol rebinding is allowed.
+            CHECK(options_->symbol_rebinding) << DebugString(existing);
           }
+          bindings.emplace_back(sym, value);
         }
       }
-      object = object->next();
     }
+
+    // Remove the standard objects and the symbol table from the other store.
+    for (int i = 1; i < kPristineHandles; ++i) {
+      other->handles_.base()[i].object->invalidate();
+    }
+
+    // Add the new symbols to the symbol table.
+    for (SymbolDatum *symbol : adopted) InsertSymbol(symbol);
+
+    // Bind symbols to the relocated frames.
+    for (auto &binding : bindings) {
+      binding.first->value = reloc[index(binding.second->self)];
+    }
+
+    // Relocate all the references in the objects in the other store in
+    // parallel. Symbols and proxies have already been relocated.
+    std::vector<Heap *> heaps;
+    for (Heap *heap = other->first_heap_; heap; heap = heap->next()) {
+      heaps.push_back(heap);
+    }
+    int threads = num_threads;
+    if (threads <= 0) threads = jit::CPU::Processors();
+    threads = std::max(std::min<int>(threads, heaps.size()), 1);
+    auto worker = [&](int thread) {
+      for (int i = thread; i < heaps.size(); i += threads) {
+        Datum *object = heaps[i]->base();
+        Datum *end = heaps[i]->end();
+        while (object < end) {
+          if (!object->IsInvalid() && !object->IsSymbol() &&
+              !object->IsProxy()) {
+            object->self = reloc[index(object->self)];
+            if (!object->IsBinary()) {
+              Handle *begin = reinterpret_cast<Handle *>(object->payload());
+              Handle *end = reinterpret_cast<Handle *>(object->limit());
+              for (Handle *cell = begin; cell < end; ++cell) {
+                if (cell->IsRef() && !cell->IsNil()) {
+                  *cell = reloc[index(*cell)];
+                }
+              }
+            }
+          }
+          object = object->next();
+        }
+      }
+    };
+    if (threads == 1) {
+      worker(0);
+    } else {
+      WorkerPool pool;
+      pool.Start(threads, worker);
+      pool.Join();
+    }
+
+    // Transfer the heaps from the other store to this store.
+    last_heap_->set_next(other->first_heap_);
+    last_heap_ = other->last_heap_;
+    other->first_heap_ = other->last_heap_ = other->current_heap_ = nullptr;
+
+    // Replace references to proxies for frames with multiple proxies.
+    for (auto &r : replacements) {
+      ReplaceHandle(r.first, r.second->self);
+      Datum *proxy = Deref(r.first);
+      proxy->invalidate();
+      unused.push_back(r.first);
+    }
+  }
+
+  // Free the handles for discarded objects.
+  for (Handle h : unused) {
+    Reference *ref = handles_.address(h.offset());
+    ref->next = free_handle_;
+    free_handle_ = ref;
   }
 
-  delete [] cache;
-  VLOG(1) << num_replaced << " strings coalesced";
+  UnlockGC();
 }
 
 string Store::DebugString(Handle handle) const {
@@ -1538,9 +3120,15 @@ void Store::GetMemoryUsage(MemoryUsage *usage, bool quick) const {
     usage->unused_heap_bytes += heap->available();
   }
 
-  // Compute handle table usage.
-  usage->num_handles = handles_.capacity() / sizeof(Reference);
-  usage->num_unused_handles = handles_.available() / sizeof(Reference);
+  // Compute handle table usage. The handle table of an overlay store is
+  // reserved at the maximum size, so only the used part is counted.
+  if (base_ != nullptr) {
+    usage->num_handles = handles_.size() / sizeof(Reference);
+    usage->num_unused_handles = 0;
+  } else {
+    usage->num_handles = handles_.capacity() / sizeof(Reference);
+    usage->num_unused_handles = handles_.available() / sizeof(Reference);
+  }
   usage->num_dead_handles = num_dead_handles_;
 
   // Count the number of free elements in the handle table.
@@ -1588,7 +3176,139 @@ void Store::GetMemoryUsage(MemoryUsage *usage, bool quick) const {
   // Garbage collection statistics.
   usage->num_gcs = num_gcs_;
   usage->gc_time = gc_time_;
+  usage->num_minor_gcs = num_minor_gcs_;
+  usage->minor_gc_time = minor_gc_time_;
+  usage->promoted_bytes = promoted_bytes_;
+  if (globals_ == nullptr && slot_index_ != nullptr) {
+    usage->num_indexed_frames = slot_index_->num_frames();
+    usage->slot_index_bytes = slot_index_->memory();
+  } else {
+    usage->num_indexed_frames = 0;
+    usage->slot_index_bytes = 0;
+  }
+  usage->num_coalesced_strings = num_coalesced_strings_;
+  usage->coalesced_bytes = coalesced_bytes_;
 }
 
-}  // namespace sling
+int MemoryProfile::SlotBucket(int slots) {
+  int bucket = 0;
+  while (slots > 0 && bucket < kSlotBuckets - 1) {
+    slots >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+string MemoryProfile::SlotRange(int bucket, const char *separator,
+                                const char *more) {
+  if (bucket == 0) return "0";
+  int low = 1 << (bucket - 1);
+  if (bucket == kSlotBuckets - 1) return StrCat(low, more);
+  return StrCat(low, separator, (1 << bucket) - 1);
+}
+
+Text MemoryProfile::Namespace(Text id) {
+  // Path ids like /w/item use the first path component as namespace.
+  if (!id.empty() && id[0] == '/') {
+    int slash = id.find('/', 1);
+    return slash == -1 ? Text() : id.substr(0, slash + 1);
+  }
+
+  // Ids like Q42 use the part before the first digit as namespace.
+  for (int i = 1; i < id.size(); ++i) {
+    if (id[i] >= '0' && id[i] <= '9') return id.substr(0, i);
+  }
+  return Text();
+}
+
+void MemoryProfile::Merge(const MemoryProfile &other) {
+  strings.add(other.strings);
+  symbols.add(other.symbols);
+  arrays.add(other.arrays);
+  frames.add(other.frames);
+  proxies.add(other.proxies);
+  invalid.add(other.invalid);
+  garbage.add(other.garbage);
+  borrowed_bytes += other.borrowed_bytes;
+  for (int i = 0; i < kSlotBuckets; ++i) slots[i].add(other.slots[i]);
+  for (auto &it : other.namespaces) namespaces[it.first].add(it.second);
+}
+
+MemoryProfile::Stats MemoryProfile::total() const {
+  Stats stats;
+  stats.add(strings);
+  stats.add(symbols);
+  stats.add(arrays);
+  stats.add(frames);
+  stats.add(proxies);
+  stats.add(invalid);
+  stats.add(garbage);
+  return stats;
+}
 
+void Store::GetMemoryProfile(MemoryProfile *profile, int threads) const {
+  // Get the list of heaps.
+  std::vector<const Heap *> heaps;
+  for (Heap *heap = first_heap_; heap != nullptr; heap = heap->next()) {
+    heaps.push_back(heap);
+  }
+  if (threads <= 0) threads = jit::CPU::Processors();
+  threads = std::max(std::min(threads, static_cast<int>(heaps.size())), 1);
+
+  // Each worker profiles every n'th heap into its own profile.
+  std::vector<MemoryProfile> profiles(threads);
+  auto worker = [this, threads, &heaps, &profiles](int index) {
+    MemoryProfile &p = profiles[index];
+    for (int i = index; i < heaps.size(); i += threads) {
+      const Datum *object = heaps[i]->base();
+      const Datum *end = heaps[i]->end();
+      while (object < end) {
+        int64 size = sizeof(Datum) + Align(object->size());
+        if (object->IsInvalid()) {
+          p.invalid.add(size);
+        } else if (Deref(object->self) != object) {
+          p.garbage.add(size);
+        } else if (object->IsFrame()) {
+          const FrameDatum *frame = object->AsFrame();
+          if (frame->IsProxy()) {
+            p.proxies.add(size);
+          } else {
+            p.frames.add(size);
+            p.slots[MemoryProfile::SlotBucket(frame->slots())].add(size);
+            for (const Slot *s = frame->begin(); s < frame->end(); ++s) {
+              if (s->name.IsId()) {
+                const SymbolDatum *symbol = GetSymbol(s->value);
+                Text id = GetString(symbol->name)->str();
+                p.namespaces[MemoryProfile::Namespace(id).str()].add(size);
+                break;
+              }
+            }
+          }
+        } else if (object->IsString()) {
+          p.strings.add(size);
+          if (object->IsBorrowed()) {
+            p.borrowed_bytes += object->AsString()->size();
+          }
+        } else if (object->IsSymbol()) {
+          p.symbols.add(size);
+        } else if (object->IsArray()) {
+          p.arrays.add(size);
+        }
+        object = object->next();
+      }
+    }
+  };
+  if (threads == 1) {
+    worker(0);
+  } else {
+    WorkerPool pool;
+    pool.Start(threads, worker);
+    pool.Join();
+  }
+
+  // Merge the profiles from the workers.
+  *profile = MemoryProfile();
+  for (const MemoryProfile &p : profiles) profile->Merge(p);
+}
+
+}  // namespace sling
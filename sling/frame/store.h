@@ -19,13 +19,17 @@
 #include <atomic>
 #include <functional>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 #include "sling/base/bitcast.h"
 #include "sling/base/logging.h"
 #include "sling/base/macros.h"
 #include "sling/base/types.h"
 #include "sling/string/text.h"
+#include "sling/util/numa.h"
 
 namespace sling {
 
@@ -42,8 +46,9 @@ class Region {
   // Initializes empty region.
   Region() : base_(nullptr), end_(nullptr), limit_(nullptr) {}
 
-  // Deallocates the memory for the region.
-  ~Region() { free(base_); }
+  // Deallocates the memory for the region. Memory-mapped regions are not owned
+  // by the region and must be released by the owner of the mapping.
+  ~Region();
 
   // Resizes the memory region to the requested size. The size is the number of
   // bytes that the region can store. It can be used to make the region smaller,
@@ -58,6 +63,28 @@ class Region {
   // until enough free space is available for the request.
   Address expand(size_t bytes);
 
+  // Uses memory-mapped data for the region. The whole region is marked as used
+  // and the region cannot be resized after this.
+  void map(void *data, size_t bytes) {
+    DCHECK(base_ == nullptr);
+    base_ = static_cast<Address>(data);
+    end_ = limit_ = base_ + bytes;
+    mapped_ = true;
+  }
+
+  // Returns true if the region is backed by memory-mapped data.
+  bool mapped() const { return mapped_; }
+
+  // Allocate the region with huge pages when it is at least the size of a huge
+  // page. Explicit huge pages are used if available. Otherwise, transparent
+  // huge pages are requested for the region, and if these are not available
+  // either, the region is backed by normal pages. This only affects later
+  // allocations.
+  void set_huge_pages(bool huge_pages) { huge_pages_ = huge_pages; }
+
+  // Returns true if the region is currently allocated with huge pages.
+  bool huge() const { return huge_; }
+
   // Mark whole region as unused.
   void reset() { end_ = base_; }
 
@@ -91,6 +118,15 @@ class Region {
   // End of memory region. Points to first byte after memory region.
   Address limit_;
 
+  // The memory for the region is mapped from a file.
+  bool mapped_ = false;
+
+  // Use huge pages for allocating the region.
+  bool huge_pages_ = false;
+
+  // The memory for the region has been allocated with huge pages.
+  bool huge_ = false;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(Region);
 };
@@ -434,6 +470,11 @@ enum FrameFlags : Word {
   UNUSED_FRAME_FLAG = 0x4UL << kSizeBits,
 };
 
+// String type flags.
+enum StringFlags : Word {
+  BORROWED = 0x4UL << kSizeBits,  // string data is borrowed from outside store
+};
+
 // All heap objects starts with an 8 byte preamble that contains the handle for
 // the object, the object size, and the object type. The object type is stored
 // in the upper bits of the size field.
@@ -468,7 +509,10 @@ struct Datum {
   Type typebits() const { return static_cast<Type>(info & kTypeMask); }
 
   // Returns the base type of the object.
-  Type type() const { return (info & FRAME) != 0 ? FRAME : typebits(); }
+  Type type() const {
+    if ((info & FRAME) != 0) return FRAME;
+    return static_cast<Type>(typebits() & ~BORROWED);
+  }
 
   // Returns true if heap object is marked.
   bool marked() const { return (self.raw() & Handle::kMark) != 0; }
@@ -477,6 +521,14 @@ struct Datum {
   void mark() { self = Handle{self.raw() | Handle::kMark}; }
   void unmark() { self = Handle{self.raw() & ~Handle::kMark}; }
 
+  // Atomically marks heap object. Returns false if the object was already
+  // marked. This is used for marking objects from multiple threads.
+  bool atomic_mark() {
+    Word *bits = reinterpret_cast<Word *>(&self);
+    return (__atomic_fetch_or(bits, Handle::kMark, __ATOMIC_RELAXED) &
+            Handle::kMark) == 0;
+  }
+
   // Invalidate heap object by setting the type to INVALID.
   void invalidate() { info = size() | INVALID; }
 
@@ -489,7 +541,7 @@ struct Datum {
   }
 
   // Object type checking.
-  bool IsString() const { return typebits() == STRING; }
+  bool IsString() const { return (typebits() & ~BORROWED) == STRING; }
   bool IsArray() const { return typebits() == ARRAY; }
   bool IsSymbol() const { return typebits() == SYMBOL; }
   bool IsInvalid() const { return typebits() == INVALID; }
@@ -498,6 +550,8 @@ struct Datum {
     return ((info & (FRAME | PROXY)) == (FRAME | PROXY));
   }
 
+  bool IsBorrowed() const { return typebits() == (STRING | BORROWED); }
+
   // Only strings contain binary data. All other types have handles as payload.
   bool IsBinary() const { return IsString(); }
 
@@ -557,11 +611,33 @@ struct Datum {
 
 // The payload of a string object contains the string. The size field is the
 // exact size of the object, although the actual size of the string object
-// is aligned. The strings are not zero-terminated.
+// is aligned. The strings are not zero-terminated. A borrowed string does not
+// hold the string data itself, but points to string data outside the store,
+// e.g. in the input buffer it was decoded from. The string data must outlive
+// the string object.
 struct StringDatum : public Datum {
+  // Payload for borrowed string.
+  struct Borrowed {
+    const char *data;
+    Word size;
+  };
+
+  // Returns true if string data is borrowed.
+  bool borrowed() const { return IsBorrowed(); }
+
   // Returns pointer to string.
-  char *data() { return reinterpret_cast<char *>(payload()); }
-  const char *data() const { return reinterpret_cast<const char *>(payload()); }
+  char *data() {
+    if (borrowed()) return const_cast<char *>(external()->data);
+    return reinterpret_cast<char *>(payload());
+  }
+  const char *data() const {
+    if (borrowed()) return external()->data;
+    return reinterpret_cast<const char *>(payload());
+  }
+
+  // Returns the size of the string. This hides the object size in the
+  // preamble, which is the size of the borrowed payload for borrowed strings.
+  Word size() const { return borrowed() ? external()->size : Datum::size(); }
 
   // Returns string as a Text.
   Text str() const { return Text(data(), size()); }
@@ -577,6 +653,11 @@ struct StringDatum : public Datum {
     if (size() != other.size()) return false;
     return memcmp(data(), other.data(), other.size()) == 0;
   }
+
+  // Returns payload for borrowed string.
+  const Borrowed *external() const {
+    return reinterpret_cast<const Borrowed *>(payload());
+  }
 };
 
 // A slot is a name and value pair.
@@ -603,6 +684,58 @@ struct Slot {
   Handle value;  // slot value
 };
 
+// Slot scanning functions for finding slots in frames. The scanning functions
+// are selected on first use and use AVX2 for comparing four slots at a time if
+// the CPU supports it. Otherwise, a scalar loop is used.
+struct SlotScan {
+  // Returns first slot in range with name, or end if there is no such slot.
+  // The function pointers are atomic since they are selected on the first
+  // scan, which can happen concurrently in several threads.
+  typedef const Slot *(*FindFunc)(const Slot *begin, const Slot *end,
+                                  Handle name);
+  static std::atomic<FindFunc> find;
+
+  // Returns first slot in range with name and value, or end if there is no
+  // such slot.
+  typedef const Slot *(*MatchFunc)(const Slot *begin, const Slot *end,
+                                   Handle name, Handle value);
+  static std::atomic<MatchFunc> match;
+
+  // Selects vectorized or scalar slot scanning. Vectorized scanning is only
+  // selected if it is supported by the CPU. Returns true if vectorized
+  // scanning is used.
+  static bool Vectorize(bool enable);
+
+  // Ranges with fewer slots than this are scanned inline with a scalar loop,
+  // since this is faster than calling the scanning function.
+  static const int kMinSlots = 8;
+};
+
+// Returns first slot in range with name, or end if there is no such slot.
+inline const Slot *FindSlot(const Slot *begin, const Slot *end, Handle name) {
+  if (end - begin < SlotScan::kMinSlots) {
+    for (const Slot *slot = begin; slot < end; ++slot) {
+      if (slot->name == name) return slot;
+    }
+    return end;
+  }
+  return SlotScan::find.load(std::memory_order_relaxed)(begin, end, name);
+}
+
+// Returns first slot in range with name and value, or end if there is no such
+// slot.
+inline const Slot *MatchSlot(const Slot *begin, const Slot *end,
+                             Handle name, Handle value) {
+  if (end - begin < SlotScan::kMinSlots) {
+    for (const Slot *slot = begin; slot < end; ++slot) {
+      if (slot->name == name && slot->value == value) return slot;
+    }
+    return end;
+  }
+  SlotScan::MatchFunc match = SlotScan::match.load(std::memory_order_relaxed);
+  return match(begin, end, name, value);
+}
+
 // A frame consists of an array of slots with names and values.
 struct FrameDatum : public Datum {
   // Range of slots for object.
@@ -624,34 +757,30 @@ struct FrameDatum : public Datum {
 
   // Finds first value of named slot.
   Handle get(Handle name) const {
-    for (const Slot *slot = begin(); slot < end(); ++slot) {
-      if (slot->name == name) return slot->value;
-    }
-    return Handle::nil();
+    const Slot *slot = FindSlot(begin(), end(), name);
+    return slot < end() ? slot->value : Handle::nil();
   }
 
   // Checks if frame has named slot.
   bool has(Handle name) const {
-    for (const Slot *slot = begin(); slot < end(); ++slot) {
-      if (slot->name == name) return true;
-    }
-    return false;
+    return FindSlot(begin(), end(), name) < end();
+  }
+
+  // Finds next slot with name starting from a slot in the frame. Returns end()
+  // if there are no more slots with this name. This can be used for iterating
+  // over all the values for a slot name.
+  const Slot *next(Handle name, const Slot *from) const {
+    return FindSlot(from, end(), name);
   }
 
   // Checks if frame has isa: type.
   bool isa(Handle type) const {
-    for (const Slot *slot = begin(); slot < end(); ++slot) {
-      if (slot->name == Handle::isa() && slot->value == type) return true;
-    }
-    return false;
+    return MatchSlot(begin(), end(), Handle::isa(), type) < end();
   }
 
   // Checks if frame has is: type.
   bool is(Handle type) const {
-    for (const Slot *slot = begin(); slot < end(); ++slot) {
-      if (slot->name == Handle::is() && slot->value == type) return true;
-    }
-    return false;
+    return MatchSlot(begin(), end(), Handle::is(), type) < end();
   }
 
   // Updates the named flag for frame.
@@ -799,6 +928,10 @@ class External {
   explicit External(Store *store);
   virtual ~External();
 
+  // Moves the external object to another store. The object must not hold any
+  // references to objects in the old store.
+  void Attach(Store *store);
+
   // The external object must store the references in a contiguous range between
   // begin and end.
   virtual void GetReferences(Range *range) {
@@ -869,6 +1002,238 @@ struct MemoryUsage {
 
   int num_gcs;              // number of garbage collections
   int64 gc_time;            // garbage collection time in microseconds
+
+  int num_minor_gcs;        // number of nursery collections
+  int64 minor_gc_time;      // nursery collection time in microseconds
+  int64 promoted_bytes;     // bytes promoted from nursery to old generation
+
+  int num_indexed_frames;   // number of frames in slot index
+  int64 slot_index_bytes;   // memory used by slot index
+
+  int num_coalesced_strings;  // number of duplicate strings coalesced
+  int64 coalesced_bytes;      // bytes saved by coalescing strings
+};
+
+// Detailed memory profile for the objects in the heaps of a store. The object
+// counts and sizes are broken down by object type, number of slots in frames,
+// and the namespace of the frame ids. Object sizes include the preamble and
+// alignment padding.
+struct MemoryProfile {
+  // Number of objects and bytes used by these.
+  struct Stats {
+    void add(int64 size) { objects++; bytes += size; }
+    void add(const Stats &other) {
+      objects += other.objects;
+      bytes += other.bytes;
+    }
+
+    int64 objects = 0;
+    int64 bytes = 0;
+  };
+
+  // Number of buckets in the slot histogram. Frames with no slots are in the
+  // first bucket, and frames with 2^(b-1) to 2^b-1 slots are in bucket b. The
+  // last bucket also holds all larger frames.
+  static const int kSlotBuckets = 16;
+
+  // Returns the histogram bucket for frames with a number of slots.
+  static int SlotBucket(int slots);
+
+  // Returns the range of slot counts in a histogram bucket, e.g. "4-7" for
+  // bucket 3 and "16384+" for the last bucket. The separator between the
+  // bounds and the suffix for the last bucket can be changed for contexts
+  // where these characters are not allowed, e.g. counter names.
+  static string SlotRange(int bucket, const char *separator = "-",
+                          const char *more = "+");
+
+  // Returns the namespace for an id, i.e. the part before the first digit for
+  // ids like Q42 and P31, or the first path component for ids like /w/item.
+  // Returns an empty namespace for ids without a namespace.
+  static Text Namespace(Text id);
+
+  // Adds the statistics from another profile to this profile.
+  void Merge(const MemoryProfile &other);
+
+  // Total number of objects and bytes in the heaps.
+  Stats total() const;
+
+  Stats strings;   // strings (heap part of borrowed strings)
+  Stats symbols;   // symbols
+  Stats arrays;    // arrays
+  Stats frames;    // frames that are not proxies
+  Stats proxies;   // proxy frames
+  Stats invalid;   // invalidated objects
+  Stats garbage;   // objects no longer referenced by the handle table
+
+  int64 borrowed_bytes = 0;  // string data borrowed from outside the store
+
+  // Frames by number of slots.
+  Stats slots[kSlotBuckets];
+
+  // Named frames by id namespace.
+  std::unordered_map<string, Stats> namespaces;
+};
+
+// A slot index is used for fast lookup of slots in frames with many slots.
+// The slot index can only be built for frozen stores, since the frames cannot
+// be modified after they have been indexed. For each indexed frame there is an
+// open-addressing hash table that maps slot names to the position of the first
+// slot with this name. The hash tables for the frames are found through a side
+// table keyed by frame handle.
+class SlotIndex {
+ public:
+  // Builds slot index for all the frames in the store with at least min_slots
+  // slots.
+  SlotIndex(const Store *store, int min_slots);
+
+  // Returns the position of the first slot with the name in the frame or -1
+  // if the frame does not have a slot with this name. Returns -2 if the frame
+  // is not indexed.
+  int Find(const FrameDatum *frame, Handle name) const {
+    // Find hash table for frame.
+    Handle handle = frame->self;
+    Word f = Hash(handle) & frame_mask_;
+    for (;;) {
+      const FrameEntry &entry = frames_[f];
+      if (entry.frame == handle) {
+        // Find slot name in hash table for frame.
+        const Word *table = tables_.data() + entry.table;
+        Word mask = *table++;
+        const Slot *slots = frame->begin();
+        Word hash = Hash(name);
+        Word tag = hash & kTagMask;
+        Word b = hash & mask;
+        for (;;) {
+          Word bucket = table[b];
+          if (bucket == 0) return -1;
+          if ((bucket & kTagMask) == tag) {
+            int pos = (bucket & kPositionMask) - 1;
+            if (slots[pos].name == name) return pos;
+          }
+          b = (b + 1) & mask;
+        }
+      }
+      if (entry.frame.IsNil()) return -2;
+      f = (f + 1) & frame_mask_;
+    }
+  }
+
+  // Minimum number of slots for indexed frames.
+  int min_slots() const { return min_slots_; }
+
+  // Maximum number of slots for indexed frames.
+  static const int kMaxSlots = 0xFFFF;
+
+  // Number of indexed frames.
+  int num_frames() const { return num_frames_; }
+
+  // Memory used by slot index in bytes.
+  int64 memory() const {
+    return frames_.size() * sizeof(FrameEntry) + tables_.size() * sizeof(Word);
+  }
+
+ private:
+  // Entry in side table mapping frame handles to slot hash tables.
+  struct FrameEntry {
+    Handle frame;  // frame handle (nil for empty entries)
+    Word table;    // offset of slot hash table in tables_
+  };
+
+  // Each bucket in the slot hash tables holds the slot position plus one in
+  // the lower bits and the upper bits of the slot name hash in the upper bits.
+  // The hash tag is used for skipping non-matching slots without accessing
+  // the frame.
+  static const Word kPositionMask = 0x0000FFFF;
+  static const Word kTagMask = 0xFFFF0000;
+
+  // Hash function for handles.
+  static Word Hash(Handle handle) {
+    Word h = (handle.raw() >> 3) * 0x9E3779B1;
+    return h ^ (h >> 16);
+  }
+
+  // Adds slot hash table for frame.
+  void Add(const FrameDatum *frame);
+
+  // Side table with hash tables for indexed frames.
+  std::vector<FrameEntry> frames_;
+  Word frame_mask_ = 0;
+
+  // Slot hash tables for all indexed frames. Each hash table starts with the
+  // hash mask followed by the hash buckets. Empty buckets are zero.
+  std::vector<Word> tables_;
+
+  // Minimum number of slots for indexed frames.
+  int min_slots_;
+
+  // Number of indexed frames.
+  int num_frames_ = 0;
+};
+
+// A perfect symbol table is a minimal perfect hash table for the symbols in a
+// frozen store. The symbol names are hashed into buckets, and each bucket has
+// a displacement that maps the names in the bucket to distinct positions in
+// the table (hash and displace). Buckets with a single name map directly to a
+// table position. Each table entry holds the symbol handle and a fingerprint
+// check, so a lookup only takes one probe and names that are not in the table
+// are rejected without accessing the symbol.
+class PerfectSymbolTable {
+ public:
+  // Builds perfect symbol table for the symbols in the store. Returns false if
+  // the table could not be built, e.g. because of fingerprint collisions.
+  bool Build(const Store *store);
+
+  // Returns the symbol for the name fingerprint or nil if the name is not in
+  // the table. The caller must check that the symbol name matches, since the
+  // table only holds partial fingerprints.
+  Handle Find(uint64 fp) const {
+    Word d = displacements_[Reduce(fp, displacements_.size())];
+    Word pos = d & kDirect ? d & ~kDirect : Reduce(Mix(fp, d), entries_.size());
+    const Entry &entry = entries_[pos];
+    return entry.check == (fp >> 32) ? entry.symbol : Handle::nil();
+  }
+
+  // Returns the number of symbols in the table.
+  int size() const { return entries_.size(); }
+
+  // Returns the number of buckets in the table.
+  int buckets() const { return displacements_.size(); }
+
+  // Returns the memory used by the table in bytes.
+  int64 memory() const {
+    return displacements_.size() * sizeof(Word) +
+           entries_.size() * sizeof(Entry);
+  }
+
+ private:
+  // Table entry with symbol handle and the upper bits of the name fingerprint.
+  struct Entry {
+    Word check;
+    Handle symbol;
+  };
+
+  // Displacements with this bit set map directly to a table position.
+  static const Word kDirect = 0x80000000;
+
+  // Maps the lower 32 bits of a hash value to the range [0;n).
+  static Word Reduce(uint64 hash, Word n) {
+    return ((hash & 0xFFFFFFFF) * n) >> 32;
+  }
+
+  // Hashes fingerprint with displacement.
+  static uint64 Mix(uint64 fp, Word d) {
+    uint64 h = (fp ^ (d * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 32);
+  }
+
+  // Displacements for hash buckets.
+  std::vector<Word> displacements_;
+
+  // Table entries for symbols.
+  std::vector<Entry> entries_;
+
+  // Allow snapshots to save and restore the table.
+  friend class Snapshot;
 };
 
 // The data for objects are stored in object heaps. An object heap is a
@@ -898,6 +1263,18 @@ class Heap : public Space<Datum> {
 // A global store can be accessed concurrently from multiple threads, but a
 // local store is not thread-safe and should only be accessed from one thread at
 // a time.
+//
+// An overlay store is a global store layered on top of a frozen base store. It
+// shares the objects and symbols of the base store, and new objects are added
+// to the heaps of the overlay store. Objects from the base store are copied
+// into the overlay store when they are modified, so the base store is never
+// changed and the memory used by the overlay store is proportional to the size
+// of the changes. The handle table of the base store is mapped copy-on-write
+// into the overlay store, so handles for base objects are valid in the overlay
+// store. Symbol lookups fall through to the base store. When the overlay store
+// is frozen, it can be used as the global store for local stores, but it
+// cannot be used as the base for another overlay store, so there are at most
+// three layers: base store, overlay store, and local stores.
 class Store {
  public:
   // Configuration options for store.
@@ -907,9 +1284,18 @@ class Store {
       maximum_heap_size = 128 * (1 << 20);
       initial_handles = 1024;
       map_buckets = 1024;
-      string_buckets = 1 << 20;
       expansion_free_fraction = 20;
       symbol_rebinding = false;
+      generational = false;
+      nursery_size = 1 << 20;
+      slot_index_threshold = 0;
+      perfect_symbols = false;
+      coalesce_strings = false;
+      huge_pages = false;
+      share_handles = true;
+      numa_interleave = false;
+      numa_replicas = false;
+      gc_threads = 1;
       local = this;
     }
 
@@ -925,15 +1311,68 @@ class Store {
     // Initial number of bucket in symbol hash table.
     int map_buckets;
 
-    // Number of buckets for coalescing strings.
-    int string_buckets;
-
     // Minimum fraction of free memory after GC to skip expansion.
     int expansion_free_fraction;
 
     // Allow symbols to be bound.
     bool symbol_rebinding;
 
+    // Use generational garbage collection. New objects are allocated in a
+    // nursery and objects surviving a nursery collection are promoted to the
+    // old generation. A nursery collection only traces the objects in the
+    // nursery, the roots, and the old objects that have been modified since
+    // the last collection. All updates to existing objects must therefore go
+    // through the store or be reported with Store::Remember().
+    bool generational;
+
+    // Nursery size in bytes for generational garbage collection.
+    int nursery_size;
+
+    // Minimum number of slots for frames in the slot index. When the store is
+    // frozen, a hashed slot index is built for all frames with at least this
+    // number of slots. Local stores use the slot index of the global store.
+    // The slot index is disabled if this is zero.
+    int slot_index_threshold;
+
+    // Build a perfect hash table for the symbols when the store is frozen.
+    // This speeds up symbol lookups in frozen global stores.
+    bool perfect_symbols;
+
+    // Coalesce identical strings before the store is frozen or written to a
+    // snapshot. Strings in heaps memory-mapped from a snapshot are never
+    // coalesced.
+    bool coalesce_strings;
+
+    // Allocate heaps and handle table with huge pages to reduce TLB misses
+    // for large stores. Only heaps and handle tables that are at least 2 MB
+    // use huge pages. If the handle table uses huge pages, it is not shared
+    // with overlay stores when the store is frozen.
+    bool huge_pages;
+
+    // Move the handle table to shared memory when the store is frozen, so
+    // overlay stores on top of it map the handle table copy-on-write instead
+    // of copying it. Handle tables smaller than 1 MB are always kept private,
+    // since they are cheap to copy.
+    bool share_handles;
+
+    // Interleave the heaps and the handle table of the frozen store over the
+    // NUMA nodes to spread the memory traffic evenly over the nodes.
+    bool numa_interleave;
+
+    // Replicate the frozen store on each NUMA node. The replicas have the same
+    // handles as the store, and replica() returns the replica for the NUMA
+    // node of the calling thread. If the store cannot be replicated, it is
+    // interleaved over the NUMA nodes instead. With huge_pages, the replicas
+    // request transparent huge pages on their node, but they do not use
+    // explicit huge pages.
+    bool numa_replicas;
+
+    // Number of threads for marking and compacting in full garbage
+    // collections. Only stores with more than 64 MB of heap objects are
+    // collected in parallel. The result is the same as for a serial garbage
+    // collection.
+    int gc_threads;
+
     // Options for local store.
     Options *local;
   };
@@ -947,6 +1386,13 @@ class Store {
   // Initializes local store.
   explicit Store(const Store *globals);
 
+  // Initializes overlay store on top of a frozen global store. Overlay stores
+  // do not use generational garbage collection or slot indices. The base store
+  // cannot itself be an overlay store. If the handle table of the base store
+  // is not shared, e.g. because it uses huge pages, it is copied into the
+  // overlay store.
+  Store(const Options *options, const Store *base);
+
   // Deletes all objects in the store.
   ~Store();
 
@@ -1038,35 +1484,84 @@ class Store {
   void Freeze();
 
   // Merges occurrences of the same string. This saves memory by only keeping
-  // one copy of each string value. This uses hashing, so it is not guaranteed
-  // to find all identical strings.
-  void CoalesceStrings();
+  // one copy of each string value. All identical strings are found by sharding
+  // the strings by fingerprint over a number of threads. If the number of
+  // threads is zero, it is selected based on the number of strings. The
+  // duplicate strings are reclaimed by the next garbage collection. Nothing is
+  // done if the store is frozen or has memory-mapped heaps.
+  void CoalesceStrings(int num_threads = 0);
+
+  // Moves all the objects from other global stores into this store. The
+  // symbols in the other stores are resolved against the symbols in this
+  // store in the same way as if the objects had been decoded into this store
+  // in order, i.e. proxies are replaced by the frames they stand for and
+  // frames that are redefined keep their handles. The object heaps of the
+  // other stores are transferred to this store and the references in the
+  // transferred objects are relocated in parallel. If the number of threads
+  // is zero, it is selected based on the number of heaps.
+  // The other stores must not have been garbage collected, and they are left
+  // empty and must be deleted afterwards.
+  void Merge(const std::vector<Store *> &stores, int num_threads = 0);
 
   // Computes memory usage for store.
   void GetMemoryUsage(MemoryUsage *usage, bool quick = false) const;
 
+  // Computes detailed memory profile for the objects in the store. The heaps
+  // are scanned in parallel using up to the given number of threads, or one
+  // thread per processor if threads is zero. The store must not be modified
+  // while the profile is computed.
+  void GetMemoryProfile(MemoryProfile *profile, int threads = 0) const;
+
   // Returns true if the store has been frozen.
   bool frozen() const { return frozen_; }
 
+  // Configuration options for store.
+  const Options *options() const { return options_; }
+
   // Global store for this store, or null if this is a global store.
   const Store *globals() const { return globals_; }
 
+  // Base store for overlay store, or null if this is not an overlay store.
+  const Store *base() const { return base_; }
+
+  // Fingerprint of the snapshot the store was loaded from or saved to when it
+  // was frozen, or zero if there is no such snapshot with a fingerprint.
+  uint64 snapshot_fingerprint() const { return snapshot_fingerprint_; }
+
+  // Returns the replica of a frozen store for the NUMA node of the calling
+  // thread. Local stores created on top of the replica use node-local memory
+  // for the global objects. Returns the store itself if the store has not
+  // been replicated.
+  const Store *replica() const {
+    if (replicas_.empty()) return this;
+    int node = NUMA::CurrentNode();
+    return node < static_cast<int>(replicas_.size()) ? replicas_[node] : this;
+  }
+
+  // Returns the number of NUMA replicas for the store.
+  int num_replicas() const { return replicas_.size(); }
+
   // Returns handle for symbol table.
   Handle symbols() const { return symbols_; }
 
-  // Returns the number of symbols in the symbol table.
+  // Returns the number of symbols in the symbol table. For overlay stores,
+  // this does not include the symbols in the base store.
   int num_symbols() const { return num_symbols_; }
 
   // Iterate all objects in the symbol table. This requires the store to be
-  // stable during iteration to avoid invalidating the iterator.
+  // stable during iteration to avoid invalidating the iterator. For overlay
+  // stores, the objects in the base store are also included, and modified
+  // base objects are returned in their modified form.
   void ForAll(std::function<void(Handle handle)> callback) {
-    const MapDatum *map = GetMap(symbols());
-    for (Handle *bucket = map->begin(); bucket < map->end(); ++bucket) {
-      Handle h = *bucket;
-      while (!h.IsNil()) {
-        const SymbolDatum *symbol = GetSymbol(h);
-        if (symbol->bound()) callback(symbol->value);
-        h = symbol->next;
+    for (const Store *s = this; s != nullptr; s = s->base_) {
+      const MapDatum *map = GetMap(s->symbols());
+      for (Handle *bucket = map->begin(); bucket < map->end(); ++bucket) {
+        Handle h = *bucket;
+        while (!h.IsNil()) {
+          const SymbolDatum *symbol = GetSymbol(h);
+          if (symbol->bound()) callback(symbol->value);
+          h = symbol->next;
+        }
       }
     }
   }
@@ -1102,6 +1597,20 @@ class Store {
   // Allocates and initializes string object.
   Handle AllocateString(Text str);
 
+  // Allocates string object that borrows the string data instead of copying
+  // it. The string data must outlive the string object or be copied into the
+  // store with CopyBorrowedStrings() before it is released.
+  Handle AllocateBorrowedString(Text str);
+
+  // Copies the string data for all borrowed strings into the store. This must
+  // be called before releasing the buffers that strings have been borrowed
+  // from if the store outlives them. Frozen stores and snapshots never contain
+  // borrowed strings.
+  void CopyBorrowedStrings();
+
+  // Returns true if strings have been borrowed since the last copy or reset.
+  bool has_borrowed_strings() const { return borrowed_strings_; }
+
   // Allocates frame optionally replacing an existing frame.
   Handle AllocateFrame(Slot *begin, Slot *end, Handle original);
   Handle AllocateFrame(Slot *begin, Slot *end) {
@@ -1120,6 +1629,13 @@ class Store {
   // Allocates array and initializes its contents.
   Handle AllocateArray(const Handle *begin, const Handle *end);
 
+  // Records that an object has been modified outside the store. In generational
+  // mode, this remembers old objects that can contain references to objects in
+  // the nursery.
+  void Remember(Handle handle) {
+    if (nursery_ != nullptr) RememberObject(handle);
+  }
+
   // Dereferences a handle and returns a pointer to the object data.
   Datum *Deref(Handle handle) {
     DCHECK(IsValidReference(handle));
@@ -1132,6 +1648,15 @@ class Store {
     return *reinterpret_cast<const Datum **>(table + handle.offset());
   }
 
+  // Dereferences handle for an object that is about to be modified. In an
+  // overlay store, objects from the base store are copied into the overlay
+  // store before they are modified. The copying can trigger a garbage
+  // collection, so any other object pointers must be fetched after this.
+  Datum *GetMutableObject(Handle handle) {
+    if (handle.offset() < base_limit_) return ShadowObject(handle);
+    return Deref(handle);
+  }
+
   // Checks basic type of object. This will return false for number types.
   bool IsType(Handle handle, Type type) const {
     DCHECK_EQ(type & Handle::kSimple, 0);
@@ -1187,9 +1712,41 @@ class Store {
   void LockGC() { ++gc_locks_; }
   void UnlockGC() { if (--gc_locks_ == 0 && gc_pending_) GC(); }
 
-  // Performs garbage collection.
+  // Performs full garbage collection.
   void GC();
 
+  // Clears all the objects in a local store. The heaps and the handle table
+  // are kept, so the store can be reused without allocating new memory. There
+  // must be no live roots or externals for the store when it is reset.
+  void Reset();
+
+  // Returns true if store uses generational garbage collection.
+  bool generational() const { return nursery_ != nullptr; }
+
+  // Finds first value of named slot in frame. This uses the slot index for
+  // wide frames in frozen stores.
+  Handle GetSlot(const FrameDatum *frame, Handle name) const {
+    if (slot_index_ != nullptr && frame->slots() >= slot_index_->min_slots()) {
+      int pos = slot_index_->Find(frame, name);
+      if (pos == -1) return Handle::nil();
+      if (pos != -2) return frame->begin()[pos].value;
+    }
+    return frame->get(name);
+  }
+
+  // Checks if frame has named slot. This uses the slot index for wide frames
+  // in frozen stores.
+  bool HasSlot(const FrameDatum *frame, Handle name) const {
+    if (slot_index_ != nullptr && frame->slots() >= slot_index_->min_slots()) {
+      int pos = slot_index_->Find(frame, name);
+      if (pos != -2) return pos != -1;
+    }
+    return frame->has(name);
+  }
+
+  // Returns slot index for store or null if it does not have a slot index.
+  const SlotIndex *slot_index() const { return slot_index_; }
+
   // Check is store is pristine, i.e. the store only contains the standard
   // frames. This can be used for checking if a snapshot can be used for
   // restoring the store without overwriting any existing content.
@@ -1256,6 +1813,25 @@ class Store {
   // heap.
   Datum *AllocateDatumSlow(Type type, Word size);
 
+  // Allocates memory for heap object when the nursery is full.
+  Datum *AllocateNurserySlow(Type type, Word size);
+
+  // Allocates memory in the old generation. This expands the old generation
+  // with a new heap if there is no room for the object.
+  Datum *AllocateOld(Word bytes);
+
+  // Adds new heap to store with room for at least the requested number of
+  // bytes.
+  void AddHeap(Word bytes);
+
+  // Adds handle to the remembered set if the object is in the old generation.
+  void RememberObject(Handle handle);
+
+  // Checks if object is in the nursery.
+  bool InNursery(const Datum *object) const {
+    return object >= nursery_->base() && object < nursery_->end();
+  }
+
   // Allocates handle for object.
   Handle AllocateHandle(Datum *object) {
     Reference *ref;
@@ -1275,6 +1851,32 @@ class Store {
   // Allocates handle when handle table is full.
   Handle AllocateHandleSlow(Datum *object);
 
+  // Copies object from the base store into an overlay store unless it has
+  // already been copied. Returns the overlay copy of the object.
+  Datum *ShadowObject(Handle handle);
+
+  // Checks if handle refers to an unmodified object in the base store.
+  bool InBase(Handle handle) const {
+    return handle.offset() < base_limit_ && shadowed_.count(handle) == 0;
+  }
+
+  // Moves the handle table of a frozen global store into shared memory, so it
+  // can be mapped copy-on-write into overlay stores.
+  void ShareHandles();
+
+  // Initializes a replica of a frozen global store by copying the heaps and
+  // the handle table to memory on a NUMA node. If the memory cannot be
+  // allocated on the node, the handle table of the replica is not mapped.
+  Store(const Store *primary, int node);
+
+  // Replicates a frozen global store on all other NUMA nodes. The store itself
+  // is moved to the first node. Returns false if the store could not be
+  // replicated.
+  bool Replicate();
+
+  // Interleaves the heaps and the handle table over the NUMA nodes.
+  void Interleave();
+
   // Assigns heap object to handle.
   void Assign(Handle handle, Datum *object) {
     Address table = pools_[store_tag_];
@@ -1283,8 +1885,21 @@ class Store {
 
   // Replaces heap object for a handle with a new object.
   void Replace(Handle handle, Datum *object) {
-    // Mark old object as invalid.
-    Deref(handle)->invalidate();
+    // In generational mode, objects referencing the handle need to be traced
+    // in the next nursery collection if the handle is moved from the old
+    // generation to the nursery.
+    Datum *existing = Deref(handle);
+    if (nursery_ != nullptr && !InNursery(existing)) {
+      *remembered_.push() = handle;
+    }
+
+    // Mark old object as invalid. Objects in the base store of an overlay
+    // store are left untouched, and the handle is recorded as modified.
+    if (InBase(handle)) {
+      shadowed_.insert(handle);
+    } else {
+      existing->invalidate();
+    }
 
     // Update handle to point to new object.
     Assign(handle, object);
@@ -1321,11 +1936,20 @@ class Store {
   // This is a very expensive operation that requires a complete heap traversal.
   void ReplaceHandle(Handle handle, Handle replacement);
 
-  // Mark reachable objects.
-  void Mark();
+  // Mark reachable objects using a number of threads.
+  void Mark(int threads);
+
+  // Compact heaps using a number of threads.
+  void Compact(int threads);
+
+  // Compacts heap by moving all the marked objects to the beginning of the
+  // heap. The handles for the dead objects are linked together in a free list
+  // from head to tail in reverse heap order.
+  void CompactHeap(Heap *heap, Reference **head, Reference **tail);
 
-  // Compact heaps.
-  void Compact();
+  // Collects garbage in the nursery and promotes the surviving objects to the
+  // old generation.
+  void CollectNursery();
 
   // Pointers to the global and local handle tables. These must be first in
   // the store object for fast dereferencing of object handles. These will be
@@ -1339,10 +1963,48 @@ class Store {
   // Reference to global store. This is null for global stores.
   const Store *globals_;
 
+  // Base store for overlay store. This is null if the store is not an overlay
+  // store.
+  const Store *base_ = nullptr;
+
+  // Size of the handle table of the base store in bytes. Handles below this
+  // offset refer to objects in the base store unless they have been modified
+  // in the overlay store. This is zero if the store is not an overlay store.
+  Word base_limit_ = 0;
+
+  // Fingerprint of the snapshot the store was loaded from. This is set by
+  // Snapshot::Read() and by Snapshot::Write() for frozen stores, and it is used
+  // for checking the base store of delta files and inverse indices.
+  uint64 snapshot_fingerprint_ = 0;
+
+  // Handles for base objects that have been modified in the overlay store.
+  // The overlay copies of these objects are roots for garbage collection.
+  std::unordered_set<Handle, HandleHash> shadowed_;
+
+  // Shared memory file with the handle table of a frozen global store, or -1
+  // if the handle table is not shared.
+  int handle_file_ = -1;
+
+  // Store that this store is a NUMA replica of. The slot index and the
+  // perfect symbol table are shared with the primary store.
+  const Store *primary_ = nullptr;
+
+  // NUMA replicas of a frozen global store indexed by node. The entry for the
+  // first node is the store itself.
+  std::vector<Store *> replicas_;
+
   // Stores must be frozen before being used as a global store for a local
   // store. When a store is frozen, it can no longer be changed.
   bool frozen_ = false;
 
+  // Slot index for wide frames in frozen global store. Local stores share the
+  // slot index with the global store.
+  const SlotIndex *slot_index_ = nullptr;
+
+  // Perfect hash table for the symbols in a frozen store. This is only used
+  // for symbol lookup when the store is frozen.
+  PerfectSymbolTable *perfect_symbols_ = nullptr;
+
   // Memory regions for storing object data. The heaps are linked together in
   // a linked list. The heaps are filled one by one until all the heaps are
   // full. Then the heaps needs to be garbage collected and if there is still
@@ -1351,6 +2013,29 @@ class Store {
   Heap *first_heap_;
   Heap *last_heap_;
 
+  // In generational mode, the first heap is used as a nursery for allocating
+  // new objects. Surviving objects are promoted to the old generation which
+  // consists of the remaining heaps. The nursery is null if the store is not
+  // generational.
+  Heap *nursery_ = nullptr;
+
+  // Current heap for allocating objects in the old generation.
+  Heap *old_heap_ = nullptr;
+
+  // Set when the old generation has been expanded since the last full GC.
+  bool old_expanded_ = false;
+
+  // Handles for old objects that have been modified since the last nursery
+  // collection. Handles for objects in the nursery that replaced objects in
+  // the old generation are also remembered. The remembered flags are indexed
+  // by handle number and prevent objects from being remembered twice.
+  Space<Handle> remembered_;
+  std::vector<bool> remembered_flags_;
+
+  // Objects allocated directly in the old generation since the last nursery
+  // collection.
+  Space<Datum *> pretenured_;
+
   // The handle table is used for storing references to objects. All access to
   // objects go through the handle table, which provides a level of indirection
   // that allows object to move dynamically, e.g. during garbage collection and
@@ -1388,17 +2073,32 @@ class Store {
   // Time spent on garbage collection in microseconds.
   int64 gc_time_ = 0;
 
+  // Statistics for nursery collections.
+  int num_minor_gcs_ = 0;
+  int64 minor_gc_time_ = 0;
+  int64 promoted_bytes_ = 0;
+
+  // Statistics for string coalescing.
+  int num_coalesced_strings_ = 0;
+  int64 coalesced_bytes_ = 0;
+
   // Number of dead handles after store has been frozen.
   int num_dead_handles_ = 0;
 
+  // Some strings in the store borrow their string data from outside the store.
+  bool borrowed_strings_ = false;
+
   // Configuration options for store.
   const Options *options_;
 
   // Default configuration options.
   static const Options kDefaultOptions;
 
-  // Allow internal access for snapshots.
+  // Allow internal access for snapshots and indices.
   friend class Snapshot;
+  friend class SlotIndex;
+  friend class PerfectSymbolTable;
+  friend class InverseIndex;
 };
 
 // Utility class for GC locking in store.
@@ -0,0 +1,69 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/frame/symbol-dictionary.h"
+
+#include <algorithm>
+
+#include "sling/base/logging.h"
+#include "sling/util/fingerprint.h"
+
+namespace sling {
+
+SymbolDictionary::SymbolDictionary(const Store *store) : store_(store) {
+  // The handles in the store must be stable.
+  CHECK(store->globals() == nullptr);
+  CHECK(store->frozen());
+
+  // Collect all symbols bound to frames.
+  std::vector<Handle> symbols;
+  const MapDatum *map = store->GetMap(store->symbols());
+  for (Handle *bucket = map->begin(); bucket < map->end(); ++bucket) {
+    Handle h = *bucket;
+    while (!h.IsNil()) {
+      const SymbolDatum *symbol = store->GetSymbol(h);
+      if (symbol->bound() && !store->IsProxy(symbol->value)) {
+        symbols.push_back(h);
+      }
+      h = symbol->next;
+    }
+  }
+
+  // Sort symbols by name.
+  std::vector<Text> names(symbols.size());
+  std::vector<int> order(symbols.size());
+  for (int i = 0; i < symbols.size(); ++i) {
+    const SymbolDatum *symbol = store->GetSymbol(symbols[i]);
+    names[i] = store->GetString(symbol->name)->str();
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&names](int a, int b) {
+    return names[a] < names[b];
+  });
+
+  // Number the symbols in name order.
+  entries_.resize(symbols.size());
+  numbers_.reserve(symbols.size());
+  for (int i = 0; i < order.size(); ++i) {
+    Handle h = symbols[order[i]];
+    Entry &entry = entries_[i];
+    entry.name = names[order[i]];
+    entry.frame = store->GetSymbol(h)->value;
+    numbers_[h] = i;
+    uint64 fp = Fingerprint(entry.name.data(), entry.name.size());
+    fingerprint_ = FingerprintCat(fingerprint_, fp);
+  }
+}
+
+}  // namespace sling
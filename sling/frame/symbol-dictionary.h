@@ -0,0 +1,83 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_FRAME_SYMBOL_DICTIONARY_H_
+#define SLING_FRAME_SYMBOL_DICTIONARY_H_
+
+#include <vector>
+
+#include "sling/base/types.h"
+#include "sling/frame/object.h"
+#include "sling/frame/store.h"
+#include "sling/string/text.h"
+
+namespace sling {
+
+// A symbol dictionary assigns numbers to the named frames in a frozen global
+// store, e.g. the commons store, so the encoder can output links to these
+// frames by number instead of by name. The frames are numbered in symbol name
+// order, so the encoder and the decoder get the same dictionary as long as
+// they use stores with the same symbols. The encoder outputs the fingerprint
+// of the dictionary before the first dictionary number, and the decoder checks
+// it against the fingerprint of its own dictionary.
+class SymbolDictionary {
+ public:
+  // Builds symbol dictionary for all symbols bound to frames in store.
+  explicit SymbolDictionary(const Store *store);
+
+  // Returns the dictionary number for symbol or -1 if it is not in the
+  // dictionary.
+  int Lookup(Handle symbol) const {
+    auto f = numbers_.find(symbol);
+    return f == numbers_.end() ? -1 : f->second;
+  }
+
+  // Returns frame for dictionary entry.
+  Handle frame(int index) const { return entries_[index].frame; }
+
+  // Returns symbol name for dictionary entry.
+  Text name(int index) const { return entries_[index].name; }
+
+  // Store for dictionary.
+  const Store *store() const { return store_; }
+
+  // Number of symbols in dictionary.
+  int size() const { return entries_.size(); }
+
+  // Fingerprint of the symbol names in the dictionary.
+  uint64 fingerprint() const { return fingerprint_; }
+
+ private:
+  // Dictionary entry with symbol name and frame.
+  struct Entry {
+    Text name;
+    Handle frame;
+  };
+
+  // Store with symbols.
+  const Store *store_;
+
+  // Dictionary entries in symbol name order.
+  std::vector<Entry> entries_;
+
+  // Mapping from symbol handles to dictionary numbers.
+  HandleMap<int> numbers_;
+
+  // Fingerprint of symbol names.
+  uint64 fingerprint_ = 0;
+};
+
+}  // namespace sling
+
+#endif  // SLING_FRAME_SYMBOL_DICTIONARY_H_
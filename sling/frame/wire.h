@@ -31,13 +31,17 @@ enum WireType {
 };
 
 enum WireSpecial {
-  WIRE_NIL      = 1,  // "nil" value
-  WIRE_ID       = 2,  // "id" value
-  WIRE_ISA      = 3,  // "isa" value
-  WIRE_IS       = 4,  // "is" value
-  WIRE_ARRAY    = 5,  // array, followed by array size and the arguments
-  WIRE_INDEX    = 6,  // index value, followed by varint32 encoded integer
-  WIRE_RESOLVE  = 7,  // resolve link, followed by slots and replacement index
+  WIRE_NIL        = 1,  // "nil" value
+  WIRE_ID         = 2,  // "id" value
+  WIRE_ISA        = 3,  // "isa" value
+  WIRE_IS         = 4,  // "is" value
+  WIRE_ARRAY      = 5,  // array, followed by array size and the arguments
+  WIRE_INDEX      = 6,  // index value, followed by varint32 encoded integer
+  WIRE_RESOLVE    = 7,  // resolve link, followed by slots and replacement index
+  WIRE_SHARED     = 8,  // bound symbol in shared symbol dictionary, followed
+                        // by varint32 encoded dictionary number
+  WIRE_DICTIONARY = 9,  // symbol dictionary check, followed by varint64
+                        // encoded dictionary fingerprint and the next value
 };
 
 // The binary marker (i.e. a nul character) is used for prefixing serialized
@@ -0,0 +1,131 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/http/store-monitor.h"
+
+#include <inttypes.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/string/printf.h"
+
+namespace sling {
+
+// Maximum number of namespaces shown for each store.
+static const int kMaxNamespaces = 50;
+
+// Output table row with object statistics.
+static void StatsRow(HTTPResponse *rsp, const string &name,
+                     const MemoryProfile::Stats &stats, int64 total) {
+  double pct = total == 0 ? 0.0 : stats.bytes * 100.0 / total;
+  rsp->Append(StringPrintf(
+      "<tr><td>%s</td><td align=\"right\">%" PRId64 "</td>"
+      "<td align=\"right\">%" PRId64 "</td>"
+      "<td align=\"right\">%.2f%%</td></tr>\n",
+      HTMLEscape(name).c_str(), stats.objects, stats.bytes, pct));
+}
+
+// Output table header.
+static void TableHeader(HTTPResponse *rsp, const char *title) {
+  rsp->Append("<table border=\"1\"><tr>");
+  rsp->Append("<td>");
+  rsp->Append(title);
+  rsp->Append("</td><td>Objects</td><td>Bytes</td><td>Share</td></tr>\n");
+}
+
+void StoreMonitor::Add(const string &name, const Store *store) {
+  MutexLock lock(&mu_);
+  stores_.emplace_back(name, store);
+}
+
+void StoreMonitor::Register(HTTPServer *http) {
+  http->Register("/memz", this, &StoreMonitor::HandleMemoryProfile);
+}
+
+void StoreMonitor::HandleMemoryProfile(HTTPRequest *request,
+                                       HTTPResponse *response) {
+  MutexLock lock(&mu_);
+  response->SetContentType("text/html");
+  response->set_status(200);
+  response->Append("<html><head><title>memz</title></head><body>\n");
+  for (auto &s : stores_) {
+    // Compute memory profile for store.
+    const Store *store = s.second;
+    Clock clock;
+    clock.start();
+    MemoryProfile profile;
+    store->GetMemoryProfile(&profile);
+    MemoryUsage usage;
+    store->GetMemoryUsage(&usage, true);
+    clock.stop();
+    int64 total = profile.total().bytes;
+
+    response->Append("<h2>" + HTMLEscape(s.first) + "</h2>\n");
+    response->Append(StringPrintf(
+        "<p>%d heaps, %" PRId64 " heap bytes, %d handles, %d symbols "
+        "(profiled in %.1f ms)</p>\n",
+        usage.num_heaps, usage.total_heap_size, usage.used_handles(),
+        usage.num_symbols(), clock.ms()));
+
+    // Object types.
+    TableHeader(response, "Type");
+    StatsRow(response, "strings", profile.strings, total);
+    StatsRow(response, "symbols", profile.symbols, total);
+    StatsRow(response, "arrays", profile.arrays, total);
+    StatsRow(response, "frames", profile.frames, total);
+    StatsRow(response, "proxies", profile.proxies, total);
+    StatsRow(response, "invalid", profile.invalid, total);
+    StatsRow(response, "garbage", profile.garbage, total);
+    StatsRow(response, "total", profile.total(), total);
+    response->Append("</table>\n");
+    if (profile.borrowed_bytes > 0) {
+      response->Append(StringPrintf(
+          "<p>%" PRId64 " bytes borrowed string data</p>\n",
+          profile.borrowed_bytes));
+    }
+
+    // Frame sizes.
+    response->Append("<p></p>\n");
+    TableHeader(response, "Slots");
+    for (int b = 0; b < MemoryProfile::kSlotBuckets; ++b) {
+      if (profile.slots[b].objects == 0) continue;
+      StatsRow(response, MemoryProfile::SlotRange(b), profile.slots[b],
+               total);
+    }
+    response->Append("</table>\n");
+
+    // Namespaces ordered by memory usage.
+    std::vector<std::pair<string, MemoryProfile::Stats>> namespaces(
+        profile.namespaces.begin(), profile.namespaces.end());
+    std::sort(namespaces.begin(), namespaces.end(),
+      [](const std::pair<string, MemoryProfile::Stats> &a,
+         const std::pair<string, MemoryProfile::Stats> &b) {
+        return a.second.bytes > b.second.bytes;
+      });
+    if (namespaces.size() > kMaxNamespaces) namespaces.resize(kMaxNamespaces);
+    response->Append("<p></p>\n");
+    TableHeader(response, "Namespace");
+    for (auto &ns : namespaces) {
+      StatsRow(response, ns.first.empty() ? "(none)" : ns.first, ns.second,
+               total);
+    }
+    response->Append("</table>\n");
+  }
+  response->Append("</body></html>\n");
+}
+
+}  // namespace sling
@@ -0,0 +1,55 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_HTTP_STORE_MONITOR_H_
+#define SLING_HTTP_STORE_MONITOR_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sling/base/types.h"
+#include "sling/frame/store.h"
+#include "sling/http/http-server.h"
+#include "sling/util/mutex.h"
+
+namespace sling {
+
+// HTTP handler for monitoring the memory usage of frame stores. The /memz page
+// shows the memory profile for each of the registered stores broken down by
+// object type, frame size, and id namespace.
+class StoreMonitor {
+ public:
+  // Add store to monitor. The store must not be modified while the memory
+  // profile is being computed, so only frozen stores should be monitored in
+  // a running server.
+  void Add(const string &name, const Store *store);
+
+  // Register handler with HTTP server.
+  void Register(HTTPServer *http);
+
+  // Handle memory profile requests.
+  void HandleMemoryProfile(HTTPRequest *request, HTTPResponse *response);
+
+ private:
+  // Stores being monitored.
+  std::vector<std::pair<string, const Store *>> stores_;
+
+  // Mutex for serializing requests.
+  Mutex mu_;
+};
+
+}  // namespace sling
+
+#endif  // SLING_HTTP_STORE_MONITOR_H_
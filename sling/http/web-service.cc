@@ -28,7 +28,7 @@
 
 namespace sling {
 
-WebService::WebService(Store *commons,
+WebService::WebService(const Store *commons,
                        HTTPRequest *request,
                        HTTPResponse *response)
     : store_(commons), request_(request), response_(response) {
@@ -38,8 +38,10 @@ class WebService {
     PLAIN,    // plain text (text/plain)
   };
 
-  // Initialize web service from HTTP request and response.
-  WebService(Store *commons, HTTPRequest *request, HTTPResponse *response);
+  // Initialize web service from HTTP request and response. The store for the
+  // request is a local store on top of the frozen commons store.
+  WebService(const Store *commons, HTTPRequest *request,
+             HTTPResponse *response);
 
   // Generate response.
   ~WebService();
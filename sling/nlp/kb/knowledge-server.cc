@@ -17,11 +17,13 @@
 #include "sling/base/logging.h"
 #include "sling/frame/serialization.h"
 #include "sling/http/http-server.h"
+#include "sling/http/store-monitor.h"
 #include "sling/nlp/kb/knowledge-service.h"
 
 DEFINE_int32(port, 8080, "HTTP server port");
 DEFINE_string(kb, "local/data/e/wiki/kb.sling", "Knowledge base");
 DEFINE_string(names, "local/data/e/wiki/en/name-table.repo", "Name table");
+DEFINE_bool(numa_replicas, false, "Replicate knowledge base on NUMA nodes");
 
 using namespace sling;
 using namespace sling::nlp;
@@ -30,7 +32,10 @@ int main(int argc, char *argv[]) {
   InitProgram(&argc, &argv);
 
   LOG(INFO) << "Loading knowledge base from " << FLAGS_kb;
-  Store commons;
+  Store::Options store_options;
+  store_options.perfect_symbols = true;
+  store_options.numa_replicas = FLAGS_numa_replicas;
+  Store commons(&store_options);
   LoadStore(FLAGS_kb, &commons);
 
   LOG(INFO) << "Start HTTP server on port " << FLAGS_port;
@@ -42,6 +47,9 @@ int main(int argc, char *argv[]) {
   commons.Freeze();
 
   kb.Register(&http);
+  StoreMonitor monitor;
+  monitor.Add("kb", &commons);
+  monitor.Register(&http);
   http.Register("/", [](HTTPRequest *req, HTTPResponse *rsp) {
     rsp->RedirectTo("/kb");
   });
@@ -121,7 +121,7 @@ void KnowledgeService::Register(HTTPServer *http) {
 
 void KnowledgeService::HandleQuery(HTTPRequest *request,
                                    HTTPResponse *response) {
-  WebService ws(kb_, request, response);
+  WebService ws(kb_->replica(), request, response);
 
   // Get query
   Text query = ws.Get("q");
@@ -166,7 +166,7 @@ void KnowledgeService::HandleQuery(HTTPRequest *request,
 
 void KnowledgeService::HandleGetItem(HTTPRequest *request,
                                      HTTPResponse *response) {
-  WebService ws(kb_, request, response);
+  WebService ws(kb_->replica(), request, response);
 
   // Look up item in knowledge base.
   Text itemid = ws.Get("id");
@@ -444,7 +444,7 @@ string KnowledgeService::UnitName(const Frame &unit) {
 
 void KnowledgeService::HandleGetFrame(HTTPRequest *request,
                                       HTTPResponse *response) {
-  WebService ws(kb_, request, response);
+  WebService ws(kb_->replica(), request, response);
 
   // Look up frame in knowledge base.
   Text id = ws.Get("id");
@@ -84,7 +84,8 @@ class KnowledgeService {
     bool alternate_image;
   };
 
-  // Knowledge base store.
+  // Knowledge base store. Requests use the NUMA replica of the knowledge base
+  // for the node of the thread handling the request.
   Store *kb_ = nullptr;
 
   // Property map.
@@ -14,24 +14,24 @@
 
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "sling/base/logging.h"
 #include "sling/base/types.h"
 #include "sling/frame/encoder.h"
+#include "sling/frame/json-parser.h"
 #include "sling/frame/object.h"
-#include "sling/frame/reader.h"
 #include "sling/frame/serialization.h"
 #include "sling/frame/store.h"
 #include "sling/nlp/wiki/wiki.h"
 #include "sling/nlp/wiki/wikidata-converter.h"
-#include "sling/stream/input.h"
-#include "sling/stream/memory.h"
 #include "sling/string/strcat.h"
 #include "sling/string/numbers.h"
 #include "sling/string/text.h"
 #include "sling/task/frames.h"
 #include "sling/task/reducer.h"
 #include "sling/task/task.h"
+#include "sling/util/mutex.h"
 
 namespace sling {
 namespace nlp {
@@ -40,6 +40,7 @@ namespace nlp {
 class WikidataImporter : public task::Processor {
  public:
   ~WikidataImporter() override {
+    for (JSONParser *parser : parsers_) delete parser;
     delete converter_;
     delete commons_;
   }
@@ -78,16 +79,35 @@ class WikidataImporter : public task::Processor {
       return;
     }
 
-    // Read Wikidata item in JSON format into local SLING store.
+    // Get parser from the pool or create a new one. The parsers are reused to
+    // avoid reallocating the structural index for each item.
     Store store(commons_);
-    ArrayInputStream stream(message->value());
-    Input input(&stream);
-    Reader reader(&store, &input);
-    reader.set_json(true);
-    Object obj = reader.Read();
-    delete message;
-    CHECK(obj.valid());
+    JSONParser *parser = nullptr;
+    {
+      MutexLock lock(&mu_);
+      if (!parsers_.empty()) {
+        parser = parsers_.back();
+        parsers_.pop_back();
+      }
+    }
+    if (parser == nullptr) {
+      parser = new JSONParser(&store);
+    } else {
+      parser->set_store(&store);
+    }
+
+    // Parse Wikidata item in JSON format into local SLING store.
+    Object obj = parser->Parse(message->value());
+    CHECK(!parser->error()) << parser->error_message() << " at position "
+                            << parser->error_position();
     CHECK(obj.IsFrame()) << message->value();
+    delete message;
+
+    // Return parser to the pool.
+    {
+      MutexLock lock(&mu_);
+      parsers_.push_back(parser);
+    }
 
     // Create SLING frame for item.
     Frame profile = converter_->Convert(obj.AsFrame());
@@ -109,6 +129,8 @@ class WikidataImporter : public task::Processor {
 
   // Clean up.
   void Done(task::Task *task) override {
+    for (JSONParser *parser : parsers_) delete parser;
+    parsers_.clear();
     delete converter_;
     converter_ = nullptr;
     delete commons_;
@@ -126,6 +148,10 @@ class WikidataImporter : public task::Processor {
   // Wikidata converter.
   WikidataConverter *converter_ = nullptr;
 
+  // Pool of JSON parsers.
+  std::vector<JSONParser *> parsers_;
+  Mutex mu_;
+
   // Statistics.
   task::Counter *num_items_ = nullptr;
   task::Counter *num_lexemes_ = nullptr;
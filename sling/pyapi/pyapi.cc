@@ -25,6 +25,7 @@
 #include "sling/pyapi/pyarray.h"
 #include "sling/pyapi/pydate.h"
 #include "sling/pyapi/pyframe.h"
+#include "sling/pyapi/pyinverse.h"
 #include "sling/pyapi/pyparser.h"
 #include "sling/pyapi/pyphrase.h"
 #include "sling/pyapi/pyrecordio.h"
@@ -61,6 +62,7 @@ static void RegisterPythonModule() {
   PyItems::Define(module);
   PyTokenizer::Define(module);
   PyPhraseTable::Define(module);
+  PyInverseIndex::Define(module);
   PyParser::Define(module);
   PyRecordReader::Define(module);
   PyRecordDatabase::Define(module);
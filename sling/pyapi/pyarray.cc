@@ -127,9 +127,10 @@ int PyArray::SetItem(Py_ssize_t index, PyObject *value) {
   }
 
   // Set array element.
-  Handle handle = pystore->Value(value);
-  if (handle.IsError()) return -1;
-  *array()->at(pos(index)) = handle;
+  Handle element = pystore->Value(value);
+  if (element.IsError()) return -1;
+  *array()->at(pos(index)) = element;
+  pystore->store->Remember(handle());
   return 0;
 }
 
@@ -0,0 +1,133 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/pyapi/pyinverse.h"
+
+#include <vector>
+
+#include "sling/pyapi/pystore.h"
+
+namespace sling {
+
+// Python type declarations.
+PyTypeObject PyInverseIndex::type;
+PyMethodTable PyInverseIndex::methods;
+
+void PyInverseIndex::Define(PyObject *module) {
+  InitType(&type, "sling.api.InverseIndex", sizeof(PyInverseIndex), true);
+
+  type.tp_init = method_cast<initproc>(&PyInverseIndex::Init);
+  type.tp_dealloc = method_cast<destructor>(&PyInverseIndex::Dealloc);
+
+  methods.Add("lookup", &PyInverseIndex::Lookup);
+  methods.Add("save", &PyInverseIndex::Save);
+  type.tp_methods = methods.table();
+
+  RegisterType(&type, module, "InverseIndex");
+}
+
+int PyInverseIndex::Init(PyObject *args, PyObject *kwds) {
+  // Get store and either list of roles or index file name.
+  index = nullptr;
+  pystore = nullptr;
+  PyObject *store = nullptr;
+  PyObject *source = nullptr;
+  int threads = 0;
+  if (!PyArg_ParseTuple(args, "OO|i", &store, &source, &threads)) return -1;
+  if (!PyObject_TypeCheck(store, &PyStore::type)) {
+    PyErr_SetString(PyExc_TypeError, "Store expected");
+    return -1;
+  }
+  pystore = reinterpret_cast<PyStore *>(store);
+  Py_INCREF(pystore);
+  index = new InverseIndex();
+
+  Status st;
+  if (PyString_Check(source)) {
+    // Load index from file.
+    st = index->Read(pystore->store, PyString_AsString(source));
+  } else if (PyList_Check(source)) {
+    // Build index for roles. Only frozen stores can be indexed.
+    if (!pystore->store->frozen()) {
+      PyErr_SetString(PyExc_ValueError, "Store is not frozen");
+      return -1;
+    }
+    std::vector<Handle> roles;
+    int size = PyList_Size(source);
+    for (int i = 0; i < size; ++i) {
+      Handle role = pystore->RoleValue(PyList_GetItem(source, i), true);
+      if (role.IsError()) return -1;
+      if (!role.IsNil()) roles.push_back(role);
+    }
+    st = index->Build(pystore->store, roles, threads);
+  } else {
+    PyErr_SetString(PyExc_ValueError, "List of roles or file name expected");
+    return -1;
+  }
+  if (!st.ok()) {
+    PyErr_SetString(PyExc_IOError, st.message());
+    return -1;
+  }
+
+  return 0;
+}
+
+void PyInverseIndex::Dealloc() {
+  delete index;
+  if (pystore != nullptr) Py_DECREF(pystore);
+  Free();
+}
+
+PyObject *PyInverseIndex::Lookup(PyObject *args) {
+  // Get target and optional role.
+  PyObject *target_arg = nullptr;
+  PyObject *role_arg = nullptr;
+  if (!PyArg_ParseTuple(args, "O|O", &target_arg, &role_arg)) return nullptr;
+  Handle target = pystore->RoleValue(target_arg, true);
+  if (target.IsError()) return nullptr;
+
+  // Look up frames in index.
+  InverseIndex::Range frames(nullptr, nullptr);
+  if (role_arg == nullptr || role_arg == Py_None) {
+    frames = index->Lookup(target);
+  } else {
+    Handle role = pystore->RoleValue(role_arg, true);
+    if (role.IsError()) return nullptr;
+    frames = index->Lookup(target, role);
+  }
+
+  // Create list of matching frames.
+  PyObject *result = PyList_New(frames.size());
+  for (int i = 0; i < frames.size(); ++i) {
+    PyList_SetItem(result, i, pystore->PyValue(frames[i]));
+  }
+
+  return result;
+}
+
+PyObject *PyInverseIndex::Save(PyObject *args) {
+  // Get file name.
+  const char *filename = nullptr;
+  if (!PyArg_ParseTuple(args, "s", &filename)) return nullptr;
+
+  // Write index to file.
+  Status st = index->Write(filename);
+  if (!st.ok()) {
+    PyErr_SetString(PyExc_IOError, st.message());
+    return nullptr;
+  }
+  Py_RETURN_NONE;
+}
+
+}  // namespace sling
@@ -0,0 +1,53 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_PYAPI_PYINVERSE_H_
+#define SLING_PYAPI_PYINVERSE_H_
+
+#include "sling/frame/inverse-index.h"
+#include "sling/pyapi/pybase.h"
+#include "sling/pyapi/pystore.h"
+
+namespace sling {
+
+// Python wrapper for inverse index.
+struct PyInverseIndex : public PyBase {
+  // Initialize inverse index wrapper. The index is either built for a list of
+  // roles or loaded from a file.
+  int Init(PyObject *args, PyObject *kwds);
+
+  // Deallocate inverse index wrapper.
+  void Dealloc();
+
+  // Look up frames pointing to target, optionally only through one role.
+  PyObject *Lookup(PyObject *args);
+
+  // Save inverse index to file.
+  PyObject *Save(PyObject *args);
+
+  // Inverse index.
+  InverseIndex *index;
+
+  // Store for frames.
+  PyStore *pystore = nullptr;
+
+  // Registration.
+  static PyTypeObject type;
+  static PyMethodTable methods;
+  static void Define(PyObject *module);
+};
+
+}  // namespace sling
+
+#endif  // SLING_PYAPI_PYINVERSE_H_
@@ -149,6 +149,7 @@ void PyRecordDatabase::Define(PyObject *module) {
 
   methods.Add("close", &PyRecordDatabase::Close);
   methods.AddO("lookup", &PyRecordDatabase::Lookup);
+  methods.AddO("lookup_batch", &PyRecordDatabase::LookupBatch);
   type.tp_methods = methods.table();
 
   RegisterType(&type, module, "RecordDatabase");
@@ -200,6 +201,38 @@ PyObject *PyRecordDatabase::Lookup(PyObject *obj) {
   return PyString_FromStringAndSize(record.value.data(), record.value.size());
 }
 
+PyObject *PyRecordDatabase::LookupBatch(PyObject *obj) {
+  // Get keys.
+  if (!PyList_Check(obj)) {
+    PyErr_SetString(PyExc_TypeError, "List of keys expected");
+    return nullptr;
+  }
+  int size = PyList_Size(obj);
+  std::vector<Slice> keys(size);
+  for (int i = 0; i < size; ++i) {
+    PyObject *item = PyList_GetItem(obj, i);
+    char *data;
+    Py_ssize_t length;
+    if (PyString_AsStringAndSize(item, &data, &length) == -1) return nullptr;
+    keys[i] = Slice(data, length);
+  }
+
+  // Look up records. Keys that are not found have None as value.
+  CHECK(db != nullptr);
+  PyObject *result = PyList_New(size);
+  for (int i = 0; i < size; ++i) {
+    Py_INCREF(Py_None);
+    PyList_SetItem(result, i, Py_None);
+  }
+  RecordReadBuffers buffers;
+  db->LookupBatch(keys, &buffers, [result](int index, const Record &record) {
+    PyObject *value = PyString_FromStringAndSize(record.value.data(),
+                                                 record.value.size());
+    PyList_SetItem(result, index, value);
+  });
+  return result;
+}
+
 void PyRecordWriter::Define(PyObject *module) {
   InitType(&type, "sling.RecordWriter", sizeof(PyRecordWriter), true);
 
@@ -217,13 +250,15 @@ void PyRecordWriter::Define(PyObject *module) {
 int PyRecordWriter::Init(PyObject *args, PyObject *kwds) {
   // Get arguments.
   static const char *kwlist[] = {
-      "filename", "bufsize", "chunksize", "compression", "index", nullptr};
+      "filename", "bufsize", "chunksize", "compression", "index", "bloom",
+      nullptr};
   char *filename = nullptr;
   RecordFileOptions options;
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|iiib",
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|iiibi",
           const_cast<char **>(kwlist),
           &filename, &options.buffer_size, &options.chunk_size,
-          &options.compression, &options.indexed)) return -1;
+          &options.compression, &options.indexed,
+          &options.bloom_bits_per_key)) return -1;
 
   // Open file.
   File *f;
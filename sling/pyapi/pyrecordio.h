@@ -72,6 +72,9 @@ struct PyRecordDatabase : public PyBase {
   // Look up record in database.
   PyObject *Lookup(PyObject *obj);
 
+  // Look up records for a list of keys in database.
+  PyObject *LookupBatch(PyObject *obj);
+
   // Close record database.
   PyObject *Close();
 
@@ -14,13 +14,12 @@
 
 #include "sling/pyapi/pywiki.h"
 
+#include "sling/frame/json-parser.h"
 #include "sling/frame/object.h"
-#include "sling/frame/reader.h"
 #include "sling/frame/serialization.h"
 #include "sling/frame/store.h"
 #include "sling/pyapi/pyarray.h"
 #include "sling/pyapi/pyframe.h"
-#include "sling/stream/memory.h"
 
 namespace sling {
 
@@ -69,13 +68,10 @@ PyObject *PyWikiConverter::ConvertWikidata(PyObject *args, PyObject *kw) {
   if (!PyObject_TypeCheck(pystore, &PyStore::type)) return nullptr;
 
   // Parse JSON.
-  ArrayInputStream stream(json, strlen(json));
-  Input input(&stream);
-  Reader reader(pystore->store, &input);
-  reader.set_json(true);
-  Object obj = reader.Read();
-  if (reader.error()) {
-    PyErr_SetString(PyExc_ValueError, reader.error_message().c_str());
+  JSONParser parser(pystore->store);
+  Object obj = parser.Parse(json);
+  if (parser.error()) {
+    PyErr_SetString(PyExc_ValueError, parser.error_message().c_str());
     return nullptr;
   }
   if (!obj.valid() || !obj.IsFrame()) {
@@ -135,20 +135,22 @@ FileOutputStream::~FileOutputStream() {
 }
 
 bool FileOutputStream::Close() {
+  bool ok = true;
   if (file_ != nullptr) {
     // Flush buffer.
     if (used_ > 0) {
-      if (!file_->Write(buffer_, used_).ok()) return false;
+      if (!file_->Write(buffer_, used_).ok()) ok = false;
       position_ += used_;
       used_ = 0;
     }
 
-    // Close file.
-    if (!file_->Close().ok()) return false;
+    // Close file. The file object is deleted even if closing fails, so the
+    // stream is closed after the first call.
+    if (!file_->Close().ok()) ok = false;
     file_ = nullptr;
   }
 
-  return true;
+  return ok;
 }
 
 bool FileOutputStream::Next(void **data, int *size) {
@@ -55,7 +55,7 @@ class Input {
   // input buffer, a pointer to the data is returned. Otherwise the data must be
   // read using the Read() method.
   bool TryRead(int size, const char **data) {
-    if (current_ + size < limit_) {
+    if (current_ + size <= limit_) {
       *data = current_;
       current_ += size;
       return true;
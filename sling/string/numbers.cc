@@ -1077,6 +1077,289 @@ char *FloatToBuffer(float value, char *buffer) {
   return buffer;
 }
 
+// ----------------------------------------------------------------------
+// FastFloatToBufferLeft()
+//    The shortest decimal representation is computed with the Ryu algorithm
+//    by Ulf Adams, "Ryu: fast float-to-string conversion", PLDI 2018. The
+//    tables contain the 5^i and 5^-i multipliers shifted to 61 and 59 bits.
+// ----------------------------------------------------------------------
+
+static const int kFloatPow5InvBits = 59;
+static const uint64 kFloatPow5InvSplit[31] = {
+    576460752303423489ULL, 461168601842738791ULL, 368934881474191033ULL,
+    295147905179352826ULL, 472236648286964522ULL, 377789318629571618ULL,
+    302231454903657294ULL, 483570327845851670ULL, 386856262276681336ULL,
+    309485009821345069ULL, 495176015714152110ULL, 396140812571321688ULL,
+    316912650057057351ULL, 507060240091291761ULL, 405648192073033409ULL,
+    324518553658426727ULL, 519229685853482763ULL, 415383748682786211ULL,
+    332306998946228969ULL, 531691198313966350ULL, 425352958651173080ULL,
+    340282366920938464ULL, 544451787073501542ULL, 435561429658801234ULL,
+    348449143727040987ULL, 557518629963265579ULL, 446014903970612463ULL,
+    356811923176489971ULL, 570899077082383953ULL, 456719261665907162ULL,
+    365375409332725730ULL
+};
+
+static const int kFloatPow5Bits = 61;
+static const uint64 kFloatPow5Split[47] = {
+    1152921504606846976ULL, 1441151880758558720ULL, 1801439850948198400ULL,
+    2251799813685248000ULL, 1407374883553280000ULL, 1759218604441600000ULL,
+    2199023255552000000ULL, 1374389534720000000ULL, 1717986918400000000ULL,
+    2147483648000000000ULL, 1342177280000000000ULL, 1677721600000000000ULL,
+    2097152000000000000ULL, 1310720000000000000ULL, 1638400000000000000ULL,
+    2048000000000000000ULL, 1280000000000000000ULL, 1600000000000000000ULL,
+    2000000000000000000ULL, 1250000000000000000ULL, 1562500000000000000ULL,
+    1953125000000000000ULL, 1220703125000000000ULL, 1525878906250000000ULL,
+    1907348632812500000ULL, 1192092895507812500ULL, 1490116119384765625ULL,
+    1862645149230957031ULL, 1164153218269348144ULL, 1455191522836685180ULL,
+    1818989403545856475ULL, 2273736754432320594ULL, 1421085471520200371ULL,
+    1776356839400250464ULL, 2220446049250313080ULL, 1387778780781445675ULL,
+    1734723475976807094ULL, 2168404344971008868ULL, 1355252715606880542ULL,
+    1694065894508600678ULL, 2117582368135750847ULL, 1323488980084844279ULL,
+    1654361225106055349ULL, 2067951531382569187ULL, 1292469707114105741ULL,
+    1615587133892632177ULL, 2019483917365790221ULL
+};
+
+// Returns ceil(log2(5^e)) for e > 0 and 1 for e = 0.
+static inline int32 Pow5Bits(int32 e) {
+  return ((e * 1217359) >> 19) + 1;
+}
+
+// Returns floor(log10(2^e)).
+static inline int32 Log10Pow2(int32 e) {
+  return (e * 78913) >> 18;
+}
+
+// Returns floor(log10(5^e)).
+static inline int32 Log10Pow5(int32 e) {
+  return (e * 732923) >> 20;
+}
+
+// Returns true if value is divisible by 5^p.
+static inline bool MultipleOfPowerOf5(uint32 value, uint32 p) {
+  uint32 count = 0;
+  while (value % 5 == 0) {
+    value /= 5;
+    count++;
+  }
+  return count >= p;
+}
+
+// Returns true if value is divisible by 2^p.
+static inline bool MultipleOfPowerOf2(uint32 value, uint32 p) {
+  return (value & ((1u << p) - 1)) == 0;
+}
+
+// Returns (m * factor) >> shift for shift > 32.
+static inline uint32 MulShift(uint32 m, uint64 factor, int32 shift) {
+  uint64 lo = static_cast<uint64>(m) * static_cast<uint32>(factor);
+  uint64 hi = static_cast<uint64>(m) * static_cast<uint32>(factor >> 32);
+  return static_cast<uint32>(((lo >> 32) + hi) >> (shift - 32));
+}
+
+// Computes the shortest decimal digits and exponent for a finite, non-zero
+// float with the mantissa and exponent bits.
+static void FloatToDecimal(uint32 mantissa, uint32 exponent,
+                           uint32 *digits, int32 *exponent10) {
+  // Decode float into m2 * 2^e2. The mantissa is multiplied by four so the
+  // bounds of the rounding interval are integers too.
+  int32 e2;
+  uint32 m2;
+  if (exponent == 0) {
+    e2 = 1 - 127 - 23 - 2;
+    m2 = mantissa;
+  } else {
+    e2 = exponent - 127 - 23 - 2;
+    m2 = (1u << 23) | mantissa;
+  }
+  bool accept_bounds = (m2 & 1) == 0;
+
+  // Compute the interval of values that round to the float.
+  uint32 mv = 4 * m2;
+  uint32 mp = 4 * m2 + 2;
+  uint32 mm_shift = mantissa != 0 || exponent <= 1;
+  uint32 mm = 4 * m2 - 1 - mm_shift;
+
+  // Convert the interval to a decimal power base.
+  uint32 vr, vp, vm;
+  int32 e10;
+  bool vm_trailing_zeros = false;
+  bool vr_trailing_zeros = false;
+  uint32 last_removed_digit = 0;
+  if (e2 >= 0) {
+    uint32 q = Log10Pow2(e2);
+    e10 = q;
+    int32 k = kFloatPow5InvBits + Pow5Bits(q) - 1;
+    int32 i = -e2 + q + k;
+    vr = MulShift(mv, kFloatPow5InvSplit[q], i);
+    vp = MulShift(mp, kFloatPow5InvSplit[q], i);
+    vm = MulShift(mm, kFloatPow5InvSplit[q], i);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      // One removed digit is needed for rounding even if the loop below is
+      // not run.
+      int32 l = kFloatPow5InvBits + Pow5Bits(q - 1) - 1;
+      last_removed_digit =
+          MulShift(mv, kFloatPow5InvSplit[q - 1], -e2 + q - 1 + l) % 10;
+    }
+    if (q <= 9) {
+      // Only one of mp, mv, and mm can be a multiple of 5, if any.
+      if (mv % 5 == 0) {
+        vr_trailing_zeros = MultipleOfPowerOf5(mv, q);
+      } else if (accept_bounds) {
+        vm_trailing_zeros = MultipleOfPowerOf5(mm, q);
+      } else {
+        vp -= MultipleOfPowerOf5(mp, q);
+      }
+    }
+  } else {
+    uint32 q = Log10Pow5(-e2);
+    e10 = q + e2;
+    int32 i = -e2 - q;
+    int32 k = Pow5Bits(i) - kFloatPow5Bits;
+    int32 j = q - k;
+    vr = MulShift(mv, kFloatPow5Split[i], j);
+    vp = MulShift(mp, kFloatPow5Split[i], j);
+    vm = MulShift(mm, kFloatPow5Split[i], j);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      j = q - 1 - (Pow5Bits(i + 1) - kFloatPow5Bits);
+      last_removed_digit = MulShift(mv, kFloatPow5Split[i + 1], j) % 10;
+    }
+    if (q <= 1) {
+      // mv = 4 * m2 always has at least two trailing zero bits.
+      vr_trailing_zeros = true;
+      if (accept_bounds) {
+        vm_trailing_zeros = mm_shift == 1;
+      } else {
+        --vp;
+      }
+    } else if (q < 31) {
+      vr_trailing_zeros = MultipleOfPowerOf2(mv, q - 1);
+    }
+  }
+
+  // Remove digits while the interval contains more than one candidate.
+  int32 removed = 0;
+  uint32 output;
+  if (vm_trailing_zeros || vr_trailing_zeros) {
+    // General case, which is rare.
+    while (vp / 10 > vm / 10) {
+      vm_trailing_zeros &= vm % 10 == 0;
+      vr_trailing_zeros &= last_removed_digit == 0;
+      last_removed_digit = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    if (vm_trailing_zeros) {
+      while (vm % 10 == 0) {
+        vr_trailing_zeros &= last_removed_digit == 0;
+        last_removed_digit = vr % 10;
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        removed++;
+      }
+    }
+    if (vr_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0) {
+      // Round to even if the exact number is .....50..0.
+      last_removed_digit = 4;
+    }
+    output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) ||
+                   last_removed_digit >= 5);
+  } else {
+    // Common case.
+    while (vp / 10 > vm / 10) {
+      last_removed_digit = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    output = vr + (vr == vm || last_removed_digit >= 5);
+  }
+
+  *digits = output;
+  *exponent10 = e10 + removed;
+}
+
+char *FastFloatToBufferLeft(float value, char *buffer) {
+  uint32 bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint32 mantissa = bits & ((1u << 23) - 1);
+  uint32 exponent = (bits >> 23) & 0xff;
+  bool negative = (bits >> 31) != 0;
+
+  // Handle special values.
+  char *p = buffer;
+  if (exponent == 0xff) {
+    if (mantissa != 0) {
+      memcpy(p, "nan", 4);
+      return p + 3;
+    }
+    if (negative) *p++ = '-';
+    memcpy(p, "inf", 4);
+    return p + 3;
+  }
+  if (negative) *p++ = '-';
+  if (exponent == 0 && mantissa == 0) {
+    *p++ = '0';
+    *p = '\0';
+    return p;
+  }
+
+  // Compute shortest digits.
+  uint32 output;
+  int32 e10;
+  FloatToDecimal(mantissa, exponent, &output, &e10);
+  char digits[16];
+  char *end = FastUInt32ToBufferLeft(output, digits);
+  int n = end - digits;
+
+  // Output the digits in fixed notation if the decimal exponent is small and
+  // in exponential notation otherwise. Like FloatToBuffer(), the exponent
+  // limit is the %g precision, i.e. FLT_DIG digits if these are enough to
+  // round-trip and FLT_DIG+2 digits otherwise.
+  int x = e10 + n - 1;
+  int precision = n <= FLT_DIG ? FLT_DIG : FLT_DIG + 2;
+  if (x < -4 || x >= precision) {
+    *p++ = digits[0];
+    if (n > 1) {
+      *p++ = '.';
+      memcpy(p, digits + 1, n - 1);
+      p += n - 1;
+    }
+    *p++ = 'e';
+    if (x < 0) {
+      *p++ = '-';
+      x = -x;
+    } else {
+      *p++ = '+';
+    }
+    if (x < 10) *p++ = '0';
+    p = FastUInt32ToBufferLeft(x, p);
+  } else if (x < 0) {
+    *p++ = '0';
+    *p++ = '.';
+    for (int i = -1; i > x; --i) *p++ = '0';
+    memcpy(p, digits, n);
+    p += n;
+    *p = '\0';
+  } else if (n <= x + 1) {
+    memcpy(p, digits, n);
+    p += n;
+    for (int i = n; i <= x; ++i) *p++ = '0';
+    *p = '\0';
+  } else {
+    memcpy(p, digits, x + 1);
+    p += x + 1;
+    *p++ = '.';
+    memcpy(p, digits + x + 1, n - x - 1);
+    p += n - x - 1;
+    *p = '\0';
+  }
+  return p;
+}
+
 // ----------------------------------------------------------------------
 // SimpleItoaWithCommas()
 //    Description: converts an integer to a string.
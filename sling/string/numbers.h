@@ -439,6 +439,23 @@ char *FloatToBuffer(float i, char *buffer);
 static const int kDoubleToBufferSize = 32;
 static const int kFloatToBufferSize = 24;
 
+// ----------------------------------------------------------------------
+// FastFloatToBufferLeft()
+//    Description: converts a float to the shortest string which, if
+//    passed to strtof(), will produce the exact same original float. The
+//    digits are computed with the Ryu algorithm using only integer
+//    arithmetic, which is much faster than FloatToBuffer(). Exponential
+//    notation is used for the same numbers as in FloatToBuffer(), but the
+//    last digit can differ when FloatToBuffer() outputs more digits than
+//    needed. NaN and infinity are output as "nan" and "inf".
+//
+//    The buffer must be at least kFloatToBufferSize bytes. Returns a
+//    pointer to the end of the string (i.e. the nul character terminating
+//    the string).
+// ----------------------------------------------------------------------
+
+char *FastFloatToBufferLeft(float value, char *buffer);
+
 // ----------------------------------------------------------------------
 // SimpleItoaWithCommas()
 //    Description: converts an integer to a string.
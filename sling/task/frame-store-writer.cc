@@ -31,7 +31,8 @@ class FrameStoreWriter : public Processor {
   ~FrameStoreWriter() { delete store_; }
 
   void Start(Task *task) override {
-    // Create store.
+    // Create store. Large stores can be garbage collected in parallel.
+    options_.gc_threads = task->Get("gc_threads", 1);
     store_ = new Store(&options_);
 
     // Suppressing garbage collection can make store updates faster at the
@@ -55,8 +56,13 @@ class FrameStoreWriter : public Processor {
     CHECK(file != nullptr);
 
     // Compact store.
-    store_->CoalesceStrings();
+    store_->CoalesceStrings(task->Get("coalesce_threads", 0));
     store_->GC();
+    MemoryUsage usage;
+    store_->GetMemoryUsage(&usage, true);
+    task->GetCounter("strings_coalesced")->Increment(
+        usage.num_coalesced_strings);
+    task->GetCounter("bytes_coalesced")->Increment(usage.coalesced_bytes);
 
     // Save store to output file.
     LOG(INFO) << "Saving store to " << file->resource()->name();
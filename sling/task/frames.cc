@@ -14,11 +14,17 @@
 
 #include "sling/task/frames.h"
 
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "sling/base/logging.h"
 #include "sling/frame/encoder.h"
 #include "sling/frame/decoder.h"
 #include "sling/frame/object.h"
 #include "sling/frame/reader.h"
+#include "sling/frame/serialization.h"
 #include "sling/frame/store.h"
 #include "sling/frame/wire.h"
 #include "sling/stream/file.h"
@@ -28,14 +34,23 @@
 namespace sling {
 namespace task {
 
+FrameProcessor::~FrameProcessor() {
+  for (Store *store : stores_) delete store;
+  delete dictionary_;
+  delete commons_;
+}
+
 void FrameProcessor::Start(Task *task) {
   // Create commons store.
   commons_ = new Store();
 
-  // Load commons store from file.
+  // Load commons store from files. Multiple files and record files are
+  // decoded in parallel.
+  std::vector<string> files;
   for (Binding *binding : task->GetInputs("commons")) {
-    LoadStore(commons_, binding->resource());
+    files.push_back(binding->resource()->name());
   }
+  LoadStores(files, commons_, task->Get("load_threads", 0));
 
   // Get output channel (optional).
   output_ = task->GetSink("output");
@@ -50,6 +65,14 @@ void FrameProcessor::Start(Task *task) {
   // Freeze commons store.
   commons_->Freeze();
 
+  // Build shared symbol dictionary for commons store. Both the producer and
+  // the consumer of the messages must enable this and use the same commons.
+  if (task->Get("symbol_dictionary", false)) {
+    dictionary_ = new SymbolDictionary(commons_);
+    VLOG(1) << "Symbol dictionary with " << dictionary_->size()
+            << " symbols, fingerprint " << dictionary_->fingerprint();
+  }
+
   // Update statistics for common store.
   MemoryUsage usage;
   commons_->GetMemoryUsage(&usage, true);
@@ -58,6 +81,9 @@ void FrameProcessor::Start(Task *task) {
   task->GetCounter("commons_symbols")->Increment(usage.num_symbols());
   task->GetCounter("commons_gcs")->Increment(usage.num_gcs);
   task->GetCounter("commons_gctime")->Increment(usage.gc_time);
+  if (task->Get("memory_profile", false)) {
+    AddMemoryProfileCounters(task, "commons", commons_);
+  }
 
   // Get counters for frame stores.
   frame_memory_ = task->GetCounter("frame_memory");
@@ -68,25 +94,43 @@ void FrameProcessor::Start(Task *task) {
 }
 
 void FrameProcessor::Receive(Channel *channel, Message *message) {
-  // Create store for frame.
-  Store store(commons_);
+  // Get store for frame from the pool or create a new one.
+  Store *store = nullptr;
+  {
+    MutexLock lock(&mu_);
+    if (!stores_.empty()) {
+      store = stores_.back();
+      stores_.pop_back();
+    }
+  }
+  if (store == nullptr) store = new Store(commons_);
 
-  // Decode frame from message.
-  Frame frame = DecodeMessage(&store, message);
-  CHECK(frame.valid());
+  {
+    // Decode frame from message. The message is deleted after the store has
+    // been reset, so strings can be borrowed from the message.
+    Frame frame = DecodeMessage(store, message, true, dictionary_);
+    CHECK(frame.valid());
 
-  // Process frame.
-  Process(message->key(), frame);
+    // Process frame.
+    Process(message->key(), frame);
+  }
 
   // Update statistics.
   MemoryUsage usage;
-  store.GetMemoryUsage(&usage, true);
+  store->GetMemoryUsage(&usage, true);
   frame_memory_->Increment(usage.memory_used());
   frame_handles_->Increment(usage.used_handles());
   frame_symbols_->Increment(usage.num_symbols());
   frame_gcs_->Increment(usage.num_gcs);
   frame_gctime_->Increment(usage.gc_time);
 
+  // Clear store and return it to the pool.
+  store->Reset();
+  {
+    MutexLock lock(&mu_);
+    stores_.push_back(store);
+  }
+
   // Delete input message.
   delete message;
 }
@@ -95,29 +139,33 @@ void FrameProcessor::Done(Task *task) {
   // Flush output.
   Flush(task);
 
-  // Delete commons store.
+  // Delete local stores and commons store.
+  for (Store *store : stores_) delete store;
+  stores_.clear();
+  delete dictionary_;
+  dictionary_ = nullptr;
   delete commons_;
   commons_ = nullptr;
 }
 
 void FrameProcessor::Output(Text key, const Object &value) {
   CHECK(output_ != nullptr);
-  output_->Send(CreateMessage(key, value));
+  output_->Send(CreateMessage(key, value, false, dictionary_));
 }
 
 void FrameProcessor::Output(const Frame &value) {
   CHECK(output_ != nullptr);
-  output_->Send(CreateMessage(value));
+  output_->Send(CreateMessage(value, false, dictionary_));
 }
 
 void FrameProcessor::OutputShallow(Text key, const Object &value) {
   CHECK(output_ != nullptr);
-  output_->Send(CreateMessage(key, value, true));
+  output_->Send(CreateMessage(key, value, true, dictionary_));
 }
 
 void FrameProcessor::OutputShallow(const Frame &value) {
   CHECK(output_ != nullptr);
-  output_->Send(CreateMessage(value, true));
+  output_->Send(CreateMessage(value, true, dictionary_));
 }
 
 void FrameProcessor::InitCommons(Task *task) {}
@@ -125,25 +173,31 @@ void FrameProcessor::Startup(Task *task) {}
 void FrameProcessor::Process(Slice key, const Frame &frame) {}
 void FrameProcessor::Flush(Task *task) {}
 
-Message *CreateMessage(Text key, const Object &object, bool shallow) {
+Message *CreateMessage(Text key, const Object &object, bool shallow,
+                       const SymbolDictionary *dictionary) {
   ArrayOutputStream stream;
   Output output(&stream);
   Encoder encoder(object.store(), &output);
   encoder.set_shallow(shallow);
+  encoder.set_dictionary(dictionary);
   encoder.Encode(object);
   output.Flush();
   return new Message(Slice(key.data(), key.size()), stream.data());
 }
 
-Message *CreateMessage(const Frame &frame, bool shallow) {
-  return CreateMessage(frame.Id(), frame, shallow);
+Message *CreateMessage(const Frame &frame, bool shallow,
+                       const SymbolDictionary *dictionary) {
+  return CreateMessage(frame.Id(), frame, shallow, dictionary);
 }
 
-Frame DecodeMessage(Store *store, Message *message) {
+Frame DecodeMessage(Store *store, Message *message, bool borrow,
+                    const SymbolDictionary *dictionary) {
   ArrayInputStream stream(message->value().data(), message->value().size());
   Input input(&stream);
   if (input.Peek() == WIRE_BINARY_MARKER) {
     Decoder decoder(store, &input);
+    decoder.set_borrow_strings(borrow);
+    decoder.set_dictionary(dictionary);
     return decoder.Decode().AsFrame();
   } else {
     Reader reader(store, &input);
@@ -168,6 +222,52 @@ void LoadStore(Store *store, Resource *file) {
   store->UnlockGC();
 }
 
+void AddMemoryProfileCounters(Task *task, const string &prefix,
+                              const Store *store, int namespaces) {
+  MemoryProfile profile;
+  store->GetMemoryProfile(&profile);
+  auto add = [task, &prefix](const string &name,
+                             const MemoryProfile::Stats &stats) {
+    task->GetCounter(prefix + "_" + name + "_objects")->
+        Increment(stats.objects);
+    task->GetCounter(prefix + "_" + name + "_bytes")->Increment(stats.bytes);
+  };
+
+  // Object types.
+  add("strings", profile.strings);
+  add("symbols", profile.symbols);
+  add("arrays", profile.arrays);
+  add("frames", profile.frames);
+  add("proxies", profile.proxies);
+  add("invalid", profile.invalid);
+  add("garbage", profile.garbage);
+  task->GetCounter(prefix + "_borrowed_bytes")->
+      Increment(profile.borrowed_bytes);
+
+  // Frame sizes.
+  for (int b = 0; b < MemoryProfile::kSlotBuckets; ++b) {
+    if (profile.slots[b].objects == 0) continue;
+    add("slots_" + MemoryProfile::SlotRange(b, "_", "plus"), profile.slots[b]);
+  }
+
+  // Namespaces with the most memory.
+  std::vector<std::pair<string, MemoryProfile::Stats>> ns(
+      profile.namespaces.begin(), profile.namespaces.end());
+  std::sort(ns.begin(), ns.end(),
+    [](const std::pair<string, MemoryProfile::Stats> &a,
+       const std::pair<string, MemoryProfile::Stats> &b) {
+      return a.second.bytes > b.second.bytes;
+    });
+  if (ns.size() > namespaces) ns.resize(namespaces);
+  for (auto &it : ns) {
+    string name;
+    for (char c : it.first) {
+      if (c != '/') name.push_back(c);
+    }
+    if (name.empty()) name = "other";
+    add("ns_" + name, it.second);
+  }
+}
+
 }  // namespace task
 }  // namespace sling
-
@@ -15,9 +15,13 @@
 #ifndef SLING_TASK_FRAMES_H_
 #define SLING_TASK_FRAMES_H_
 
+#include <vector>
+
 #include "sling/frame/object.h"
+#include "sling/frame/symbol-dictionary.h"
 #include "sling/task/message.h"
 #include "sling/task/task.h"
+#include "sling/util/mutex.h"
 
 namespace sling {
 namespace task {
@@ -25,7 +29,7 @@ namespace task {
 // Task processor for receiving and sending frames.
 class FrameProcessor : public Processor {
  public:
-  ~FrameProcessor() { delete commons_; }
+  ~FrameProcessor();
 
   // Task processor implementation.
   void Start(Task *task) override;
@@ -61,12 +65,23 @@ class FrameProcessor : public Processor {
   // Commons store for messages.
   Store *commons_ = nullptr;
 
+  // Shared symbol dictionary for the commons store (optional). If enabled,
+  // links to frames in the commons store are encoded as dictionary numbers
+  // in output messages and decoded from dictionary numbers in input messages.
+  SymbolDictionary *dictionary_ = nullptr;
+
   // Name bindings.
   Names names_;
 
   // Output channel (optional).
   Channel *output_;
 
+  // Local stores for decoding and processing frames. Each worker thread takes
+  // a store from the pool while processing a message and resets it afterwards
+  // so the memory for the store can be reused for the next message.
+  std::vector<Store *> stores_;
+  Mutex mu_;
+
   // Statistics.
   Counter *frame_memory_;
   Counter *frame_handles_;
@@ -75,18 +90,32 @@ class FrameProcessor : public Processor {
   Counter *frame_gctime_;
 };
 
-// Create message from object.
-Message *CreateMessage(Text key, const Object &Object, bool shallow = false);
+// Create message from object. If a symbol dictionary is given, links to
+// frames in the dictionary are encoded as dictionary numbers, and the message
+// can only be decoded with the same dictionary.
+Message *CreateMessage(Text key, const Object &Object, bool shallow = false,
+                       const SymbolDictionary *dictionary = nullptr);
 
 // Create message with encoded frame using frame id as key.
-Message *CreateMessage(const Frame &frame, bool shallow = false);
+Message *CreateMessage(const Frame &frame, bool shallow = false,
+                       const SymbolDictionary *dictionary = nullptr);
 
-// Decode message as frame.
-Frame DecodeMessage(Store *store, Message *message);
+// Decode message as frame. If borrow is true, large strings in binary encoded
+// messages borrow their string data from the message, so the message must not
+// be deleted before the store is reset or the borrowed strings are copied.
+// The symbol dictionary is needed for decoding messages encoded with one.
+Frame DecodeMessage(Store *store, Message *message, bool borrow = false,
+                    const SymbolDictionary *dictionary = nullptr);
 
 // Load repository into store from input file.
 void LoadStore(Store *store, Resource *file);
 
+// Add counters to task with detailed memory profile for store. The counter
+// names start with the prefix followed by the object type, frame size range,
+// or id namespace. Only the namespaces using the most memory are reported.
+void AddMemoryProfileCounters(Task *task, const string &prefix,
+                              const Store *store, int namespaces = 20);
+
 }  // namespace task
 }  // namespace sling
 
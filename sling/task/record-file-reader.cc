@@ -44,6 +44,7 @@ class RecordFileReader : public Process {
     // Open input file.
     RecordFileOptions options;
     options.buffer_size = task->Get("buffer_size", options.buffer_size);
+    options.memory_map = task->Get("memory_map", options.memory_map);
     RecordReader reader(input->resource()->name(), options);
 
     // Statistics counters.
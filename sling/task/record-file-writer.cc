@@ -36,6 +36,10 @@ class RecordFileWriter : public Processor {
     // Open record file writer.
     RecordFileOptions options;
     if (task->Get("indexed", false)) options.indexed = true;
+    options.bloom_bits_per_key = task->Get("bloom_bits_per_key", 0);
+    if (task->Get("block_compression", false)) {
+      options.compression = RecordFile::BLOCK_SNAPPY;
+    }
     writer_ = new RecordWriter(output->resource()->name(), options);
   }
 
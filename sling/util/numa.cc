@@ -0,0 +1,163 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/util/numa.h"
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <algorithm>
+#include <vector>
+
+namespace sling {
+
+// Maximum number of NUMA nodes supported in node masks.
+static const int kMaxNodes = 1024;
+static const int kMaskWords = kMaxNodes / (8 * sizeof(unsigned long));
+
+// Reads a list of numbers and ranges, e.g. 0-3,8,10-11, from a sysfs file.
+static std::vector<int> ReadList(const char *filename) {
+  std::vector<int> list;
+  FILE *f = fopen(filename, "r");
+  if (f == nullptr) return list;
+  char buffer[4096];
+  if (fgets(buffer, sizeof(buffer), f) != nullptr) {
+    char *p = buffer;
+    while (*p >= '0' && *p <= '9') {
+      int first = strtol(p, &p, 10);
+      int last = first;
+      if (*p == '-') last = strtol(p + 1, &p, 10);
+      for (int n = first; n <= last; ++n) list.push_back(n);
+      if (*p == ',') p++;
+    }
+  }
+  fclose(f);
+  return list;
+}
+
+// Adds node to node mask.
+static void AddNode(unsigned long *mask, int node) {
+  const int bits = 8 * sizeof(unsigned long);
+  mask[node / bits] |= 1UL << (node % bits);
+}
+
+// Sets memory policy for a memory range. The range is shrunk to whole pages.
+static bool SetPolicy(void *data, size_t size, int mode,
+                      const unsigned long *mask, unsigned flags) {
+#ifdef SYS_mbind
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+  uintptr_t end = begin + size;
+  begin = (begin + page - 1) & ~(page - 1);
+  end &= ~(page - 1);
+  if (end <= begin) return true;
+  return syscall(SYS_mbind, begin, end - begin, mode, mask, kMaxNodes + 1,
+                 flags) == 0;
+#else
+  return false;
+#endif
+}
+
+int NUMA::Nodes() {
+  static int nodes = [] {
+    std::vector<int> online = ReadList("/sys/devices/system/node/online");
+    if (online.empty()) return 1;
+    int last = *std::max_element(online.begin(), online.end());
+    return std::min(last + 1, kMaxNodes);
+  }();
+  return nodes;
+}
+
+int NUMA::CurrentNode() {
+  // Map from CPU to NUMA node read from sysfs. This is used with
+  // sched_getcpu(), which goes through the vDSO instead of making a system
+  // call, since this is called on request paths.
+  static const std::vector<int> *cpu_nodes = [] {
+    std::vector<int> *nodes = new std::vector<int>;
+    for (int node = 0; node < Nodes(); ++node) {
+      char filename[64];
+      snprintf(filename, sizeof(filename),
+               "/sys/devices/system/node/node%d/cpulist", node);
+      for (int cpu : ReadList(filename)) {
+        if (cpu >= static_cast<int>(nodes->size())) nodes->resize(cpu + 1);
+        (*nodes)[cpu] = node;
+      }
+    }
+    return nodes;
+  }();
+  if (cpu_nodes->empty()) return 0;
+  int cpu = sched_getcpu();
+  if (cpu < 0 || cpu >= static_cast<int>(cpu_nodes->size())) return 0;
+  return (*cpu_nodes)[cpu];
+}
+
+void *NUMA::Allocate(size_t size, int node) {
+  if (node < 0 || node >= kMaxNodes) return nullptr;
+  void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) return nullptr;
+
+  // Bind the memory to the node before the pages are touched, so the pages
+  // are allocated on the node.
+  unsigned long mask[kMaskWords];
+  memset(mask, 0, sizeof(mask));
+  AddNode(mask, node);
+  if (!SetPolicy(data, size, MPOL_BIND, mask, MPOL_MF_STRICT)) {
+    munmap(data, size);
+    return nullptr;
+  }
+  return data;
+}
+
+void NUMA::Free(void *data, size_t size) {
+  munmap(data, size);
+}
+
+bool NUMA::Bind(void *data, size_t size, int node) {
+  if (node < 0 || node >= kMaxNodes) return false;
+  unsigned long mask[kMaskWords];
+  memset(mask, 0, sizeof(mask));
+  AddNode(mask, node);
+  return SetPolicy(data, size, MPOL_BIND, mask, MPOL_MF_MOVE);
+}
+
+bool NUMA::Interleave(void *data, size_t size) {
+  unsigned long mask[kMaskWords];
+  memset(mask, 0, sizeof(mask));
+  for (int node : ReadList("/sys/devices/system/node/has_memory")) {
+    if (node < kMaxNodes) AddNode(mask, node);
+  }
+  return SetPolicy(data, size, MPOL_INTERLEAVE, mask, MPOL_MF_MOVE);
+}
+
+bool NUMA::RunOnNode(int node) {
+  char filename[64];
+  snprintf(filename, sizeof(filename),
+           "/sys/devices/system/node/node%d/cpulist", node);
+  std::vector<int> cpus = ReadList(filename);
+  if (cpus.empty()) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+}  // namespace sling
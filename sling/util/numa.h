@@ -0,0 +1,56 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_UTIL_NUMA_H_
+#define SLING_UTIL_NUMA_H_
+
+#include <stddef.h>
+
+namespace sling {
+
+// Memory placement on NUMA nodes. This uses the Linux memory policy system
+// calls directly, so it does not depend on libnuma. On systems without NUMA
+// support, there is a single node and the placement functions fail.
+class NUMA {
+ public:
+  // Returns the number of NUMA nodes. This is always at least one.
+  static int Nodes();
+
+  // Returns the NUMA node for the CPU the calling thread is running on.
+  static int CurrentNode();
+
+  // Allocates memory on a NUMA node. Returns null if the memory could not be
+  // allocated on the node. The memory must be released with Free().
+  static void *Allocate(size_t size, int node);
+
+  // Releases memory allocated with Allocate().
+  static void Free(void *data, size_t size);
+
+  // Moves the pages in the memory range to a NUMA node. Only the whole pages
+  // inside the range are moved. Returns false if the pages could not be moved.
+  static bool Bind(void *data, size_t size, int node);
+
+  // Interleaves the pages in the memory range over all NUMA nodes. Only the
+  // whole pages inside the range are moved. Returns false if the pages could
+  // not be interleaved.
+  static bool Interleave(void *data, size_t size);
+
+  // Restricts the calling thread to run on the CPUs of a NUMA node. Returns
+  // false if the CPUs for the node could not be determined.
+  static bool RunOnNode(int node);
+};
+
+}  // namespace sling
+
+#endif  // SLING_UTIL_NUMA_H_
@@ -0,0 +1,134 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Check that the changes in an overlay store survive a round trip through a
+// delta file.
+//
+// A small base store is saved as a snapshot and changed through an overlay
+// store. The changes include edits to anonymous base objects, i.e. a qualifier
+// and a frame inside an array, which are only reachable through the named
+// frames that refer to them. The delta is applied to a new overlay store, and
+// the frames in the two overlay stores are compared. Finally, a delta with
+// wrong change counts in the header must be rejected without changing the
+// overlay store.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/base/types.h"
+#include "sling/file/file.h"
+#include "sling/frame/object.h"
+#include "sling/frame/serialization.h"
+#include "sling/frame/snapshot.h"
+#include "sling/frame/store.h"
+
+DEFINE_string(dir, "/tmp", "Directory for snapshot and delta files");
+
+using namespace sling;
+
+// Frames in the base store.
+static const char *base_frames[] = {
+  "{=Q1 name: \"one\" P: {+Q5 q: 1}}",
+  "{=Q2 name: \"two\"}",
+  "{=Q3 name: \"three\" R: [{q: 1} {q: 2}]}",
+  "{=Q5 name: \"five\"}",
+};
+
+// Frames that are compared after the delta has been applied.
+static const char *ids[] = {"Q1", "Q2", "Q3", "Q4", "Q5"};
+
+// Load base store from snapshot.
+void LoadBase(Store *base, const string &filename) {
+  CHECK(Snapshot::Read(base, filename, true));
+}
+
+// Return text for frame in store, or an empty string if the id is not bound.
+string Dump(Store *store, const char *id) {
+  Handle handle = store->LookupExisting(id);
+  if (handle.IsNil()) return "";
+  return ToText(store, handle);
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+  string base = FLAGS_dir + "/deltas.sling";
+  string delta = FLAGS_dir + "/deltas.delta";
+
+  // Write base snapshot.
+  {
+    Store store;
+    for (const char *text : base_frames) FromText(&store, string(text));
+    store.Freeze();
+    CHECK(Snapshot::Write(&store, base));
+  }
+
+  // Change the base store through an overlay store and save the delta.
+  Store::Options options;
+  Store base1;
+  LoadBase(&base1, base);
+  Store overlay1(&options, &base1);
+  {
+    Frame q1(&overlay1, "Q1");
+    Frame qualifier(&overlay1, q1.GetHandle("P"));
+    qualifier.Set("q", 2);
+    Frame q3(&overlay1, "Q3");
+    Array values(&overlay1, q3.GetHandle("R"));
+    Frame element(&overlay1, values.get(1));
+    element.Set("q", 3);
+    Frame(&overlay1, "Q2").Set("name", "zwei");
+    FromText(&overlay1, string("{=Q4 name: \"four\" P: Q1}"));
+  }
+  overlay1.Freeze();
+  CHECK(Snapshot::WriteDelta(&overlay1, base, delta));
+
+  // Apply the delta to a new overlay store and compare the frames.
+  Store base2;
+  LoadBase(&base2, base);
+  Store overlay2(&options, &base2);
+  CHECK(Snapshot::ReadDelta(&overlay2, base, delta));
+  for (const char *id : ids) {
+    string expected = Dump(&overlay1, id);
+    string actual = Dump(&overlay2, id);
+    std::cout << actual << "\n";
+    CHECK(!expected.empty()) << id;
+    CHECK_EQ(expected, actual) << "Frame " << id << " differs after delta";
+  }
+  CHECK_NE(Dump(&base2, "Q1"), Dump(&overlay2, "Q1"));
+  CHECK_NE(Dump(&base2, "Q3"), Dump(&overlay2, "Q3"));
+
+  // Corrupt the number of added frames, which follows the magic, the version,
+  // and the base fingerprint in the delta header. The delta must be rejected
+  // and the overlay store must be left unchanged.
+  string data;
+  CHECK(File::ReadContents(delta, &data));
+  data[16]++;
+  CHECK(File::WriteContents(delta, data));
+  Store overlay3(&options, &base2);
+  Status st = Snapshot::ReadDelta(&overlay3, base, delta);
+  std::cout << "corrupt delta: " << st << "\n";
+  CHECK(!st.ok());
+  CHECK(!overlay3.frozen());
+  CHECK(overlay3.LookupExisting("Q4").IsNil());
+  CHECK_EQ(Dump(&base2, "Q2"), Dump(&overlay3, "Q2"));
+
+  CHECK(File::Delete(base + ".snap"));
+  CHECK(File::Delete(delta));
+  std::cout << "delta matches overlay store\n";
+
+  return 0;
+}
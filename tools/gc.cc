@@ -0,0 +1,187 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Check that parallel garbage collection gives the same store as serial
+// garbage collection.
+//
+// The same store is built twice, once with one GC thread and once with
+// --threads GC threads, and both stores are garbage collected. The live
+// objects reachable from the symbol table must have the same handles and
+// contents in both stores, and the handle free lists must hand out the same
+// handles in the same order. Only stores with more than 64 MB of heap objects
+// are collected in parallel. Without arguments, the check is run on a
+// synthetic store where a fraction of the objects is garbage.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/base/types.h"
+#include "sling/file/file.h"
+#include "sling/frame/object.h"
+#include "sling/frame/serialization.h"
+#include "sling/frame/store.h"
+
+DEFINE_int32(frames, 500000, "Number of frames in synthetic store");
+DEFINE_int32(garbage, 50, "Percentage of garbage objects in synthetic store");
+DEFINE_int32(threads, 4, "Number of threads for parallel GC");
+
+using namespace sling;
+
+// Build synthetic store. Every frame has a name and a link to an anonymous
+// data frame. Some of the data frames are replaced after the frame has been
+// created, which turns the old data frames and their strings into garbage.
+void BuildStore(Store *store) {
+  Handle n_name = store->Lookup("name");
+  Handle n_data = store->Lookup("data");
+  Handle n_value = store->Lookup("value");
+  Handle n_next = store->Lookup("next");
+  Handle prev = Handle::nil();
+  for (int i = 0; i < FLAGS_frames; ++i) {
+    string item = std::to_string(i);
+    Builder data(store);
+    data.Add(n_value, store->AllocateString("data for item " + item));
+    Builder b(store);
+    b.AddId("item" + item);
+    b.Add(n_name, store->AllocateString("item " + item));
+    b.Add(n_data, data.Create());
+    b.Add(n_next, prev);
+    Handle frame = b.Create().handle();
+    if (i % 100 < FLAGS_garbage) {
+      Builder replacement(store);
+      replacement.Add(n_value, i);
+      store->Set(frame, n_data, replacement.Create().handle());
+    }
+    prev = frame;
+  }
+}
+
+// Return all the handles owned by the store that are reachable from the symbol
+// table.
+std::vector<Handle> LiveHandles(const Store &store) {
+  MemoryUsage usage;
+  store.GetMemoryUsage(&usage, true);
+  std::vector<bool> visited(usage.num_handles);
+  std::vector<Handle> live;
+  std::vector<Handle> stack = {store.symbols()};
+  while (!stack.empty()) {
+    Handle h = stack.back();
+    stack.pop_back();
+    if (!h.IsRef() || h.IsNil() || !store.Owned(h)) continue;
+    int index = h.offset() / sizeof(Datum *);
+    if (visited[index]) continue;
+    visited[index] = true;
+    live.push_back(h);
+    const Datum *object = store.GetObject(h);
+    if (object->IsBinary()) continue;
+    Range range;
+    object->range(&range);
+    stack.insert(stack.end(), range.begin, range.end);
+  }
+  return live;
+}
+
+// Compare the live objects in the two stores.
+void CompareObjects(const Store &serial, const Store &parallel) {
+  std::vector<Handle> live = LiveHandles(serial);
+  CHECK_EQ(live.size(), LiveHandles(parallel).size())
+      << "Different number of live objects";
+  for (Handle h : live) {
+    const Datum *a = serial.GetObject(h);
+    const Datum *b = parallel.GetObject(h);
+    CHECK_EQ(a->info, b->info) << "Object type differs for handle " << h.raw();
+    CHECK(a->self == h && b->self == h) << "Bad self handle " << h.raw();
+    CHECK(memcmp(a->payload(), b->payload(), a->size()) == 0)
+        << "Object contents differ for handle " << h.raw();
+  }
+  std::cout << live.size() << " live objects match\n" << std::flush;
+}
+
+// Compare the handle free lists by allocating all the free handles in both
+// stores.
+void CompareFreeLists(Store *serial, Store *parallel) {
+  MemoryUsage usage;
+  serial->GetMemoryUsage(&usage);
+  int free_handles = usage.num_free_handles;
+  parallel->GetMemoryUsage(&usage);
+  CHECK_EQ(free_handles, usage.num_free_handles)
+      << "Different number of free handles";
+  for (int i = 0; i < free_handles; ++i) {
+    Handle a = serial->AllocateString(Text());
+    Handle b = parallel->AllocateString(Text());
+    CHECK(a == b) << "Free lists differ at handle " << i;
+  }
+  std::cout << free_handles << " free handles match\n" << std::flush;
+}
+
+// Build or load store and garbage collect it with a number of threads. GC is
+// locked while the store is built, so all the garbage is left for the final
+// collection.
+void Collect(const std::vector<string> &files, Store *store) {
+  store->LockGC();
+  if (files.empty()) {
+    BuildStore(store);
+  } else {
+    for (const string &file : files) LoadStore(file, store);
+  }
+  MemoryUsage usage;
+  store->GetMemoryUsage(&usage, true);
+  int64 before = usage.used_heap_bytes();
+  int64 gcs = usage.num_gcs;
+
+  // Unlocking the store runs the pending GC if the heaps were filled while the
+  // store was built.
+  Clock clock;
+  clock.start();
+  store->UnlockGC();
+  store->GetMemoryUsage(&usage, true);
+  if (usage.num_gcs == gcs) store->GC();
+  clock.stop();
+  store->GetMemoryUsage(&usage);
+  std::cout << store->options()->gc_threads << " threads: GC of "
+            << before << " bytes in " << clock.ms() << " ms, "
+            << usage.used_heap_bytes() << " bytes used, "
+            << usage.used_handles() << " handles used\n" << std::flush;
+  if (before < 64 * (1 << 20)) {
+    LOG(WARNING) << "Store is too small to be collected in parallel";
+  }
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  std::vector<string> files;
+  for (int i = 1; i < argc; ++i) {
+    File::Match(argv[i], &files);
+  }
+
+  Store::Options serial_options;
+  Store serial(&serial_options);
+  Collect(files, &serial);
+
+  Store::Options parallel_options;
+  parallel_options.gc_threads = FLAGS_threads;
+  Store parallel(&parallel_options);
+  Collect(files, &parallel);
+
+  CompareObjects(serial, parallel);
+  CompareFreeLists(&serial, &parallel);
+  std::cout << "parallel GC matches serial GC\n";
+
+  return 0;
+}
@@ -38,6 +38,8 @@ DEFINE_int32(index_page_size, options.index_page_size,
              "Number of entries in each index record");
 DEFINE_int32(index_cache_size, options.index_cache_size,
              "Size of index page cache");
+DEFINE_int32(bloom_bits_per_key, options.bloom_bits_per_key,
+             "Number of bits per key in Bloom filter (0 for no filter)");
 
 using namespace sling;
 
@@ -51,6 +53,7 @@ int main(int argc, char *argv[]) {
       static_cast<RecordFile::CompressionType>(FLAGS_compression);
   options.index_page_size = FLAGS_index_page_size;
   options.index_cache_size = FLAGS_index_cache_size;
+  options.bloom_bits_per_key = FLAGS_bloom_bits_per_key;
 
   // Get files to index.
   std::vector<string> files;
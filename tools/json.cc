@@ -0,0 +1,301 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark JSON parsing and writing throughput.
+//
+// The reader in JSON mode is compared with the JSON parser using scalar and
+// vectorized structural scanning. The input files have one JSON value per
+// line like the Wikidata dump. Without arguments, synthetic documents with a
+// structure similar to Wikidata entities are used.
+//
+// The JSON writer is benchmarked with scalar and vectorized escaping on the
+// frames in the store files given with --kb, e.g. the knowledge base items,
+// or on the parsed documents otherwise.
+
+#include <string.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/init.h"
+#include "sling/base/flags.h"
+#include "sling/base/logging.h"
+#include "sling/base/types.h"
+#include "sling/file/file.h"
+#include "sling/frame/json.h"
+#include "sling/frame/json-parser.h"
+#include "sling/frame/object.h"
+#include "sling/frame/reader.h"
+#include "sling/frame/serialization.h"
+#include "sling/frame/store.h"
+#include "sling/stream/memory.h"
+#include "sling/string/numbers.h"
+
+DEFINE_int32(documents, 10000, "Number of synthetic documents");
+DEFINE_int32(repeat, 3, "Number of passes over the documents");
+DEFINE_bool(check, true, "Check that parser output matches reader output");
+DEFINE_string(kb, "", "Store files with frames for writer benchmark");
+DEFINE_int32(floats, 10000000, "Number of floats for formatting benchmark");
+
+using namespace sling;
+
+// Create synthetic documents with labels, descriptions, aliases, and claims
+// like Wikidata entities.
+void CreateDocuments(std::vector<string> *docs) {
+  std::mt19937 rnd(0);
+  const char *langs[] = {"en", "de", "fr", "es", "it", "ja", "ru", "zh"};
+  auto text = [&rnd](int length) {
+    string s;
+    for (int i = 0; i < length; ++i) {
+      int r = rnd() % 50;
+      if (r == 0) {
+        s.append("\\u00e9");
+      } else if (r == 1) {
+        s.append("\\\"");
+      } else if (r < 8) {
+        s.push_back(' ');
+      } else {
+        s.push_back('a' + rnd() % 26);
+      }
+    }
+    return s;
+  };
+  for (int d = 0; d < FLAGS_documents; ++d) {
+    string id = "Q" + std::to_string(d);
+    string json = "{\"type\":\"item\",\"id\":\"" + id + "\",\"labels\":{";
+    for (int i = 0; i < 8; ++i) {
+      if (i > 0) json.append(",");
+      json.append("\"" + string(langs[i]) + "\":{\"language\":\"" + langs[i] +
+                  "\",\"value\":\"" + text(5 + rnd() % 20) + "\"}");
+    }
+    json.append("},\"descriptions\":{\"en\":{\"language\":\"en\",\"value\":\"" +
+                text(20 + rnd() % 60) + "\"}},\"claims\":{");
+    int properties = 1 + rnd() % 20;
+    for (int p = 0; p < properties; ++p) {
+      if (p > 0) json.append(",");
+      string pid = "P" + std::to_string(rnd() % 2000);
+      json.append("\"" + pid + "\":[");
+      int claims = 1 + rnd() % 3;
+      for (int c = 0; c < claims; ++c) {
+        if (c > 0) json.append(",");
+        json.append("{\"mainsnak\":{\"snaktype\":\"value\",\"property\":\"" +
+                    pid + "\",\"datavalue\":{\"value\":{\"entity-type\":"
+                    "\"item\",\"numeric-id\":" +
+                    std::to_string(rnd() % 10000000) +
+                    ",\"id\":\"Q" + std::to_string(rnd() % 10000000) +
+                    "\"},\"type\":\"wikibase-entityid\"},\"datatype\":"
+                    "\"wikibase-item\"},\"type\":\"statement\",\"rank\":"
+                    "\"normal\",\"precision\":" +
+                    std::to_string(rnd() % 10 / 3.0) + "}");
+      }
+      json.append("]");
+    }
+    json.append("}},");
+    docs->push_back(json);
+  }
+}
+
+// Read documents from files with one document per line.
+void ReadDocuments(const std::vector<string> &files,
+                   std::vector<string> *docs) {
+  for (const string &file : files) {
+    string contents;
+    CHECK(File::ReadContents(file, &contents));
+    size_t start = 0;
+    while (start < contents.size()) {
+      size_t end = contents.find('\n', start);
+      if (end == string::npos) end = contents.size();
+      if (end - start > 2) docs->push_back(contents.substr(start, end - start));
+      start = end + 1;
+    }
+  }
+}
+
+// Parse documents with reader in JSON mode.
+Handle ReadJSON(Store *store, const string &doc) {
+  ArrayInputStream stream(doc.data(), doc.size());
+  Input input(&stream);
+  Reader reader(store, &input);
+  reader.set_json(true);
+  return reader.Read().handle();
+}
+
+// Benchmark JSON writer on frames.
+void BenchmarkWriter(const Store &store, const Handles &frames) {
+  for (bool vectorized : {false, true}) {
+    bool simd = JSONWriter::Vectorize(vectorized);
+    if (vectorized && !simd) {
+      std::cout << "vectorized escaping not supported\n";
+      break;
+    }
+    int64 bytes = 0;
+    string json;
+    Clock clock;
+    clock.start();
+    for (int r = 0; r < FLAGS_repeat; ++r) {
+      for (Handle frame : frames) {
+        json.clear();
+        StringOutputStream stream(&json);
+        Output output(&stream);
+        JSONWriter writer(&store, &output);
+        writer.Write(frame);
+        output.Flush();
+        bytes += json.size();
+      }
+    }
+    clock.stop();
+    std::cout << (vectorized ? "vectorized" : "scalar") << " writer: "
+              << (bytes / (clock.secs() * 1e6)) << " MB/s, "
+              << (clock.us() / (frames.size() * FLAGS_repeat)) << " us/frame\n"
+              << std::flush;
+  }
+  JSONWriter::Vectorize(true);
+}
+
+// Benchmark float formatting.
+void BenchmarkFloats() {
+  std::mt19937 rnd(0);
+  std::vector<float> numbers(FLAGS_floats);
+  for (float &f : numbers) {
+    int r = rnd() % 3;
+    if (r == 0) {
+      f = (rnd() % 1000000) / 1000.0;
+    } else if (r == 1) {
+      f = rnd() % 100;
+    } else {
+      uint32 bits = rnd() & 0x7f7fffff;
+      memcpy(&f, &bits, sizeof(float));
+    }
+  }
+  char buffer[kFastToBufferSize];
+  int64 length = 0;
+  Clock clock;
+  clock.start();
+  for (float f : numbers) length += strlen(FloatToBuffer(f, buffer));
+  clock.stop();
+  double snprintf_time = clock.ns() / numbers.size();
+  clock.start();
+  for (float f : numbers) length += FastFloatToBufferLeft(f, buffer) - buffer;
+  clock.stop();
+  double shortest_time = clock.ns() / numbers.size();
+  std::cout << "float formatting: snprintf " << snprintf_time << " ns, "
+            << "shortest " << shortest_time << " ns, "
+            << length << " chars\n";
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  std::vector<string> files;
+  for (int i = 1; i < argc; ++i) {
+    File::Match(argv[i], &files);
+  }
+
+  std::vector<string> docs;
+  if (files.empty()) {
+    CreateDocuments(&docs);
+  } else {
+    ReadDocuments(files, &docs);
+  }
+  int64 bytes = 0;
+  for (const string &doc : docs) bytes += doc.size();
+  std::cout << docs.size() << " documents, " << bytes << " bytes\n";
+
+  Store commons;
+  commons.Freeze();
+
+  // Check that the parser produces the same frames as the reader, and that
+  // both reject objects with empty keys. One parser is re-targeted at a new
+  // store for each document.
+  if (FLAGS_check) {
+    JSONParser parser(&commons);
+    for (const string &doc : docs) {
+      Store s1(&commons);
+      Store s2(&commons);
+      parser.set_store(&s2);
+      Object obj = parser.Parse(doc);
+      CHECK(!parser.error()) << parser.error_message() << " at "
+                             << parser.error_position();
+      CHECK_EQ(ToText(&s1, ReadJSON(&s1, doc)), ToText(obj));
+    }
+    for (const char *doc : {"{\"\":1}", "{\"a\":[{\"\":{}}]}"}) {
+      Store s1(&commons);
+      Store s2(&commons);
+      JSONParser parser(&s2);
+      parser.Parse(doc);
+      CHECK(parser.error()) << doc;
+      CHECK(ReadJSON(&s1, doc).IsError()) << doc;
+    }
+  }
+
+  // Benchmark reader and parser.
+  for (int mode = 0; mode < 3; ++mode) {
+    const char *name = "reader";
+    if (mode > 0) {
+      bool vectorized = mode == 2;
+      bool simd = JSONParser::Vectorize(vectorized);
+      if (vectorized && !simd) {
+        std::cout << "vectorized scanning not supported\n";
+        break;
+      }
+      name = vectorized ? "vectorized parser" : "scalar parser";
+    }
+    Clock clock;
+    clock.start();
+    for (int r = 0; r < FLAGS_repeat; ++r) {
+      for (const string &doc : docs) {
+        Store store(&commons);
+        if (mode == 0) {
+          ReadJSON(&store, doc);
+        } else {
+          JSONParser parser(&store);
+          parser.Parse(doc);
+        }
+      }
+    }
+    clock.stop();
+    double mbs = bytes * FLAGS_repeat / (clock.secs() * 1e6);
+    std::cout << name << ": " << mbs << " MB/s, "
+              << (clock.us() / (docs.size() * FLAGS_repeat)) << " us/doc\n"
+              << std::flush;
+  }
+  JSONParser::Vectorize(true);
+
+  // Benchmark writer on frames from store files or the parsed documents.
+  Store store;
+  Handles frames(&store);
+  if (!FLAGS_kb.empty()) {
+    std::vector<string> kb;
+    File::Match(FLAGS_kb, &kb);
+    for (const string &file : kb) {
+      FileDecoder decoder(&store, file);
+      while (!decoder.done()) {
+        Object object = decoder.Decode();
+        if (object.IsFrame()) frames.push_back(object.handle());
+      }
+    }
+  } else {
+    for (const string &doc : docs) {
+      JSONParser parser(&store);
+      frames.push_back(parser.Parse(doc).handle());
+    }
+  }
+  std::cout << frames.size() << " frames\n";
+  BenchmarkWriter(store, frames);
+  BenchmarkFloats();
+
+  return 0;
+}
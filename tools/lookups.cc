@@ -0,0 +1,192 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark random frame lookups in large stores with and without huge pages.
+//
+// Each lookup finds a frame by id with LookupExisting() and follows a slot
+// value to another frame with Frame::Get(), which is dominated by the random
+// handle table and heap accesses. Without arguments, the benchmark is run on
+// a synthetic store. If store files are given as arguments, the benchmark is
+// run on the frames in these files.
+//
+// With --numa, the store is replicated on all NUMA nodes, and the lookup
+// latency is measured from each node both for the store itself and for the
+// node-local replica.
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/init.h"
+#include "sling/base/flags.h"
+#include "sling/base/logging.h"
+#include "sling/base/types.h"
+#include "sling/file/file.h"
+#include "sling/frame/object.h"
+#include "sling/frame/serialization.h"
+#include "sling/frame/store.h"
+#include "sling/util/numa.h"
+#include "sling/util/thread.h"
+
+DEFINE_int32(frames, 5000000, "Number of frames in synthetic store");
+DEFINE_int32(lookups, 10000000, "Number of lookups for each benchmark");
+DEFINE_int32(ids, 1000000, "Number of distinct ids to look up");
+DEFINE_bool(numa, false, "Benchmark lookups from each NUMA node");
+
+using namespace sling;
+
+// Create synthetic store where each frame has a name and links to other
+// random frames.
+void CreateStore(Store *store) {
+  std::mt19937 rnd(1);
+  std::uniform_int_distribution<int> target(0, FLAGS_frames - 1);
+  Handle name = store->Lookup("name");
+  Handle link = store->Lookup("link");
+  Handle other = store->Lookup("other");
+  for (int i = 0; i < FLAGS_frames; ++i) {
+    Builder b(store);
+    b.AddId("Q" + std::to_string(i));
+    b.Add(name, "item " + std::to_string(i));
+    b.Add(link, store->Lookup("Q" + std::to_string(target(rnd))));
+    b.Add(other, store->Lookup("Q" + std::to_string(target(rnd))));
+    b.Create();
+  }
+}
+
+// Get random sample of ids for frames with a link.
+void SampleIds(Store *store, Handle link, std::vector<string> *ids) {
+  std::vector<string> all;
+  store->ForAll([&](Handle handle) {
+    const Datum *datum = store->GetObject(handle);
+    if (!datum->IsFrame() || datum->IsProxy()) return;
+    const FrameDatum *frame = datum->AsFrame();
+    if (!frame->IsNamed() || !frame->has(link)) return;
+    Handle id = frame->get(Handle::id());
+    all.push_back(store->GetString(store->GetSymbol(id)->name)->str().str());
+  });
+  CHECK(!all.empty()) << "No frames to look up";
+  std::mt19937 rnd(2);
+  std::uniform_int_distribution<int> pick(0, all.size() - 1);
+  for (int i = 0; i < FLAGS_ids; ++i) ids->push_back(all[pick(rnd)]);
+}
+
+// Create and freeze store.
+void LoadStore(const std::vector<string> &files, Store *store) {
+  Clock clock;
+  clock.start();
+  if (files.empty()) {
+    CreateStore(store);
+  } else {
+    for (const string &file : files) LoadStore(file, store);
+  }
+  store->Freeze();
+  clock.stop();
+  std::cout << "store loaded in " << clock.ms() << " ms\n" << std::flush;
+}
+
+// Get link role for benchmark.
+Handle GetLink(const Store &store, const std::vector<string> &files) {
+  Handle link = store.LookupExisting(files.empty() ? "link" : "P31");
+  CHECK(!link.IsNil()) << "Link role not found";
+  return link;
+}
+
+// Look up frames by id and follow links. Returns the time per lookup in ns.
+double RunLookups(Store *store, const std::vector<string> &ids, Handle link) {
+  Handle name = store->LookupExisting("name");
+  int64 hits = 0;
+  Clock clock;
+  clock.start();
+  for (int i = 0; i < FLAGS_lookups; ++i) {
+    Handle handle = store->LookupExisting(ids[i % ids.size()]);
+    Frame frame(store, handle);
+    Object target = frame.Get(link);
+    if (target.IsFrame() && !target.AsFrame().Get(name).IsNil()) hits++;
+  }
+  clock.stop();
+  CHECK_GT(hits, 0);
+  return clock.ns() / FLAGS_lookups;
+}
+
+// Run benchmark on store with or without huge pages.
+void Benchmark(const std::vector<string> &files, bool huge_pages) {
+  const char *mode = huge_pages ? "huge pages: " : "normal pages: ";
+  Store::Options options;
+  options.huge_pages = huge_pages;
+  Store store(&options);
+  std::cout << mode;
+  LoadStore(files, &store);
+
+  Handle link = GetLink(store, files);
+  std::vector<string> ids;
+  SampleIds(&store, link, &ids);
+  double ns = RunLookups(&store, ids, link);
+  std::cout << mode << FLAGS_lookups << " lookups, " << ns << " ns/lookup, "
+            << (1e3 / ns) << " M lookups/s\n" << std::flush;
+
+  MemoryUsage usage;
+  store.GetMemoryUsage(&usage, true);
+  std::cout << mode << usage.memory_used() << " bytes used\n" << std::flush;
+}
+
+// Run benchmark from each NUMA node on store and node-local replica.
+void BenchmarkNUMA(const std::vector<string> &files) {
+  Store::Options options;
+  options.numa_replicas = true;
+  Store store(&options);
+  LoadStore(files, &store);
+  std::cout << NUMA::Nodes() << " NUMA nodes, "
+            << store.num_replicas() << " replicas\n" << std::flush;
+
+  Handle link = GetLink(store, files);
+  std::vector<string> ids;
+  SampleIds(&store, link, &ids);
+  for (int node = 0; node < NUMA::Nodes(); ++node) {
+    ClosureThread thread([&store, &ids, link, node]() {
+      if (!NUMA::RunOnNode(node)) {
+        std::cout << "node " << node << ": cannot run on node\n";
+        return;
+      }
+      Store primary(&store);
+      double remote = RunLookups(&primary, ids, link);
+      Store replica(store.replica());
+      double local = RunLookups(&replica, ids, link);
+      std::cout << "node " << node << ": " << remote << " ns/lookup on store, "
+                << local << " ns/lookup on replica\n" << std::flush;
+    });
+    thread.SetJoinable(true);
+    thread.Start();
+    thread.Join();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  std::vector<string> files;
+  for (int i = 1; i < argc; ++i) {
+    File::Match(argv[i], &files);
+  }
+
+  if (FLAGS_numa) {
+    BenchmarkNUMA(files);
+  } else {
+    Benchmark(files, false);
+    Benchmark(files, true);
+  }
+
+  return 0;
+}
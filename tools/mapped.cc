@@ -0,0 +1,97 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Check that memory-mapped snapshots are not modified when they are loaded.
+//
+// A synthetic store with many identical strings is saved as a snapshot without
+// coalescing the strings. The snapshot is then loaded with the coalesce_strings
+// option both into memory and memory-mapped. Freezing the store read into
+// memory must coalesce the strings, whereas the mapped store must be left
+// unchanged, since the mapped heaps are shared with other processes.
+
+#include <iostream>
+#include <string>
+
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/base/types.h"
+#include "sling/file/file.h"
+#include "sling/frame/object.h"
+#include "sling/frame/snapshot.h"
+#include "sling/frame/store.h"
+
+DEFINE_int32(frames, 10000, "Number of frames in synthetic store");
+DEFINE_string(dir, "/tmp", "Directory for snapshot file");
+
+using namespace sling;
+
+// Build synthetic store where every frame has the same description.
+void BuildStore(Store *store) {
+  Handle n_name = store->Lookup("name");
+  Handle n_description = store->Lookup("description");
+  for (int i = 0; i < FLAGS_frames; ++i) {
+    string item = std::to_string(i);
+    Builder b(store);
+    b.AddId("item" + item);
+    b.Add(n_name, store->AllocateString("item " + item));
+    b.Add(n_description, store->AllocateString("synthetic item"));
+    b.Create();
+  }
+}
+
+// Return the number of coalesced strings in store.
+int Coalesced(const Store &store) {
+  MemoryUsage usage;
+  store.GetMemoryUsage(&usage, true);
+  return usage.num_coalesced_strings;
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+  string filename = FLAGS_dir + "/mapped.sling";
+
+  // Write snapshot without coalescing strings.
+  {
+    Store store;
+    BuildStore(&store);
+    store.Freeze();
+    CHECK(Snapshot::Write(&store, filename));
+  }
+
+  // Strings are coalesced when the store read into memory is frozen.
+  Store::Options options;
+  options.coalesce_strings = true;
+  {
+    Store store(&options);
+    CHECK(Snapshot::Read(&store, filename, false));
+    store.Freeze();
+    std::cout << "read: " << Coalesced(store) << " strings coalesced\n";
+    CHECK_GT(Coalesced(store), 0);
+  }
+
+  // Strings are not coalesced in the mapped heaps.
+  {
+    Store store(&options);
+    CHECK(Snapshot::Read(&store, filename, true));
+    CHECK(store.frozen());
+    std::cout << "mapped: " << Coalesced(store) << " strings coalesced\n";
+    CHECK_EQ(Coalesced(store), 0);
+  }
+
+  CHECK(File::Delete(filename + ".snap"));
+  std::cout << "mapped snapshot is unchanged\n";
+
+  return 0;
+}
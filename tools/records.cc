@@ -0,0 +1,208 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark reading record files with buffered and memory-mapped readers.
+//
+// Each record file is read sequentially, and records are looked up by key
+// through the record file index. With --threads, the lookups are also done
+// concurrently from multiple threads, and with --batch, the keys are also
+// looked up in batches. Without arguments, the benchmark is run on synthetic
+// uncompressed, snappy-compressed, and block-compressed record files. The
+// read throughput is reported in MB/s of uncompressed record data.
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/base/types.h"
+#include "sling/file/file.h"
+#include "sling/file/recordio.h"
+#include "sling/util/thread.h"
+
+DEFINE_int32(records, 1000000, "Number of records in synthetic record files");
+DEFINE_int32(value_size, 200, "Average value size for synthetic records");
+DEFINE_int32(block_size, 64 * 1024, "Block size for block-compressed records");
+DEFINE_int32(bloom_bits_per_key, 10, "Bits per key in Bloom filter");
+DEFINE_int32(lookups, 1000000, "Number of key lookups");
+DEFINE_int32(batch, 0, "Number of keys in each batch lookup");
+DEFINE_int32(threads, 0, "Number of threads for concurrent lookups");
+DEFINE_string(dir, "/tmp", "Directory for synthetic record files");
+
+using namespace sling;
+
+// Write synthetic indexed record file.
+void WriteRecords(const string &filename,
+                  RecordFile::CompressionType compression) {
+  RecordFileOptions options;
+  options.compression = compression;
+  options.block_size = FLAGS_block_size;
+  options.indexed = true;
+  options.bloom_bits_per_key = FLAGS_bloom_bits_per_key;
+  RecordWriter writer(filename, options);
+  std::mt19937 rnd(1);
+  std::uniform_int_distribution<int> size(0, 2 * FLAGS_value_size);
+  string value;
+  for (int i = 0; i < FLAGS_records; ++i) {
+    value.resize(size(rnd));
+    for (char &c : value) c = 'a' + rnd() % 4;
+    CHECK(writer.Write("key" + std::to_string(i), value));
+  }
+  CHECK(writer.Close());
+}
+
+// Read all records in file sequentially and return the time in ms. The
+// number of record data bytes is returned in bytes.
+double ReadAll(const string &filename, const RecordFileOptions &options,
+               std::vector<string> *keys, int64 *bytes) {
+  Clock clock;
+  clock.start();
+  RecordReader reader(filename, options);
+  Record record;
+  *bytes = 0;
+  while (!reader.Done()) {
+    CHECK(reader.Read(&record));
+    *bytes += record.key.size() + record.value.size();
+    if (keys != nullptr) keys->push_back(record.key.str());
+  }
+  clock.stop();
+  return clock.ms();
+}
+
+// Look up random keys and return the time per lookup in ns.
+double LookupAll(const string &filename, const RecordFileOptions &options,
+                 const std::vector<string> &keys) {
+  RecordDatabase db(std::vector<string>{filename}, options);
+  std::mt19937 rnd(2);
+  std::uniform_int_distribution<int> pick(0, keys.size() - 1);
+  Record record;
+  Clock clock;
+  clock.start();
+  for (int i = 0; i < FLAGS_lookups; ++i) {
+    CHECK(db.Lookup(keys[pick(rnd)], &record));
+  }
+  clock.stop();
+  return clock.ns() / FLAGS_lookups;
+}
+
+// Look up random keys in batches and return the time per lookup in ns.
+double LookupBatches(const string &filename, const RecordFileOptions &options,
+                     const std::vector<string> &keys) {
+  RecordDatabase db(std::vector<string>{filename}, options);
+  std::mt19937 rnd(2);
+  std::uniform_int_distribution<int> pick(0, keys.size() - 1);
+  RecordReadBuffers buffers;
+  std::vector<Slice> batch;
+  int64 found = 0;
+  Clock clock;
+  clock.start();
+  for (int i = 0; i < FLAGS_lookups; i += FLAGS_batch) {
+    batch.clear();
+    for (int j = 0; j < FLAGS_batch; ++j) batch.push_back(keys[pick(rnd)]);
+    found += db.LookupBatch(batch, &buffers, [](int, const Record &) {});
+  }
+  clock.stop();
+  CHECK_GE(found, FLAGS_lookups);
+  return clock.ns() / found;
+}
+
+// Look up random keys concurrently and return the number of lookups per
+// second.
+double LookupConcurrent(const string &filename,
+                        const RecordFileOptions &options,
+                        const std::vector<string> &keys) {
+  RecordDatabase db(std::vector<string>{filename}, options);
+  Clock clock;
+  clock.start();
+  WorkerPool pool;
+  pool.Start(FLAGS_threads, [&](int index) {
+    std::mt19937 rnd(index);
+    std::uniform_int_distribution<int> pick(0, keys.size() - 1);
+    RecordReadBuffers buffers;
+    Record record;
+    for (int i = 0; i < FLAGS_lookups; ++i) {
+      CHECK(db.Lookup(keys[pick(rnd)], &record, &buffers));
+    }
+  });
+  pool.Join();
+  clock.stop();
+  return FLAGS_threads * FLAGS_lookups / clock.secs();
+}
+
+// Benchmark buffered and memory-mapped reading of record file.
+void Benchmark(const string &filename) {
+  std::vector<string> keys;
+  int64 bytes;
+  ReadAll(filename, RecordFileOptions(), &keys, &bytes);
+  CHECK(!keys.empty()) << "No records in " << filename;
+  uint64 size;
+  CHECK(File::GetSize(filename, &size));
+  std::cout << filename << ": " << size << " bytes on disk, " << bytes
+            << " bytes of record data\n" << std::flush;
+  for (bool mapped : {false, true}) {
+    RecordFileOptions options;
+    options.memory_map = mapped;
+    const char *mode = mapped ? "mapped" : "buffered";
+    double ms = ReadAll(filename, options, nullptr, &bytes);
+    std::cout << filename << ": " << mode << " read of " << keys.size()
+              << " records in " << ms << " ms, " << (bytes / ms / 1e3)
+              << " MB/s\n" << std::flush;
+    RecordReader reader(filename, options);
+    if (reader.info().index_start != 0) {
+      double ns = LookupAll(filename, options, keys);
+      std::cout << filename << ": " << mode << " lookup " << ns
+                << " ns/record\n" << std::flush;
+      if (FLAGS_batch > 0) {
+        double ns = LookupBatches(filename, options, keys);
+        std::cout << filename << ": " << mode << " batch lookup " << ns
+                  << " ns/record\n" << std::flush;
+      }
+      if (FLAGS_threads > 0) {
+        double rate = LookupConcurrent(filename, options, keys);
+        std::cout << filename << ": " << mode << " concurrent lookup with "
+                  << FLAGS_threads << " threads " << rate
+                  << " records/s\n" << std::flush;
+      }
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  std::vector<string> files;
+  for (int i = 1; i < argc; ++i) {
+    File::Match(argv[i], &files);
+  }
+
+  if (files.empty()) {
+    string plain = FLAGS_dir + "/records-uncompressed.rec";
+    string snappy = FLAGS_dir + "/records-snappy.rec";
+    string block = FLAGS_dir + "/records-block.rec";
+    WriteRecords(plain, RecordFile::UNCOMPRESSED);
+    WriteRecords(snappy, RecordFile::SNAPPY);
+    WriteRecords(block, RecordFile::BLOCK_SNAPPY);
+    files.push_back(plain);
+    files.push_back(snappy);
+    files.push_back(block);
+  }
+
+  for (const string &file : files) Benchmark(file);
+
+  return 0;
+}
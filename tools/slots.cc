@@ -0,0 +1,260 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark slot lookups in frames.
+//
+// Without arguments, the slot index is benchmarked on synthetic frames of
+// increasing width, and slot scanning is benchmarked on synthetic frames with
+// a frame size distribution similar to the knowledge base. If store files are
+// given as arguments, slot scanning is benchmarked on the frames in these
+// files.
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/init.h"
+#include "sling/base/flags.h"
+#include "sling/base/logging.h"
+#include "sling/base/types.h"
+#include "sling/file/file.h"
+#include "sling/frame/object.h"
+#include "sling/frame/serialization.h"
+#include "sling/frame/store.h"
+
+DEFINE_int32(frames, 10000, "Number of frames for each frame width");
+DEFINE_int32(names, 1000, "Number of distinct slot names");
+DEFINE_int32(lookups, 10000000, "Number of slot lookups for each benchmark");
+DEFINE_int32(slot_index_threshold, 64, "Minimum slots for indexed frames");
+DEFINE_int32(min_width, 4, "Number of slots in narrowest frames");
+DEFINE_int32(max_width, 1024, "Number of slots in widest frames");
+
+using namespace sling;
+
+// Benchmark slot lookups in frames with a certain number of slots with and
+// without slot index.
+void BenchmarkIndex(int width, bool indexed) {
+  // Create global store with frames.
+  Store::Options options;
+  options.slot_index_threshold = indexed ? FLAGS_slot_index_threshold : 0;
+  Store store(&options);
+  Handles names(&store);
+  for (int i = 0; i < FLAGS_names; ++i) {
+    names.push_back(store.Lookup("P" + std::to_string(i)));
+  }
+  std::mt19937 rnd(width);
+  Handles frames(&store);
+  for (int i = 0; i < FLAGS_frames; ++i) {
+    Builder b(&store);
+    for (int j = 0; j < width; ++j) {
+      b.Add(names[rnd() % names.size()], j);
+    }
+    frames.push_back(b.Create().handle());
+  }
+  store.Freeze();
+
+  // Look up random slot names in random frames.
+  Clock clock;
+  clock.start();
+  int64 hits = 0;
+  for (int i = 0; i < FLAGS_lookups; ++i) {
+    Frame frame(&store, frames[rnd() % frames.size()]);
+    Handle name = names[rnd() % names.size()];
+    if (frame.Has(name)) hits++;
+    if (!frame.GetHandle(name).IsNil()) hits++;
+  }
+  clock.stop();
+
+  MemoryUsage usage;
+  store.GetMemoryUsage(&usage, true);
+  std::cout << "width " << width << (indexed ? " indexed" : " linear")
+            << ": " << (clock.ns() / (FLAGS_lookups * 2.0)) << " ns/lookup"
+            << ", " << hits << " hits"
+            << ", " << usage.num_indexed_frames << " indexed frames"
+            << ", " << usage.slot_index_bytes << " bytes index\n"
+            << std::flush;
+}
+
+// Create synthetic frames with a frame size distribution similar to the
+// knowledge base, i.e. mostly small frames with a long tail of items with
+// hundreds of slots. The slot names follow a skewed distribution where a few
+// properties are used in most frames.
+void CreateFrames(Store *store, Handles *frames, Handles *names,
+                  Handles *types) {
+  for (int i = 0; i < FLAGS_names; ++i) {
+    names->push_back(store->Lookup("P" + std::to_string(i)));
+  }
+  for (int i = 0; i < 100; ++i) {
+    types->push_back(store->Lookup("Q" + std::to_string(i)));
+  }
+  std::mt19937 rnd(0);
+  std::geometric_distribution<int> width(0.1);
+  std::geometric_distribution<int> property(0.02);
+  for (int i = 0; i < FLAGS_frames; ++i) {
+    int slots = 2 + width(rnd);
+    if (rnd() % 100 == 0) slots *= 20;
+    Builder b(store);
+    b.AddIsA((*types)[rnd() % types->size()]);
+    for (int j = 0; j < slots; ++j) {
+      b.Add((*names)[property(rnd) % names->size()], j);
+    }
+    frames->push_back(b.Create().handle());
+  }
+}
+
+// Read frames from store files.
+void ReadFrames(Store *store, const std::vector<string> &files,
+                Handles *frames, Handles *names, Handles *types) {
+  for (const string &file : files) {
+    FileDecoder decoder(store, file);
+    while (!decoder.done()) {
+      Object object = decoder.Decode();
+      if (!object.IsFrame()) continue;
+      Frame frame = object.AsFrame();
+      frames->push_back(frame.handle());
+      for (const Slot &s : frame) {
+        if (s.name.IsId()) continue;
+        if (s.name.IsIsA()) {
+          types->push_back(s.value);
+        } else {
+          names->push_back(s.name);
+        }
+      }
+    }
+  }
+}
+
+// Benchmark scalar and vectorized slot scanning.
+void BenchmarkScan(const std::vector<string> &files) {
+  Store store;
+  Handles frames(&store);
+  Handles names(&store);
+  Handles types(&store);
+  if (files.empty()) {
+    CreateFrames(&store, &frames, &names, &types);
+  } else {
+    ReadFrames(&store, files, &frames, &names, &types);
+  }
+  CHECK(!frames.empty());
+  CHECK(!names.empty());
+  if (types.empty()) types.push_back(Handle::nil());
+
+  // Output frame size distribution.
+  int64 total_slots = 0;
+  std::vector<int> histogram(5);
+  for (Handle h : frames) {
+    int slots = store.GetFrame(h)->slots();
+    total_slots += slots;
+    if (slots < 4) {
+      histogram[0]++;
+    } else if (slots < 8) {
+      histogram[1]++;
+    } else if (slots < 32) {
+      histogram[2]++;
+    } else if (slots < 128) {
+      histogram[3]++;
+    } else {
+      histogram[4]++;
+    }
+  }
+  std::cout << frames.size() << " frames, "
+            << (total_slots * 1.0 / frames.size()) << " slots/frame, "
+            << "<4: " << histogram[0] << ", "
+            << "4-7: " << histogram[1] << ", "
+            << "8-31: " << histogram[2] << ", "
+            << "32-127: " << histogram[3] << ", "
+            << ">=128: " << histogram[4] << "\n";
+
+  // Generate random queries. The store is frozen so the frames do not move.
+  store.Freeze();
+  struct Query {
+    const FrameDatum *frame;
+    Handle name;
+    Handle type;
+  };
+  std::vector<Query> queries(FLAGS_lookups);
+  std::mt19937 rnd(0);
+  for (Query &q : queries) {
+    q.frame = store.GetFrame(frames[rnd() % frames.size()]);
+    q.name = names[rnd() % names.size()];
+    q.type = types[rnd() % types.size()];
+  }
+
+  // Run lookups with scalar and vectorized slot scanning.
+  for (bool vectorized : {false, true}) {
+    bool simd = SlotScan::Vectorize(vectorized);
+    if (vectorized && !simd) {
+      std::cout << "vectorized slot scanning not supported\n";
+      break;
+    }
+    int64 hits = 0;
+    Clock clock;
+    clock.start();
+    for (const Query &q : queries) {
+      if (!q.frame->get(q.name).IsNil()) hits++;
+    }
+    clock.stop();
+    double get_time = clock.ns() / queries.size();
+
+    clock.start();
+    for (const Query &q : queries) {
+      if (q.frame->isa(q.type)) hits++;
+    }
+    clock.stop();
+    double isa_time = clock.ns() / queries.size();
+
+    clock.start();
+    for (const Query &q : queries) {
+      const FrameDatum *f = q.frame;
+      for (const Slot *s = f->next(q.name, f->begin()); s < f->end();
+           s = f->next(q.name, s + 1)) {
+        hits++;
+      }
+    }
+    clock.stop();
+    double all_time = clock.ns() / queries.size();
+
+    std::cout << (vectorized ? "vectorized" : "scalar") << ": "
+              << "get " << get_time << " ns, "
+              << "isa " << isa_time << " ns, "
+              << "all " << all_time << " ns, "
+              << hits << " hits\n" << std::flush;
+  }
+  SlotScan::Vectorize(true);
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  std::vector<string> files;
+  for (int i = 1; i < argc; ++i) {
+    File::Match(argv[i], &files);
+  }
+
+  if (files.empty()) {
+    // Benchmark with and without slot index for increasing frame widths.
+    for (int width = FLAGS_min_width; width <= FLAGS_max_width; width *= 4) {
+      for (bool indexed : {false, true}) {
+        BenchmarkIndex(width, indexed);
+      }
+    }
+  }
+
+  // Benchmark slot scanning.
+  BenchmarkScan(files);
+
+  return 0;
+}
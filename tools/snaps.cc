@@ -16,20 +16,91 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 
+#include "sling/base/clock.h"
 #include "sling/base/init.h"
 #include "sling/base/flags.h"
 #include "sling/base/logging.h"
 #include "sling/base/types.h"
+#include "sling/frame/decoder.h"
+#include "sling/frame/inverse-index.h"
 #include "sling/frame/serialization.h"
 #include "sling/frame/snapshot.h"
 #include "sling/frame/store.h"
 
 DEFINE_bool(check, false, "Check for valid snapshot");
 DEFINE_bool(verify, false, "Check snapshot by reading it into memory");
+DEFINE_bool(benchmark, false, "Benchmark loading store with snapshots");
+DEFINE_bool(perfect_symbols, false, "Save perfect symbol table in snapshot");
+DEFINE_bool(coalesce_strings, false, "Merge identical strings in snapshot");
+DEFINE_int32(gc_threads, 1, "Number of threads for garbage collecting stores");
+DEFINE_bool(map, false, "Memory-map snapshot when checking it with --verify");
+DEFINE_string(inverse_roles, "", "Comma-separated roles for inverse index");
 
 using namespace sling;
 
+// Benchmark loading store from snapshot and from encoded store.
+void Benchmark(const string &file) {
+  Clock clock;
+  for (bool map : {false, true}) {
+    clock.start();
+    Store store;
+    CHECK(Snapshot::Read(&store, file, map));
+    clock.stop();
+    std::cout << file << ": " << (map ? "mapped" : "read")
+              << " snapshot in " << clock.ms() << " ms\n" << std::flush;
+  }
+
+  // Write the store as a version 1 snapshot, which has no handle table, and
+  // read it back. This rebuilds the handle table by walking the heaps.
+  string legacy = file + ".v1";
+  {
+    Store store;
+    CHECK(Snapshot::Read(&store, file));
+    CHECK(Snapshot::Write(&store, legacy, 1));
+  }
+  {
+    clock.start();
+    Store store;
+    CHECK(Snapshot::Read(&store, legacy));
+    clock.stop();
+  }
+  std::cout << file << ": read v1 snapshot in " << clock.ms() << " ms\n"
+            << std::flush;
+  CHECK(File::Delete(legacy + ".snap"));
+
+  clock.start();
+  Store store;
+  FileDecoder decoder(&store, file);
+  store.LockGC();
+  decoder.DecodeAll();
+  store.UnlockGC();
+  clock.stop();
+  std::cout << file << ": decoded store in " << clock.ms() << " ms\n";
+}
+
+// Build inverse index for store and save it next to the snapshot.
+void BuildInverseIndex(Store *store, const string &file) {
+  std::vector<Handle> roles;
+  const string &names = FLAGS_inverse_roles;
+  size_t start = 0;
+  while (start <= names.size()) {
+    size_t end = names.find(',', start);
+    if (end == string::npos) end = names.size();
+    if (end > start) {
+      Handle role = store->LookupExisting(names.substr(start, end - start));
+      if (!role.IsNil()) roles.push_back(role);
+    }
+    start = end + 1;
+  }
+
+  InverseIndex index;
+  CHECK(index.Build(store, roles));
+  CHECK(index.Write(file));
+  std::cout << "(" << index.num_edges() << " edges) " << std::flush;
+}
+
 int main(int argc, char *argv[]) {
   InitProgram(&argc, &argv);
 
@@ -40,24 +111,39 @@ int main(int argc, char *argv[]) {
   }
 
   for (const string &file : files) {
-    if (FLAGS_check) {
+    if (FLAGS_benchmark) {
+      Benchmark(file);
+    } else if (FLAGS_check) {
       bool valid = Snapshot::Valid(file);
       std::cout << file << ": " << (valid ? "valid" : "INVALID") << "\n";
     } else if (FLAGS_verify) {
       std::cout << file << ": " << std::flush;
       std::cout << "load " << std::flush;
       Store store;
-      CHECK(Snapshot::Read(&store, file));
+      CHECK(Snapshot::Read(&store, file, FLAGS_map));
       std::cout << "done\n" << std::flush;
     } else {
       std::cout << file << ": " << std::flush;
       std::cout << "load " << std::flush;
-      Store store;
+      Store::Options options;
+      options.perfect_symbols = FLAGS_perfect_symbols;
+      options.coalesce_strings = FLAGS_coalesce_strings;
+      options.gc_threads = FLAGS_gc_threads;
+      Store store(&options);
       LoadStore(file, &store);
       std::cout << "freeze " << std::flush;
       store.Freeze();
+      if (FLAGS_coalesce_strings) {
+        MemoryUsage usage;
+        store.GetMemoryUsage(&usage, true);
+        std::cout << "(" << usage.coalesced_bytes << " bytes coalesced) ";
+      }
       std::cout << "snapshot " << std::flush;
       CHECK(Snapshot::Write(&store, file));
+      if (!FLAGS_inverse_roles.empty()) {
+        std::cout << "index " << std::flush;
+        BuildInverseIndex(&store, file);
+      }
       std::cout << "done\n" << std::flush;
     }
   }
@@ -0,0 +1,161 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Check that loading store files in parallel gives the same store as loading
+// them sequentially.
+//
+// The store files are loaded with LoadStores() using one thread and using
+// --threads threads, and the named frames in the two stores are compared.
+// References to frames that are no longer bound to their ids are reported as
+// stale. Without arguments, the check is run on synthetic text and record
+// files where later files redefine frames from earlier files, add ids to
+// existing frames, and refer to frames defined in later files.
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/base/types.h"
+#include "sling/file/file.h"
+#include "sling/file/recordio.h"
+#include "sling/frame/object.h"
+#include "sling/frame/serialization.h"
+#include "sling/frame/store.h"
+
+DEFINE_int32(files, 8, "Number of synthetic store files");
+DEFINE_int32(frames, 10000, "Number of frames in each synthetic store file");
+DEFINE_int32(threads, 4, "Number of threads for parallel loading");
+DEFINE_string(dir, "/tmp", "Directory for synthetic store files");
+
+using namespace sling;
+
+// Return text for synthetic frame. Every tenth frame in the files after the
+// first redefines a frame from the previous file under an additional alias.
+string SyntheticFrame(int file, int i, std::mt19937 *rnd) {
+  int total = FLAGS_files * FLAGS_frames;
+  string link = "item" + std::to_string((*rnd)() % total);
+  if (file > 0 && i % 10 == 0) {
+    string item = std::to_string((file - 1) * FLAGS_frames + i);
+    return "{=item" + item + " =alias" + item + " name: \"redefined in " +
+           std::to_string(file) + "\" link: " + link + "}";
+  }
+  string item = std::to_string(file * FLAGS_frames + i);
+  return "{=item" + item + " name: \"item " + item + "\" link: " + link + "}";
+}
+
+// Write synthetic store files. The last file is a record file with small
+// chunks, which are loaded as separate parts.
+void WriteStores(std::vector<string> *files) {
+  std::mt19937 rnd(1);
+  for (int f = 0; f < FLAGS_files; ++f) {
+    if (f < FLAGS_files - 1) {
+      string filename = FLAGS_dir + "/stores-" + std::to_string(f) + ".sling";
+      string text;
+      for (int i = 0; i < FLAGS_frames; ++i) {
+        text.append(SyntheticFrame(f, i, &rnd));
+        text.push_back('\n');
+      }
+      CHECK(File::WriteContents(filename, text));
+      files->push_back(filename);
+    } else {
+      string filename = FLAGS_dir + "/stores-" + std::to_string(f) + ".rec";
+      RecordFileOptions options;
+      options.chunk_size = 64 * 1024;
+      RecordWriter writer(filename, options);
+      for (int i = 0; i < FLAGS_frames; ++i) {
+        Store store;
+        Object frame = FromText(&store, SyntheticFrame(f, i, &rnd));
+        CHECK(writer.Write(Encode(frame)));
+      }
+      CHECK(writer.Close());
+      files->push_back(filename);
+    }
+  }
+}
+
+// Return the id of a named frame.
+Text FrameId(const Store &store, const FrameDatum *frame) {
+  Handle id = frame->get(Handle::id());
+  return store.GetString(store.GetSymbol(id)->name)->str();
+}
+
+// Dump the named frames in the store in id order and count the references to
+// frames that are no longer bound to their ids.
+string Dump(Store *store, int *stale) {
+  std::vector<string> frames;
+  *stale = 0;
+  store->ForAll([&](Handle handle) {
+    const Datum *datum = store->GetObject(handle);
+    if (!datum->IsFrame() || datum->IsProxy()) return;
+    const FrameDatum *frame = datum->AsFrame();
+    if (!frame->IsNamed()) return;
+    if (store->LookupExisting(FrameId(*store, frame)) != handle) return;
+    for (const Slot *slot = frame->begin(); slot < frame->end(); ++slot) {
+      if (slot->name.IsId() || !slot->value.IsRef()) continue;
+      if (slot->value.IsNil()) continue;
+      const Datum *target = store->GetObject(slot->value);
+      if (!target->IsFrame() || !target->AsFrame()->IsNamed()) continue;
+      Text id = FrameId(*store, target->AsFrame());
+      if (store->LookupExisting(id) != slot->value) (*stale)++;
+    }
+    frames.push_back(ToText(store, handle));
+  });
+  std::sort(frames.begin(), frames.end());
+  string dump;
+  for (const string &frame : frames) {
+    dump.append(frame);
+    dump.push_back('\n');
+  }
+  return dump;
+}
+
+// Load store files with a number of threads and return dump of the store.
+string Load(const std::vector<string> &files, int threads) {
+  Clock clock;
+  clock.start();
+  Store store;
+  LoadStores(files, &store, threads);
+  clock.stop();
+  store.GC();
+  int stale;
+  string dump = Dump(&store, &stale);
+  std::cout << threads << " threads: loaded in " << clock.ms() << " ms, "
+            << dump.size() << " bytes of frames, " << stale
+            << " stale references\n" << std::flush;
+  CHECK_EQ(stale, 0);
+  return dump;
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  std::vector<string> files;
+  for (int i = 1; i < argc; ++i) {
+    File::Match(argv[i], &files);
+  }
+  if (files.empty()) WriteStores(&files);
+
+  string sequential = Load(files, 1);
+  string parallel = Load(files, FLAGS_threads);
+  CHECK(sequential == parallel) << "Parallel load differs from sequential";
+  std::cout << "parallel load matches sequential load\n";
+
+  return 0;
+}